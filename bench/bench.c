@@ -0,0 +1,358 @@
+/**
+ * Measures how fast the emulator core runs on the host. The core options are
+ * set by the benchmark target, so that builds with different options can be
+ * compared.
+ *
+ * Usage: bench [-direct] [-lcd] [-frames n] [rom.gb]
+ *
+ * Without a ROM file, a built in ROM runs nested loops of loads, stores, ALU
+ * operations, calls and compares followed by branches from ROM, which include
+ * every pair run as a superinstruction. The time taken by each instruction is
+ * also reported. With -direct, ROM and cart RAM are mapped with
+ * gb_init_direct() instead of being read through the callbacks.
+ *
+ * The share of the cycles that were skipped in idle loops is reported for
+ * each ROM, and builds with the block cache report when it is bypassed because
+ * ROM is mapped directly. Builds with PEANUT_GB_SUPERINSTRUCTION_STATS print how often each
+ * superinstruction was run.
+ *
+ * With -lcd, lines are drawn and passed to lcd_draw_line(). The built in ROM
+ * then halts instead, with VRAM and OAM filled with random tiles, maps and
+ * sprites, so that most of the time is spent drawing lines.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+/* MAP_ANONYMOUS, for the buffer of the JIT. */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "peanut_gb.h"
+
+#if PEANUT_GB_USE_JIT
+# include <sys/mman.h>
+
+# define JIT_CODE_SIZE		0x40000
+#endif
+
+#define DEFAULT_FRAMES		600
+
+/* Instructions and clock cycles of each pass through the built in loop. */
+#define LOOP_INSTRUCTIONS	153
+#define LOOP_CYCLES		1144
+
+/* Duration of a frame on the Game Boy in nanoseconds. */
+#define FRAME_NS		(1e9 * LCD_LINE_CYCLES * LCD_VERT_LINES / \
+				 DMG_CLOCK_FREQ)
+
+static uint8_t *rom;
+static size_t rom_size;
+static uint8_t *cart_ram;
+
+/* Keeps the lines drawn from being optimised away. */
+static volatile uint8_t lcd_pixel;
+
+static uint8_t bench_rom_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	(void)gb;
+	return addr < rom_size ? rom[addr] : 0xFF;
+}
+
+static uint8_t bench_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	(void)gb;
+	return cart_ram[addr];
+}
+
+static void bench_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
+		const uint8_t val)
+{
+	(void)gb;
+	cart_ram[addr] = val;
+}
+
+static void bench_error(struct gb_s *gb, const enum gb_error_e err,
+		const uint16_t addr)
+{
+	(void)gb;
+	fprintf(stderr, "emulator error %d at 0x%04X\n", (int)err, addr);
+	exit(EXIT_FAILURE);
+}
+
+static void bench_lcd_draw_line(struct gb_s *gb, const uint8_t *pixels,
+		const uint_fast8_t line)
+{
+	(void)gb;
+	lcd_pixel = pixels[line % LCD_WIDTH];
+}
+
+/**
+ * Builds the ROM that is run when no ROM file is given.
+ */
+static void build_rom(int lcd)
+{
+	static const uint8_t loop_code[] = {
+		0x21, 0x00, 0xC0,	/* LD HL, 0xC000 */
+		0x11, 0x00, 0xC1,	/* LD DE, 0xC100 */
+		0x0E, 0x04,		/* outer: LD C, 4 */
+		0x06, 0x04,		/* mid: LD B, 4 */
+		0x2A,			/* inner: LD A, (HL+) */
+		0x12,			/* LD (DE), A */
+		0x1C,			/* INC E */
+		0x80,			/* ADD A, B */
+		0xCB, 0x37,		/* SWAP A */
+		0x05,			/* DEC B */
+		0x20, 0xF7,		/* JR NZ, inner */
+		0x7D,			/* LD A, L */
+		0xE6, 0x3F,		/* AND 0x3F */
+		0x6F,			/* LD L, A */
+		0xCD, 0x00, 0x02,	/* CALL 0x0200 */
+		0x0D,			/* DEC C */
+		0x20, 0xEB,		/* JR NZ, mid */
+		0xAF,			/* XOR A */
+		0xB1,			/* OR C */
+		0x20, 0x00,		/* JR NZ, +0 */
+		0xFE, 0x00,		/* CP 0x00 */
+		0x28, 0x00,		/* JR Z, +0 */
+		0xFE, 0x01,		/* CP 0x01 */
+		0x20, 0x00,		/* JR NZ, +0 */
+		0x18, 0xDB		/* JR outer */
+	};
+	/* The CPU halts until each VBlank interrupt. */
+	static const uint8_t lcd_code[] = {
+		0x3E, 0x01,		/* LD A, 0x01 */
+		0xE0, 0xFF,		/* LDH (IE), A */
+		0xFB,			/* EI */
+		0x76,			/* loop: HALT */
+		0x18, 0xFD		/* JR loop */
+	};
+	uint8_t x = 0;
+	uint_fast16_t i;
+
+	rom_size = 0x8000;
+	rom = calloc(rom_size, 1);
+
+	if(rom == NULL)
+		exit(EXIT_FAILURE);
+
+	/* NOP; JP 0x0150 */
+	rom[0x0101] = 0xC3;
+	rom[0x0102] = 0x50;
+	rom[0x0103] = 0x01;
+	memcpy(&rom[0x0134], "PGBBENCH", 8);
+
+	if(lcd)
+		memcpy(&rom[0x0150], lcd_code, sizeof(lcd_code));
+	else
+		memcpy(&rom[0x0150], loop_code, sizeof(loop_code));
+
+	/* RETI from the VBlank interrupt, and RET. */
+	rom[0x0040] = 0xD9;
+	rom[0x0200] = 0xC9;
+
+	for(i = 0x0134; i <= 0x014C; i++)
+		x = x - rom[i] - 1;
+
+	rom[0x014D] = x;
+}
+
+/**
+ * Reads the ROM file at path.
+ */
+static void read_rom(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	long size;
+
+	if(f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0)
+	{
+		fprintf(stderr, "cannot read %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	rewind(f);
+	rom_size = size;
+	rom = malloc(rom_size);
+
+	if(rom == NULL || fread(rom, 1, rom_size, f) != rom_size)
+	{
+		fprintf(stderr, "cannot read %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(f);
+}
+
+/**
+ * Fills VRAM and OAM with random values, and turns on the background, window
+ * and sprites.
+ */
+static void fill_vram(struct gb_s *gb)
+{
+	uint32_t x = 0x12345678;
+	uint_fast16_t addr;
+
+	for(addr = 0x8000; addr < 0xA000; addr++)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		__gb_write(gb, addr, x);
+	}
+
+	/* Ten sprites on each line that they cover. */
+	for(addr = 0xFE00; addr < 0xFEA0; addr += 4)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		__gb_write(gb, addr + 0, 16 + (addr - 0xFE00) / 4 % 4 * 40);
+		__gb_write(gb, addr + 1, 8 + (addr - 0xFE00) / 16 * 16);
+		__gb_write(gb, addr + 2, x);
+		__gb_write(gb, addr + 3, x >> 8);
+	}
+
+	__gb_write(gb, 0xFF40, LCDC_ENABLE | LCDC_WINDOW_MAP |
+			LCDC_WINDOW_ENABLE | LCDC_OBJ_ENABLE | LCDC_BG_ENABLE);
+	__gb_write(gb, 0xFF47, 0xE4);
+	__gb_write(gb, 0xFF48, 0xD2);
+	__gb_write(gb, 0xFF49, 0x1B);
+	__gb_write(gb, 0xFF4A, LCD_HEIGHT / 2);
+	__gb_write(gb, 0xFF4B, 7 + LCD_WIDTH / 2);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	static struct gb_s gb;
+	const char *name = strrchr(argv[0], '/');
+	const char *rom_path = NULL;
+	unsigned long frames = DEFAULT_FRAMES, frame;
+	int direct = 0, lcd = 0;
+	uint64_t cycles, skipped;
+	double start, ns;
+	int i;
+
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-direct") == 0)
+			direct = 1;
+		else if(strcmp(argv[i], "-lcd") == 0)
+			lcd = 1;
+		else if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+			frames = strtoul(argv[++i], NULL, 0);
+		else
+			rom_path = argv[i];
+	}
+
+	if(rom_path != NULL)
+		read_rom(rom_path);
+	else
+		build_rom(lcd);
+
+	if(gb_init(&gb, &bench_rom_read, &bench_cart_ram_read,
+			&bench_cart_ram_write, &bench_error, NULL) !=
+			GB_INIT_NO_ERROR)
+	{
+		fprintf(stderr, "unsupported ROM\n");
+		return EXIT_FAILURE;
+	}
+
+	/* At least one byte, so that calloc() does not return NULL. */
+	cart_ram = calloc(gb_get_save_size(&gb) + 1, 1);
+
+	if(cart_ram == NULL)
+		return EXIT_FAILURE;
+
+	if(direct)
+	{
+		gb_init_direct(&gb, rom, rom_size, cart_ram,
+				gb_get_save_size(&gb));
+	}
+
+#if PEANUT_GB_USE_JIT
+	{
+		void *code = mmap(NULL, JIT_CODE_SIZE,
+				PROT_READ | PROT_WRITE | PROT_EXEC,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if(code == MAP_FAILED)
+		{
+			fprintf(stderr, "cannot map the JIT buffer\n");
+			return EXIT_FAILURE;
+		}
+
+		gb_init_jit(&gb, code, JIT_CODE_SIZE);
+	}
+#endif
+
+	if(lcd)
+	{
+		gb_init_lcd(&gb, &bench_lcd_draw_line);
+
+		if(rom_path == NULL)
+			fill_vram(&gb);
+	}
+
+	cycles = gb_get_cycles(&gb);
+	skipped = gb_get_skipped_cycles(&gb);
+	start = now_ns();
+
+	for(frame = 0; frame < frames; frame++)
+		gb_run_frame(&gb);
+
+	ns = now_ns() - start;
+	cycles = gb_get_cycles(&gb) - cycles;
+	skipped = gb_get_skipped_cycles(&gb) - skipped;
+
+	printf("%s %s %s%s: %.0f ns/frame, %.1fx real time",
+			name != NULL ? name + 1 : argv[0],
+			rom_path != NULL ? rom_path : lcd ? "halt" : "loop",
+			direct ? "direct" : "callbacks", lcd ? " lcd" : "",
+			ns / frames, FRAME_NS * frames / ns);
+
+	if(rom_path == NULL && !lcd)
+	{
+		printf(", %.2f ns/instruction",
+				ns * LOOP_CYCLES / LOOP_INSTRUCTIONS / cycles);
+	}
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+	/* Opcodes were read from the map instead of the cache. */
+	if(gb.block_cache.bypass)
+		printf(", block cache bypassed");
+#endif
+
+	/* Share of the cycles that were skipped in idle loops. */
+	printf(", %.1f%% skipped\n", 100.0 * skipped / cycles);
+
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+	{
+		enum gb_fused_e fused;
+
+		for(fused = GB_FUSED_NONE + 1; fused < GB_FUSED_MAX; fused++)
+		{
+			const char *fused_name;
+			const uint32_t count = gb_get_fused_count(&gb, fused,
+					&fused_name);
+
+			printf("  %-24s %lu\n", fused_name,
+					(unsigned long)count);
+		}
+	}
+#endif
+
+	free(cart_ram);
+	free(rom);
+	return EXIT_SUCCESS;
+}
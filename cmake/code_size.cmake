@@ -0,0 +1,30 @@
+# Prints the size of the hot and cold code of the emulator core in OBJECTS, a
+# list separated by "|", using OBJDUMP. Warns if the hot code is larger than
+# BUDGET bytes, unless BUDGET is 0.
+
+string(REPLACE "|" ";" objects "${OBJECTS}")
+set(hot 0)
+set(cold 0)
+
+foreach(object ${objects})
+    execute_process(COMMAND ${OBJDUMP} -h ${object}
+        OUTPUT_VARIABLE sections
+        RESULT_VARIABLE result)
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${OBJDUMP} failed on ${object}: ${result}")
+    endif()
+
+    foreach(section hot cold)
+        if(sections MATCHES "\\.text\\.peanut_gb_${section} +([0-9a-fA-F]+)")
+            math(EXPR ${section} "${${section}} + 0x${CMAKE_MATCH_1}")
+        endif()
+    endforeach()
+endforeach()
+
+message(STATUS "Emulator core: ${hot} bytes of hot code, ${cold} bytes of cold code")
+
+if(BUDGET GREATER 0 AND hot GREATER BUDGET)
+    message(WARNING "Hot code of the emulator core is ${hot} bytes, more than "
+        "the budget of ${BUDGET} bytes (PEANUT_GB_HOT_CODE_BUDGET)")
+endif()
@@ -30,6 +30,21 @@ PSP_MODULE_INFO("pspeanut-gb", 0, 1, 0);
 #define RENDER_OFFSET_X 160
 #define RENDER_OFFSET_Y (PSP_FRAME_BUFFER_WIDTH * 64)
 
+#if PEANUT_GB_RELOCATE_MEMORY
+/* 16 KiB of RAM that is as fast as the data cache. The emulator context, OAM
+ * and HRAM/IO are placed there, WRAM and VRAM in ordinary memory. */
+#define PSP_SCRATCHPAD ((uint8_t *) 0x00010000)
+#define PSP_SCRATCHPAD_SIZE 0x4000
+#define SCRATCHPAD_OAM (PSP_SCRATCHPAD + ((sizeof(struct gb_s) + 63) & ~63))
+#define SCRATCHPAD_HRAM_IO (SCRATCHPAD_OAM + OAM_SIZE)
+
+static_assert(((sizeof(struct gb_s) + 63) & ~63) + OAM_SIZE + HRAM_IO_SIZE <=
+              PSP_SCRATCHPAD_SIZE, "emulator context does not fit in the scratchpad");
+
+static uint8_t gb_wram[WRAM_SIZE];
+static uint8_t gb_vram[VRAM_SIZE];
+#endif
+
 typedef struct {
     unsigned int width, height;
     unsigned int pW, pH;
@@ -69,6 +84,8 @@ struct priv_t
 {
 	/* Pointer to allocated memory holding GB file. */
 	uint8_t *rom;
+	/* Size of the GB file in bytes. */
+	size_t rom_size;
 	/* Pointer to allocated memory holding save file. */
 	uint8_t *cart_ram;
 };
@@ -103,8 +120,9 @@ void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
 
 /**
  * Returns a pointer to the allocated space containing the ROM. Must be freed.
+ * The size of the ROM is written to rom_size_out.
  */
-uint8_t *read_rom_to_ram(const char *file_name)
+uint8_t *read_rom_to_ram(const char *file_name, size_t *rom_size_out)
 {
 	FILE *rom_file = fopen(file_name, "rb");
 	size_t rom_size;
@@ -126,6 +144,7 @@ uint8_t *read_rom_to_ram(const char *file_name)
 	}
 
 	fclose(rom_file);
+	*rom_size_out = rom_size;
 	return rom;
 }
 
@@ -152,15 +171,6 @@ void gb_error(struct gb_s *gb, const enum gb_error_e gb_err, const uint16_t val)
 	exit(EXIT_FAILURE);
 }
 
-/**
- * Draws scanline into framebuffer.
- */
-void lcd_draw_line(struct gb_s *gb, const uint8_t pixels[LCD_WIDTH],
-		   const uint_fast8_t line)
-{
-    memcpy((uint8_t*)(gb_texture.data) + (gb_texture.pW * line), pixels, LCD_WIDTH);
-}
-
 int string_ends_with(char * string, const char * end) {
     int string_length = strlen(string);
     int end_length = strlen(end);
@@ -255,7 +265,11 @@ int main(void)
     SceCtrlLatch pad;
     char** rom_file_names;
     int rom_file_amount;
+#if PEANUT_GB_RELOCATE_MEMORY
+    struct gb_s &gb = *(struct gb_s *) PSP_SCRATCHPAD;
+#else
     static struct gb_s gb;
+#endif
     static struct priv_t priv;
     enum gb_init_error_e ret;
 
@@ -296,7 +310,7 @@ int main(void)
         pspDebugScreenClear();
         pspDebugScreenPrintf("Loading %s...\n", rom_file_names[selection]);
 
-        if((priv.rom = read_rom_to_ram(rom_file_names[selection])) == NULL) {
+        if((priv.rom = read_rom_to_ram(rom_file_names[selection], &priv.rom_size)) == NULL) {
             pspDebugScreenPrintf("Failed, press X to exit.\n");
             while(!exit) {
                 sceCtrlReadLatch(&pad);
@@ -313,6 +327,11 @@ int main(void)
         free(rom_file_names);
 
 
+#if PEANUT_GB_RELOCATE_MEMORY
+        /* Start from zero, as the static context would. */
+        memset(PSP_SCRATCHPAD, 0, PSP_SCRATCHPAD_SIZE);
+        gb_set_memory(&gb, gb_wram, gb_vram, SCRATCHPAD_OAM, SCRATCHPAD_HRAM_IO);
+#endif
         ret = gb_init(&gb, &gb_rom_read, &gb_cart_ram_read,
 		      &gb_cart_ram_write, &gb_error, &priv);
         if(ret != GB_INIT_NO_ERROR)
@@ -328,7 +347,9 @@ int main(void)
 
         priv.cart_ram = (uint8_t *) malloc(gb_get_save_size(&gb));
 
-        gb_init_lcd(&gb, &lcd_draw_line);
+        /* Let the core access ROM and cart RAM without the callbacks. */
+        gb_init_direct(&gb, priv.rom, priv.rom_size,
+                       priv.cart_ram, gb_get_save_size(&gb));
 
         fbp0 = guGetStaticVramBuffer(PSP_FRAME_BUFFER_WIDTH, PSP_SCREEN_HEIGHT, GU_PSM_8888);
         fbp1 = guGetStaticVramBuffer(PSP_FRAME_BUFFER_WIDTH, PSP_SCREEN_HEIGHT, GU_PSM_8888);
@@ -337,7 +358,9 @@ int main(void)
         gb_texture.height = LCD_HEIGHT;
         gb_texture.pH = 256;
         gb_texture.pW = 256;
-        gb_texture.size = gb_texture.pH * gb_texture.pW * PIXEL_SIZE;
+        /* GU_PSM_T8 uses one byte per texel, the same as the pixels of the
+         * core, so a line of pW texels is pW bytes. */
+        gb_texture.size = gb_texture.pH * gb_texture.pW;
         gb_texture.data = guGetStaticVramTexture(gb_texture.pW, gb_texture.pH, GU_PSM_T8);
         TextureVertex tverts[4] = {
             {0.0f, 0.0f, 0xFFFFFFFF, (PSP_SCREEN_WIDTH - LCD_WIDTH) / 2.0f, (PSP_SCREEN_HEIGHT - LCD_HEIGHT) / 2.0f, 0.0f},
@@ -346,6 +369,10 @@ int main(void)
 
         memset(gb_texture.data, 0xFF00FF00, gb_texture.pW * gb_texture.pH);
 
+        /* The core draws each line straight into the texture. */
+        gb_init_framebuffer(&gb, (uint8_t *) gb_texture.data, gb_texture.pW,
+                            GB_FRAMEBUFFER_8BPP);
+
         // This needs to be 32 entries, but we only need 4
         uint32_t __attribute__((aligned(16))) palette[32];
         palette[0] = 0xFFFFFFFF;
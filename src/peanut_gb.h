@@ -41,8 +41,9 @@
 # define __has_include(x) 0
 #endif
 
-#include <stdlib.h>	/* Required for qsort and abort */
+#include <stdlib.h>	/* Required for abort */
 #include <stdbool.h>	/* Required for bool types */
+#include <stddef.h>	/* Required for offsetof */
 #include <stdint.h>	/* Required for int types */
 #include <string.h>	/* Required for memset */
 #include <time.h>	/* Required for tm struct */
@@ -105,6 +106,162 @@
 # define PEANUT_GB_USE_INTRINSICS 1
 #endif
 
+/* Store the results that the CPU flags are derived from instead of the flags
+ * themselves, and only derive each flag when it is read. This avoids bit-field
+ * read-modify-writes on every ALU instruction, which are slow on MIPS. The F
+ * register is then not available as gb->cpu_reg.f. */
+#ifndef PEANUT_GB_LAZY_FLAGS
+# define PEANUT_GB_LAZY_FLAGS 0
+#endif
+
+/* Dispatch opcodes through a table of label addresses instead of a switch
+ * statement. Requires the GCC "labels as values" extension. Whether this is
+ * faster depends on the target, so it is off by default. */
+#ifndef PEANUT_GB_USE_COMPUTED_GOTO
+# define PEANUT_GB_USE_COMPUTED_GOTO 0
+#endif
+
+#if PEANUT_GB_USE_COMPUTED_GOTO && !defined(__GNUC__)
+# error "PEANUT_GB_USE_COMPUTED_GOTO requires GCC or Clang"
+#endif
+
+/* Skip over the remaining iterations of loops that wait for an interrupt or
+ * a change to an IO register, such as polling LY. Only loops that cannot
+ * change anything until the next event are skipped, and never past the end of
+ * the cycles given to gb_run_cycles(), so timing is unchanged. */
+#ifndef PEANUT_GB_SKIP_IDLE_LOOPS
+# define PEANUT_GB_SKIP_IDLE_LOOPS 1
+#endif
+
+/* Translate runs of instructions to x86-64 machine code. Only available on
+ * x86-64 hosts. The front-end must provide an executable buffer with
+ * gb_init_jit(). Requires the block cache. */
+#ifndef PEANUT_GB_USE_JIT
+# define PEANUT_GB_USE_JIT 0
+#endif
+
+/* Cache decoded runs of instructions instead of fetching every opcode and
+ * operand through __gb_read(). Off by default so that the results can be
+ * cross-checked against the plain interpreter. The cache is bypassed while ROM
+ * is mapped with gb_init_direct(), unless superinstructions are used, and the
+ * JIT then only runs while ROM is read through the callbacks. */
+#ifndef PEANUT_GB_USE_BLOCK_CACHE
+# define PEANUT_GB_USE_BLOCK_CACHE PEANUT_GB_USE_JIT
+#endif
+
+#if PEANUT_GB_USE_JIT
+# if !defined(__x86_64__)
+#  error "PEANUT_GB_USE_JIT is only supported on x86-64"
+# endif
+# if !PEANUT_GB_USE_BLOCK_CACHE
+#  error "PEANUT_GB_USE_JIT requires PEANUT_GB_USE_BLOCK_CACHE"
+# endif
+# if PEANUT_GB_LAZY_FLAGS
+#  error "PEANUT_GB_USE_JIT does not support PEANUT_GB_LAZY_FLAGS"
+# endif
+#endif
+
+/* Run OAM DMA over 640 clock cycles, during which the CPU can only access IO
+ * and HRAM, instead of copying all of OAM at once. Few games rely on this. */
+#ifndef PEANUT_GB_ACCURATE_OAM_DMA
+# define PEANUT_GB_ACCURATE_OAM_DMA 0
+#endif
+
+/* Store WRAM, VRAM, OAM and HRAM/IO in memory given to gb_set_memory() instead
+ * of in struct gb_s. The front-end may then place struct gb_s, OAM and HRAM/IO
+ * in fast memory, such as the PSP scratchpad, and WRAM and VRAM elsewhere. */
+#ifndef PEANUT_GB_RELOCATE_MEMORY
+# define PEANUT_GB_RELOCATE_MEMORY 0
+#endif
+
+/* Keep the 384 tiles in VRAM decoded to one byte per pixel, so that the
+ * background and window are drawn without unpacking the bit planes of every
+ * tile on every line. Uses 24 KiB and sends VRAM writes down the slow path to
+ * track which tiles have changed. On x86-64 hosts this is slower than the SWAR
+ * renderer; run the benchmark target to compare on others. */
+#ifndef PEANUT_GB_TILE_CACHE
+# define PEANUT_GB_TILE_CACHE 0
+#endif
+
+/* Decode and colour the eight pixels of a tile row together in a 64-bit
+ * integer, instead of one pixel at a time. */
+#ifndef PEANUT_GB_SWAR_RENDERER
+# define PEANUT_GB_SWAR_RENDERER 1
+#endif
+
+/* Draw the lines of a frame together when VBLANK starts, instead of one at a
+ * time between instructions. Writes to VRAM, OAM and LCD registers made while
+ * lines wait to be drawn are logged and replayed, so that every line is drawn
+ * as it was when reached. */
+#ifndef PEANUT_GB_DEFERRED_RENDER
+# define PEANUT_GB_DEFERRED_RENDER 0
+#endif
+
+/* Number of writes logged while lines wait to be drawn. When the log is full,
+ * the lines reached so far are drawn early. */
+#ifndef PEANUT_GB_DEFERRED_LOG_SIZE
+# define PEANUT_GB_DEFERRED_LOG_SIZE 512
+#endif
+
+#if PEANUT_GB_DEFERRED_RENDER && !ENABLE_LCD
+# error "PEANUT_GB_DEFERRED_RENDER requires ENABLE_LCD"
+#endif
+
+#if PEANUT_GB_DEFERRED_RENDER && PEANUT_GB_ACCURATE_OAM_DMA
+# error "PEANUT_GB_DEFERRED_RENDER does not support PEANUT_GB_ACCURATE_OAM_DMA"
+#endif
+
+/* Number of blocks held by the block cache. Must be a power of two. */
+#ifndef PEANUT_GB_BLOCK_CACHE_SIZE
+# define PEANUT_GB_BLOCK_CACHE_SIZE 512
+#endif
+
+/* Run common pairs of instructions in ROM, such as DEC B followed by JR NZ, as
+ * a single superinstruction. Requires the block cache, which is then also used
+ * while ROM is mapped with gb_init_direct(). Off by default, since the pairs
+ * are not run faster on x86-64 hosts; compare with the benchmark target. */
+#ifndef PEANUT_GB_USE_SUPERINSTRUCTIONS
+# define PEANUT_GB_USE_SUPERINSTRUCTIONS 0
+#endif
+
+/* Count how often each superinstruction is run. The counts are returned by
+ * gb_get_fused_count(). */
+#ifndef PEANUT_GB_SUPERINSTRUCTION_STATS
+# define PEANUT_GB_SUPERINSTRUCTION_STATS 0
+#endif
+
+#if PEANUT_GB_USE_SUPERINSTRUCTIONS && !PEANUT_GB_USE_BLOCK_CACHE
+# error "PEANUT_GB_USE_SUPERINSTRUCTIONS requires PEANUT_GB_USE_BLOCK_CACHE"
+#endif
+
+#if PEANUT_GB_SUPERINSTRUCTION_STATS && !PEANUT_GB_USE_SUPERINSTRUCTIONS
+# error "PEANUT_GB_SUPERINSTRUCTION_STATS requires PEANUT_GB_USE_SUPERINSTRUCTIONS"
+#endif
+
+/* Run each opcode in its own function, which tail-calls the function of the
+ * next opcode through a table, with the CPU registers passed as an argument.
+ * Each handler then ends in its own indirect jump, as with computed goto, but
+ * the compiler allocates registers for one opcode at a time. Uses the musttail
+ * attribute if the compiler has it, and otherwise relies on sibling call
+ * optimisation, so an optimised build is required. Off by default, since the
+ * handlers are slower with GCC on x86-64 hosts; compare with the benchmark
+ * target. */
+#ifndef PEANUT_GB_USE_MUSTTAIL
+# define PEANUT_GB_USE_MUSTTAIL 0
+#endif
+
+#if PEANUT_GB_USE_MUSTTAIL
+# if !defined(__GNUC__)
+#  error "PEANUT_GB_USE_MUSTTAIL requires GCC or Clang"
+# endif
+# if PEANUT_GB_USE_COMPUTED_GOTO
+#  error "PEANUT_GB_USE_MUSTTAIL does not support PEANUT_GB_USE_COMPUTED_GOTO"
+# endif
+# if PEANUT_GB_USE_BLOCK_CACHE
+#  error "PEANUT_GB_USE_MUSTTAIL does not support PEANUT_GB_USE_BLOCK_CACHE"
+# endif
+#endif
+
 /* Only include function prototypes. At least one file must *not* have this
  * defined. */
 // #define PEANUT_GB_HEADER_ONLY
@@ -124,6 +281,15 @@
 #define HRAM_IO_SIZE	0x0100
 #define OAM_SIZE	0x00A0
 
+/* Maximum size of the CPU registers, interrupt state and counters at the start
+ * of struct gb_s. Two 64 byte cache lines. */
+#define PEANUT_GB_HOT_SIZE	128
+
+/* Maximum size of all state used by every instruction, which also includes the
+ * memory map, HRAM, the IO registers and the head of the block cache. Eleven
+ * 64 byte cache lines. */
+#define PEANUT_GB_HOT_SET_SIZE	(11 * 64)
+
 /* Memory addresses */
 #define ROM_0_ADDR      0x0000
 #define ROM_N_ADDR      0x4000
@@ -152,6 +318,9 @@
  * 4194304 / (8192 / 8) = 4096 clock cycles for sending 1 byte. */
 #define SERIAL_CYCLES       4096
 
+/* OAM DMA copies 1 byte every 4 clock cycles. */
+#define DMA_BYTE_CYCLES	4
+
 /* Calculating VSYNC. */
 #define DMG_CLOCK_FREQ      4194304.0
 #define SCREEN_REFRESH_CYCLES 70224.0
@@ -159,6 +328,9 @@
 
 /* Real Time Clock is locked to 1Hz. */
 #define RTC_CYCLES	((uint_fast32_t)DMG_CLOCK_FREQ)
+/* The RTC registers are only updated when accessed, and once every
+ * RTC_UPDATE_SECONDS so that the elapsed cycles do not overflow. */
+#define RTC_UPDATE_SECONDS	256
 
 /* SERIAL SC register masks. */
 #define SERIAL_SC_TX_START  0x80
@@ -204,6 +376,7 @@
 #define VRAM_BMAP_2         (0x9C00 - VRAM_ADDR)
 #define VRAM_TILES_3        (0x8000 - VRAM_ADDR + VRAM_BANK_SIZE)
 #define VRAM_TILES_4        (0x8800 - VRAM_ADDR + VRAM_BANK_SIZE)
+#define VRAM_TILE_COUNT     384
 
 /* Interrupt jump addresses */
 #define VBLANK_INTR_ADDR    0x0040
@@ -272,6 +445,117 @@
 # endif
 #endif /* !defined(PGB_LIKELY) */
 
+/* The PGB_ALWAYS_INLINE macro forces a function to be inlined, so that it is
+ * specialised for the constant arguments at each call site. */
+#if !defined(PGB_ALWAYS_INLINE)
+# if defined(__GNUC__)
+#  define PGB_ALWAYS_INLINE inline __attribute__((always_inline))
+# elif defined(_MSC_VER)
+#  define PGB_ALWAYS_INLINE __forceinline
+# else
+#  define PGB_ALWAYS_INLINE inline
+# endif
+#endif /* !defined(PGB_ALWAYS_INLINE) */
+
+/* The PGB_NOINLINE macro keeps a function out of line, so that it is not
+ * copied into each caller. */
+#if !defined(PGB_NOINLINE)
+# if defined(__GNUC__)
+#  define PGB_NOINLINE __attribute__((noinline))
+# elif defined(_MSC_VER)
+#  define PGB_NOINLINE __declspec(noinline)
+# else
+#  define PGB_NOINLINE
+# endif
+#endif /* !defined(PGB_NOINLINE) */
+
+#if !defined(__has_attribute)
+# define __has_attribute(x) 0
+#endif
+
+/* The PGB_TAIL_CALL() macro returns the result of a call that must reuse the
+ * stack frame of the caller. Without the musttail attribute, the jump is only
+ * made by the optimiser, and an unoptimised build may run out of stack. */
+#if PEANUT_GB_USE_MUSTTAIL
+# if __has_attribute(musttail)
+#  define PGB_TAIL_CALL(call)	__attribute__((musttail)) return call
+# else
+#  if !defined(__OPTIMIZE__)
+#   error "PEANUT_GB_USE_MUSTTAIL requires the musttail attribute or optimisation"
+#  endif
+#  define PGB_TAIL_CALL(call)	do { call; return; } while(0)
+# endif
+#endif
+
+/* Functions marked PGB_HOT run for every instruction or line, and functions
+ * marked PGB_COLD almost never. Each group is placed in its own section, so
+ * that the linker packs the hot code together in the instruction cache. */
+#if !defined(PGB_HOT)
+# if defined(__GNUC__) && defined(__ELF__)
+#  define PGB_HOT	__attribute__((hot, section(".text.peanut_gb_hot")))
+#  define PGB_COLD	__attribute__((cold, noinline, \
+				section(".text.peanut_gb_cold")))
+# else
+#  define PGB_HOT
+#  define PGB_COLD
+# endif
+#endif /* !defined(PGB_HOT) */
+
+/* Labels of the opcodes executed by __gb_run_cpu(). With computed goto, the
+ * switch statement only remains as the target of break. */
+#if PEANUT_GB_USE_COMPUTED_GOTO
+# define PGB_OPCODE_SWITCH(op)	switch(0) default: if(1) goto *op_labels[op]; else
+# define PGB_OPCODE(op)		op_##op
+# define PGB_OPCODE_INVALID	op_invalid
+#else
+# define PGB_OPCODE_SWITCH(op)	switch(op)
+# define PGB_OPCODE(op)		case op
+# define PGB_OPCODE_INVALID	default
+#endif
+
+/* CPU registers used by the instruction macros. __gb_run_cpu() redefines this
+ * to use its local copy of the registers. */
+#define PGB_CPU_REG	gb->cpu_reg
+
+/* Access to the flags of the CPU. The macros require a gb variable in scope.
+ * PGB_SET_FLAG_Z_RESULT() sets the zero flag if the low byte of the result is
+ * zero. PGB_SET_FLAGS_RESULT() sets all flags, where the half carry flag is
+ * bit 4 of h_ and the carry flag is bit 8 of c_. */
+#if PEANUT_GB_LAZY_FLAGS
+# define PGB_FLAG_Z()		((PGB_CPU_REG.flags.z & 0xFF) == 0)
+# define PGB_FLAG_N()		(PGB_CPU_REG.flags.n)
+# define PGB_FLAG_H()		((uint8_t)(PGB_CPU_REG.flags.h >> 4) & 1)
+# define PGB_FLAG_C()		((uint8_t)(PGB_CPU_REG.flags.c >> 8) & 1)
+# define PGB_SET_FLAG_Z(x)	PGB_CPU_REG.flags.z = !(x)
+# define PGB_SET_FLAG_N(x)	PGB_CPU_REG.flags.n = (x)
+# define PGB_SET_FLAG_H(x)	PGB_CPU_REG.flags.h = (x) << 4
+# define PGB_SET_FLAG_C(x)	PGB_CPU_REG.flags.c = (x) << 8
+# define PGB_SET_FLAG_Z_RESULT(res) PGB_CPU_REG.flags.z = (res)
+# define PGB_SET_FLAGS_RESULT(res,sub,h_,c_)				\
+	(PGB_CPU_REG.flags.z = (res), PGB_CPU_REG.flags.n = (sub),		\
+	 PGB_CPU_REG.flags.h = (h_), PGB_CPU_REG.flags.c = (c_))
+# define PGB_CLEAR_FLAGS()						\
+	(PGB_CPU_REG.flags.z = 1, PGB_CPU_REG.flags.n = 0,			\
+	 PGB_CPU_REG.flags.h = 0, PGB_CPU_REG.flags.c = 0)
+#else
+# define PGB_FLAG_Z()		(PGB_CPU_REG.f.f_bits.z)
+# define PGB_FLAG_N()		(PGB_CPU_REG.f.f_bits.n)
+# define PGB_FLAG_H()		(PGB_CPU_REG.f.f_bits.h)
+# define PGB_FLAG_C()		(PGB_CPU_REG.f.f_bits.c)
+# define PGB_SET_FLAG_Z(x)	PGB_CPU_REG.f.f_bits.z = (x)
+# define PGB_SET_FLAG_N(x)	PGB_CPU_REG.f.f_bits.n = (x)
+# define PGB_SET_FLAG_H(x)	PGB_CPU_REG.f.f_bits.h = (x)
+# define PGB_SET_FLAG_C(x)	PGB_CPU_REG.f.f_bits.c = (x)
+# define PGB_SET_FLAG_Z_RESULT(res)					\
+	PGB_CPU_REG.f.f_bits.z = (((res) & 0xFF) == 0x00)
+# define PGB_SET_FLAGS_RESULT(res,sub,h_,c_)				\
+	(PGB_CPU_REG.f.f_bits.z = (((res) & 0xFF) == 0x00),			\
+	 PGB_CPU_REG.f.f_bits.n = (sub),					\
+	 PGB_CPU_REG.f.f_bits.h = ((h_) >> 4) & 1,				\
+	 PGB_CPU_REG.f.f_bits.c = ((c_) >> 8) & 1)
+# define PGB_CLEAR_FLAGS()	PGB_CPU_REG.f.reg = 0
+#endif
+
 #if PEANUT_GB_USE_INTRINSICS
 /* If using MSVC, only enable intrinsics for x86 platforms*/
 # if defined(_MSC_VER) && __has_include("intrin.h") && \
@@ -289,95 +573,83 @@
 # endif
 #endif /* PEANUT_GB_USE_INTRINSICS */
 
-#if defined(PGB_INTRIN_SBC)
+#if defined(PGB_INTRIN_SBC) && !PEANUT_GB_LAZY_FLAGS
 # define PGB_INSTR_SBC_R8(r,cin)						\
 	{									\
 		uint8_t temp;							\
-		gb->cpu_reg.f.f_bits.c = PGB_INTRIN_SBC(gb->cpu_reg.a,r,cin,temp);\
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.a ^ r ^ temp) & 0x10) > 0;\
-		gb->cpu_reg.f.f_bits.n = 1;					\
-		gb->cpu_reg.f.f_bits.z = (temp == 0x00);			\
-		gb->cpu_reg.a = temp;						\
+		PGB_SET_FLAG_C(PGB_INTRIN_SBC(PGB_CPU_REG.a,r,cin,temp));\
+		PGB_SET_FLAG_H(((PGB_CPU_REG.a ^ r ^ temp) & 0x10) > 0);\
+		PGB_SET_FLAG_N(1);					\
+		PGB_SET_FLAG_Z(temp == 0x00);			\
+		PGB_CPU_REG.a = temp;						\
 	}
 
 # define PGB_INSTR_CP_R8(r)							\
 	{									\
 		uint8_t temp;							\
-		gb->cpu_reg.f.f_bits.c = PGB_INTRIN_SBC(gb->cpu_reg.a,r,0,temp);\
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.a ^ r ^ temp) & 0x10) > 0;\
-		gb->cpu_reg.f.f_bits.n = 1;					\
-		gb->cpu_reg.f.f_bits.z = (temp == 0x00);			\
+		PGB_SET_FLAG_C(PGB_INTRIN_SBC(PGB_CPU_REG.a,r,0,temp));\
+		PGB_SET_FLAG_H(((PGB_CPU_REG.a ^ r ^ temp) & 0x10) > 0);\
+		PGB_SET_FLAG_N(1);					\
+		PGB_SET_FLAG_Z(temp == 0x00);			\
 	}
 #else
 # define PGB_INSTR_SBC_R8(r,cin)						\
 	{									\
-		uint16_t temp = gb->cpu_reg.a - (r + cin);			\
-		gb->cpu_reg.f.f_bits.c = (temp & 0xFF00) ? 1 : 0;		\
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.a ^ r ^ temp) & 0x10) > 0; \
-		gb->cpu_reg.f.f_bits.n = 1;					\
-		gb->cpu_reg.f.f_bits.z = ((temp & 0xFF) == 0x00);		\
-		gb->cpu_reg.a = (temp & 0xFF);					\
+		uint16_t temp = PGB_CPU_REG.a - (r + cin);			\
+		PGB_SET_FLAGS_RESULT(temp, 1, PGB_CPU_REG.a ^ r ^ temp, temp);	\
+		PGB_CPU_REG.a = (temp & 0xFF);					\
 	}
 
 # define PGB_INSTR_CP_R8(r)							\
 	{									\
-		uint16_t temp = gb->cpu_reg.a - r;				\
-		gb->cpu_reg.f.f_bits.c = (temp & 0xFF00) ? 1 : 0;		\
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.a ^ r ^ temp) & 0x10) > 0; \
-		gb->cpu_reg.f.f_bits.n = 1;					\
-		gb->cpu_reg.f.f_bits.z = ((temp & 0xFF) == 0x00);		\
+		uint16_t temp = PGB_CPU_REG.a - r;				\
+		PGB_SET_FLAGS_RESULT(temp, 1, PGB_CPU_REG.a ^ r ^ temp, temp);	\
 	}
 #endif  /* PGB_INTRIN_SBC */
 
-#if defined(PGB_INTRIN_ADC)
+#if defined(PGB_INTRIN_ADC) && !PEANUT_GB_LAZY_FLAGS
 # define PGB_INSTR_ADC_R8(r,cin)						\
 	{									\
 		uint8_t temp;							\
-		gb->cpu_reg.f.f_bits.c = PGB_INTRIN_ADC(gb->cpu_reg.a,r,cin,temp);\
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.a ^ r ^ temp) & 0x10) > 0; \
-		gb->cpu_reg.f.f_bits.n = 0;					\
-		gb->cpu_reg.f.f_bits.z = (temp == 0x00);			\
-		gb->cpu_reg.a = temp;						\
+		PGB_SET_FLAG_C(PGB_INTRIN_ADC(PGB_CPU_REG.a,r,cin,temp));\
+		PGB_SET_FLAG_H(((PGB_CPU_REG.a ^ r ^ temp) & 0x10) > 0); \
+		PGB_SET_FLAG_N(0);					\
+		PGB_SET_FLAG_Z(temp == 0x00);			\
+		PGB_CPU_REG.a = temp;						\
 	}
 #else
 # define PGB_INSTR_ADC_R8(r,cin)						\
 	{									\
-		uint16_t temp = gb->cpu_reg.a + r + cin;			\
-		gb->cpu_reg.f.f_bits.c = (temp & 0xFF00) ? 1 : 0;		\
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.a ^ r ^ temp) & 0x10) > 0; \
-		gb->cpu_reg.f.f_bits.n = 0;					\
-		gb->cpu_reg.f.f_bits.z = ((temp & 0xFF) == 0x00);		\
-		gb->cpu_reg.a = (temp & 0xFF);					\
+		uint16_t temp = PGB_CPU_REG.a + r + cin;			\
+		PGB_SET_FLAGS_RESULT(temp, 0, PGB_CPU_REG.a ^ r ^ temp, temp);	\
+		PGB_CPU_REG.a = (temp & 0xFF);					\
 	}
 #endif /* PGB_INTRIN_ADC */
 
 #define PGB_INSTR_INC_R8(r)							\
 	r++;									\
-	gb->cpu_reg.f.f_bits.h = ((r & 0x0F) == 0x00);				\
-	gb->cpu_reg.f.f_bits.n = 0;						\
-	gb->cpu_reg.f.f_bits.z = (r == 0x00)
+	PGB_SET_FLAG_H((r & 0x0F) == 0x00);					\
+	PGB_SET_FLAG_N(0);							\
+	PGB_SET_FLAG_Z_RESULT(r)
 
 #define PGB_INSTR_DEC_R8(r)							\
 	r--;									\
-	gb->cpu_reg.f.f_bits.h = ((r & 0x0F) == 0x0F);				\
-	gb->cpu_reg.f.f_bits.n = 1;						\
-	gb->cpu_reg.f.f_bits.z = (r == 0x00)
+	PGB_SET_FLAG_H((r & 0x0F) == 0x0F);					\
+	PGB_SET_FLAG_N(1);							\
+	PGB_SET_FLAG_Z_RESULT(r)
 
 #define PGB_INSTR_XOR_R8(r)							\
-	gb->cpu_reg.a ^= r;							\
-	gb->cpu_reg.f.reg = 0;							\
-	gb->cpu_reg.f.f_bits.z = (gb->cpu_reg.a == 0x00)
+	PGB_CPU_REG.a ^= r;							\
+	PGB_SET_FLAGS_RESULT(PGB_CPU_REG.a, 0, 0, 0)
 
 #define PGB_INSTR_OR_R8(r)							\
-	gb->cpu_reg.a |= r;							\
-        gb->cpu_reg.f.reg = 0;							\
-	gb->cpu_reg.f.f_bits.z = (gb->cpu_reg.a == 0x00)
+	PGB_CPU_REG.a |= r;							\
+	PGB_SET_FLAGS_RESULT(PGB_CPU_REG.a, 0, 0, 0)
 
+/* AND always sets the half carry flag. */
 #define PGB_INSTR_AND_R8(r)							\
-	gb->cpu_reg.a &= r;							\
-	gb->cpu_reg.f.reg = 0;							\
-	gb->cpu_reg.f.f_bits.z = (gb->cpu_reg.a == 0x00);			\
-	gb->cpu_reg.f.f_bits.h = 1
+	PGB_CPU_REG.a &= r;							\
+	PGB_SET_FLAGS_RESULT(PGB_CPU_REG.a, 0, 0x10, 0)
 
 #if PEANUT_GB_IS_LITTLE_ENDIAN
 # define PEANUT_GB_GET_LSB16(x) (x & 0xFF)
@@ -400,6 +672,15 @@ struct cpu_registers_s
 #else
 # define PEANUT_GB_LE_REG(x,y) y,x
 #endif
+#if PEANUT_GB_LAZY_FLAGS
+	/* Values that the flags are derived from. See PGB_FLAG_Z(). */
+	struct {
+		uint_fast16_t z; /* Zero flag is set if the low byte is zero. */
+		uint_fast16_t h; /* Half carry flag is bit 4. */
+		uint_fast16_t c; /* Carry flag is bit 8. */
+		uint_fast8_t n; /* Add/sub flag. */
+	} flags;
+#else
 	/* Define specific bits of Flag register. */
 	union {
 		struct {
@@ -410,6 +691,7 @@ struct cpu_registers_s
 		} f_bits;
 		uint8_t reg;
 	} f;
+#endif
 	uint8_t a;
 
 	union
@@ -461,13 +743,104 @@ struct cpu_registers_s
 #undef PEANUT_GB_LE_REG
 };
 
+#if PEANUT_GB_USE_BLOCK_CACHE
+/* Maximum number of instructions in a cached block. */
+#define PEANUT_GB_BLOCK_MAX_INST 16
+
+/* Key of blocks in WRAM and HRAM. ROM blocks are keyed by ROM offset. */
+#define PEANUT_GB_BLOCK_RAM_KEY	0x1000000
+
+#if PEANUT_GB_USE_SUPERINSTRUCTIONS
+/* Pairs of instructions that are run as one superinstruction. */
+enum gb_fused_e
+{
+	GB_FUSED_NONE = 0,
+	GB_FUSED_LD_A_HLI_LD_DE_A,	/* LD A, (HL+); LD (DE), A */
+	GB_FUSED_DEC_B_JR_NZ,		/* DEC B; JR NZ, imm */
+	GB_FUSED_DEC_C_JR_NZ,		/* DEC C; JR NZ, imm */
+	GB_FUSED_OR_C_JR_NZ,		/* OR C; JR NZ, imm */
+	GB_FUSED_CP_JR_Z,		/* CP imm; JR Z, imm */
+	GB_FUSED_CP_JR_NZ,		/* CP imm; JR NZ, imm */
+
+	GB_FUSED_MAX
+};
+#endif
+
+struct gb_block_inst_s
+{
+	uint8_t opcode;
+	uint8_t length;
+	uint16_t imm;
+#if PEANUT_GB_USE_JIT
+	/* Translated code for the run of instructions starting here, or NULL.
+	 * Only modifies CPU registers. */
+	void (*jit)(struct cpu_registers_s *);
+	/* Number of instructions, bytes and clock cycles in the run. */
+	uint8_t jit_count;
+	uint8_t jit_length;
+	uint8_t jit_cycles;
+#endif
+#if PEANUT_GB_USE_SUPERINSTRUCTIONS
+	/* enum gb_fused_e of this and the next instruction. */
+	uint8_t fused;
+#endif
+};
+
+/* Straight-line run of decoded instructions. */
+struct gb_block_s
+{
+	/* Key of the first instruction, or -1 if the entry is unused. */
+	int_fast32_t key;
+	/* Generation of the RAM page the block was decoded from. */
+	uint_fast32_t gen;
+	/* Number of instructions. 0 if the code at key cannot be cached. */
+	uint_fast8_t count;
+	struct gb_block_inst_s inst[PEANUT_GB_BLOCK_MAX_INST];
+};
+#endif
+
+/* Events handled by the scheduler. */
+enum gb_event_e
+{
+	GB_EVENT_LCD = 0,	/* LCD mode transition */
+	GB_EVENT_TIMA,		/* TIMA overflow */
+	GB_EVENT_SERIAL,	/* Serial transfer completion */
+	GB_EVENT_RTC,		/* RTC register update */
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	GB_EVENT_DMA,		/* OAM DMA completion */
+#endif
+
+	GB_EVENT_MAX
+};
+
 struct count_s
 {
-	uint_fast16_t lcd_count;	/* LCD Timing */
-	uint_fast16_t div_count;	/* Divider Register Counter */
-	uint_fast16_t tima_count;	/* Timer Counter */
-	uint_fast16_t serial_count;	/* Serial Counter */
-	uint_fast32_t rtc_count;	/* RTC Counter */
+	/* Clock cycles since reset. Deadlines are compared with the signed
+	 * difference to this counter, so it is allowed to wrap. */
+	uint32_t cycles;
+	/* Earliest deadline of all scheduled events. */
+	uint32_t next_event;
+	/* Deadline of each event, valid when its bit is set in scheduled. */
+	uint32_t event[GB_EVENT_MAX];
+	uint_fast8_t scheduled;
+
+	uint32_t lcd_line_start;	/* Cycle on which the current line started */
+	uint32_t tima_start;		/* Cycle of the last TIMA increment */
+	uint8_t div_offset;		/* DIV minus cycles / DIV_CYCLES */
+	uint32_t rtc_start;		/* Cycle of the last RTC update */
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	uint32_t dma_start;		/* Cycle on which OAM DMA started */
+#endif
+
+	/* Clock cycles since reset, up to the cycle in elapsed_sync. Updated
+	 * after each call to gb_run_frame() or gb_run_cycles(). This and the
+	 * following counters are not used while instructions run. */
+	uint64_t elapsed;
+	uint32_t elapsed_sync;
+
+	uint_fast16_t tima_count;	/* Timer Counter while TIMA is stopped */
+	uint_fast16_t serial_count;	/* Serial Counter while no transfer */
+	uint_fast32_t rtc_count;	/* RTC Counter while RTC is halted */
 };
 
 #if ENABLE_LCD
@@ -525,6 +898,16 @@ enum gb_serial_rx_ret_e
 	GB_SERIAL_RX_NO_CONNECTION = 1
 };
 
+/**
+ * Pixel formats of frame buffers given to gb_init_framebuffer().
+ */
+enum gb_framebuffer_format_e
+{
+	/* One byte per pixel, the same as the pixels passed to
+	 * lcd_draw_line(). */
+	GB_FRAMEBUFFER_8BPP = 0
+};
+
 union cart_rtc
 {
 	struct
@@ -538,6 +921,23 @@ union cart_rtc
 	uint8_t bytes[5];
 };
 
+struct gb_s;
+
+/**
+ * Memory handlers for one type of Memory Bank Controller. gb_init() selects
+ * the handlers for the MBC of the cartridge.
+ */
+struct gb_mbc_handlers_s
+{
+	/* Read from the switchable ROM bank at 0x4000-0x7FFF. */
+	uint8_t (*rom_read)(struct gb_s*, uint_fast16_t addr);
+	/* Write to the MBC registers at 0x0000-0x7FFF. */
+	void (*rom_write)(struct gb_s*, uint_fast16_t addr, uint8_t val);
+	/* Access to cart RAM or RTC registers at 0xA000-0xBFFF. */
+	uint8_t (*ram_read)(struct gb_s*, uint_fast16_t addr);
+	void (*ram_write)(struct gb_s*, uint_fast16_t addr, uint8_t val);
+};
+
 /**
  * Emulator context.
  *
@@ -546,6 +946,87 @@ union cart_rtc
  */
 struct gb_s
 {
+	/* State used by every instruction comes first, so that it shares as
+	 * few cache lines as possible. The registers, interrupt state and
+	 * counters must fit in PEANUT_GB_HOT_SIZE bytes, and all state up to
+	 * the head of the block cache in PEANUT_GB_HOT_SET_SIZE bytes. Rarely
+	 * used state follows the block cache. */
+	struct cpu_registers_s cpu_reg;
+	//struct gb_registers_s gb_reg;
+	struct
+	{
+		bool gb_halt	: 1;
+		bool gb_ime	: 1;
+		bool gb_frame	: 1; /* New frame drawn. */
+		bool lcd_blank	: 1;
+	};
+
+	/* Interrupts that are both requested in IF and enabled in IE. Updated
+	 * by __gb_update_intr_pending() whenever IF or IE change. */
+	uint8_t intr_pending;
+
+	struct count_s counter;
+
+	/* Host memory backing each 4 KiB page of the address space. Pages
+	 * that are NULL are handled by __gb_read_slow() and __gb_write_slow().
+	 * Rebuilt by __gb_update_memory_map() whenever the bank selection
+	 * changes. */
+	struct
+	{
+		const uint8_t *read[0x10];
+		uint8_t *write[0x10];
+	} map;
+
+	/* Memory handlers for the MBC type. */
+	const struct gb_mbc_handlers_s *mbc_handlers;
+
+#if PEANUT_GB_RELOCATE_MEMORY
+	/* Memory registered with gb_set_memory(). */
+	uint8_t *hram_io;
+#else
+	uint8_t hram_io[HRAM_IO_SIZE];
+#endif
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+	struct
+	{
+		/* Next instructions of the current block, used while
+		 * execution continues in a straight line from next_pc. */
+		const struct gb_block_inst_s *next;
+		uint_fast8_t next_count;
+
+		/* Set when ROM is mapped with gb_init_direct() and
+		 * superinstructions are not used, so that opcodes are read
+		 * from the map. */
+		bool bypass;
+		uint16_t next_pc;
+
+		/* Offset added to the address of the switchable ROM bank. */
+		int_fast32_t rom_bank_addr;
+
+		/* Bit mask of WRAM and HRAM pages that cached blocks were
+		 * decoded from. Writes to these pages are handled by
+		 * __gb_write_slow(), which increments the page generation to
+		 * invalidate the blocks. */
+		uint_fast16_t ram_code;
+		uint_fast32_t ram_gen[0x10];
+
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+		/* Number of times each superinstruction was run. */
+		uint32_t fused_count[GB_FUSED_MAX];
+#endif
+
+		struct gb_block_s block[PEANUT_GB_BLOCK_CACHE_SIZE];
+	} block_cache;
+#endif
+
+	/* OAM is only used to draw lines and by OAM DMA. */
+#if PEANUT_GB_RELOCATE_MEMORY
+	uint8_t *oam;
+#else
+	uint8_t oam[OAM_SIZE];
+#endif
+
 	/**
 	 * Return byte from ROM at given address.
 	 *
@@ -590,14 +1071,6 @@ struct gb_s
 	/* Read byte from boot ROM at given address. */
 	uint8_t (*gb_bootrom_read)(struct gb_s*, const uint_fast16_t addr);
 
-	struct
-	{
-		bool gb_halt	: 1;
-		bool gb_ime	: 1;
-		bool gb_frame	: 1; /* New frame drawn. */
-		bool lcd_blank	: 1;
-	};
-
 	/* Cartridge information:
 	 * Memory Bank Controller (MBC) type. */
 	int8_t mbc;
@@ -617,15 +1090,94 @@ struct gb_s
 
 	union cart_rtc rtc_latched, rtc_real;
 
-	struct cpu_registers_s cpu_reg;
-	//struct gb_registers_s gb_reg;
-	struct count_s counter;
+	/* ROM and cart RAM buffers registered with gb_init_direct(). NULL if
+	 * only the front-end callbacks are available. */
+	struct
+	{
+		const uint8_t *rom;
+		uint_fast32_t rom_size;
+		uint8_t *cart_ram;
+		uint_fast32_t cart_ram_size;
+	} host;
+
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+	struct
+	{
+		/* Registers at the previous backward jump, if no event was
+		 * handled since. */
+		struct cpu_registers_s reg;
+		uint_fast16_t branch;
+		uint32_t cycles;
+		bool valid;
+
+		/* Number of clock cycles skipped since reset. */
+		uint64_t skipped_cycles;
+	} idle;
+#endif
+
+#if PEANUT_GB_USE_JIT
+	/* Executable buffer registered with gb_init_jit(). */
+	struct
+	{
+		uint8_t *code;
+		size_t size;
+		size_t used;
+		/* Flags register value for each value of the x86 AH register
+		 * after LAHF. */
+		uint8_t flags[0x100];
+	} jit;
+#endif
 
+#if PEANUT_GB_RELOCATE_MEMORY
+	uint8_t *wram;
+	uint8_t *vram;
+#else
 	/* TODO: Allow implementation to allocate WRAM, VRAM and Frame Buffer. */
 	uint8_t wram[WRAM_SIZE];
 	uint8_t vram[VRAM_SIZE];
-	uint8_t oam[OAM_SIZE];
-	uint8_t hram_io[HRAM_IO_SIZE];
+#endif
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	struct
+	{
+		/* Source data, read when the transfer started. */
+		uint8_t src[OAM_SIZE];
+		/* Number of bytes copied to OAM so far. */
+		uint_fast8_t copied;
+	} dma;
+#endif
+
+#if PEANUT_GB_TILE_CACHE
+	struct
+	{
+		/* Colour index of each pixel of each tile, from left to
+		 * right. */
+		uint8_t pixels[VRAM_TILE_COUNT][8][8];
+		/* Set bits mark tiles that were written to since they were
+		 * last decoded. */
+		uint32_t dirty[VRAM_TILE_COUNT / 32];
+	} tile_cache;
+#endif
+
+#if PEANUT_GB_DEFERRED_RENDER
+	struct
+	{
+		/* Writes made while lines wait to be drawn. */
+		struct
+		{
+			uint16_t addr;
+			uint8_t old;
+			uint8_t val;
+			/* Number of lines waiting when the write was made. */
+			uint8_t line;
+		} log[PEANUT_GB_DEFERRED_LOG_SIZE];
+		uint_fast16_t count;
+
+		/* Lines waiting to be drawn, starting at first_line. */
+		uint8_t lines;
+		uint8_t first_line;
+	} deferred;
+#endif
 
 	struct
 	{
@@ -652,6 +1204,12 @@ struct gb_s
 				const uint8_t *pixels,
 				const uint_fast8_t line);
 
+		/* Frame buffer that lines are drawn to instead of being passed
+		 * to lcd_draw_line(), if not NULL. Line n starts at
+		 * framebuffer + n * framebuffer_stride. */
+		uint8_t *framebuffer;
+		size_t framebuffer_stride;
+
 		/* Palettes */
 		uint8_t bg_palette[4];
 		uint8_t sp_palette[8];
@@ -659,6 +1217,14 @@ struct gb_s
 		uint8_t window_clear;
 		uint8_t WY;
 
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+		/* Sprites drawn on each line, from high to low priority. Found
+		 * again when the position or size of a sprite changes. */
+		uint8_t line_sprites[LCD_HEIGHT][MAX_SPRITES_LINE];
+		uint8_t line_sprite_count[LCD_HEIGHT];
+		bool line_sprites_valid;
+#endif
+
 		/* Only support 30fps frame skip. */
 		bool frame_skip_count : 1;
 		bool interlace_count : 1;
@@ -678,6 +1244,10 @@ struct gb_s
 		 */
 		bool interlace : 1;
 		bool frame_skip : 1;
+#if PEANUT_GB_USE_JIT
+		/* Set to ignore translated code and only use the interpreter. */
+		bool interpreter_only : 1;
+#endif
 
 		union
 		{
@@ -704,6 +1274,26 @@ struct gb_s
 	} direct;
 };
 
+/* Offset of the end of a member of struct gb_s. */
+#define PEANUT_GB_END_OF(member)					\
+	(offsetof(struct gb_s, member) + sizeof(((struct gb_s *)0)->member))
+
+/* Fail to compile if the state used by every instruction grows larger than
+ * PEANUT_GB_HOT_SIZE and PEANUT_GB_HOT_SET_SIZE, or moves past them. */
+typedef char __gb_hot_size_check[
+	offsetof(struct gb_s, counter.elapsed) <= PEANUT_GB_HOT_SIZE ? 1 : -1];
+typedef char __gb_hot_map_check[
+	PEANUT_GB_END_OF(map) <= PEANUT_GB_HOT_SET_SIZE ? 1 : -1];
+typedef char __gb_hot_mbc_check[
+	PEANUT_GB_END_OF(mbc_handlers) <= PEANUT_GB_HOT_SET_SIZE ? 1 : -1];
+typedef char __gb_hot_hram_io_check[
+	PEANUT_GB_END_OF(hram_io) <= PEANUT_GB_HOT_SET_SIZE ? 1 : -1];
+#if PEANUT_GB_USE_BLOCK_CACHE
+typedef char __gb_hot_block_cache_check[
+	PEANUT_GB_END_OF(block_cache.ram_code) <= PEANUT_GB_HOT_SET_SIZE ?
+	1 : -1];
+#endif
+
 #ifndef PEANUT_GB_HEADER_ONLY
 
 #define IO_JOYP	0x00
@@ -740,127 +1330,460 @@ struct gb_s
 #define IO_STAT_MODE_VBLANK_OR_TRANSFER_MASK 0x1
 
 /**
- * Internal function used to read bytes.
- * addr is host platform endian.
+ * Recalculates gb->intr_pending. Must be called after any change to IF or IE.
  */
-uint8_t __gb_read(struct gb_s *gb, uint16_t addr)
+PGB_HOT void __gb_update_intr_pending(struct gb_s *gb)
 {
-	switch(PEANUT_GB_GET_MSN16(addr))
-	{
-	case 0x0:
-		/* IO_BOOT is only set to 1 if gb->gb_bootrom_read was not NULL
-		 * on reset. */
-		if(gb->hram_io[IO_BOOT] == 0 && addr < 0x0100)
-		{
-			return gb->gb_bootrom_read(gb, addr);
-		}
+	gb->intr_pending =
+		gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & ANY_INTR;
+}
 
-		/* Fallthrough */
-	case 0x1:
-	case 0x2:
-	case 0x3:
-		return gb->gb_rom_read(gb, addr);
+/* Number of clock cycles between TIMA increments for each TAC rate. */
+static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
 
-	case 0x4:
-	case 0x5:
-	case 0x6:
-	case 0x7:
-		if(gb->mbc == 1 && gb->cart_mode_select)
-			return gb->gb_rom_read(gb,
-					       addr + ((gb->selected_rom_bank & 0x1F) - 1) * ROM_BANK_SIZE);
-		else
-			return gb->gb_rom_read(gb, addr + (gb->selected_rom_bank - 1) * ROM_BANK_SIZE);
+/**
+ * Recalculates the earliest deadline of all scheduled events. Must be called
+ * after any change to the event deadlines.
+ */
+PGB_HOT void __gb_update_next_event(struct gb_s *gb)
+{
+	uint_fast8_t e;
+	int32_t nearest = INT32_MAX;
 
-	case 0x8:
-	case 0x9:
-		return gb->vram[addr - VRAM_ADDR];
+	for(e = 0; e < GB_EVENT_MAX; e++)
+	{
+		int32_t delta;
 
-	case 0xA:
-	case 0xB:
-		if(gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
-		{
-			return gb->rtc_latched.bytes[gb->cart_ram_bank - 0x08];
-		}
-		else if(gb->cart_ram && gb->enable_cart_ram)
-		{
-			if(gb->mbc == 2)
-			{
-				/* Only 9 bits are available in address. */
-				addr &= 0x1FF;
-				return gb->gb_cart_ram_read(gb, addr);
-			}
-			else if((gb->cart_mode_select || gb->mbc != 1) &&
-					gb->cart_ram_bank < gb->num_ram_banks)
-			{
-				return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR +
-							    (gb->cart_ram_bank * CRAM_BANK_SIZE));
-			}
-			else
-				return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR);
-		}
+		if(!(gb->counter.scheduled & (1 << e)))
+			continue;
 
-		return 0xFF;
+		delta = (int32_t)(gb->counter.event[e] - gb->counter.cycles);
 
-	case 0xC:
-	case 0xD:
-		return gb->wram[addr - WRAM_0_ADDR];
+		if(delta < nearest)
+			nearest = delta;
+	}
 
-	case 0xE:
-		return gb->wram[addr - ECHO_ADDR];
+	gb->counter.next_event = gb->counter.cycles + (uint32_t)nearest;
+}
 
-	case 0xF:
-		if(addr < OAM_ADDR)
-			return gb->wram[addr - ECHO_ADDR];
+PGB_HOT void __gb_schedule_event(struct gb_s *gb, enum gb_event_e e,
+		uint32_t deadline)
+{
+	gb->counter.event[e] = deadline;
+	gb->counter.scheduled |= (1 << e);
+	__gb_update_next_event(gb);
+}
 
-		if(addr < UNUSED_ADDR)
-			return gb->oam[addr - OAM_ADDR];
+void __gb_cancel_event(struct gb_s *gb, enum gb_event_e e)
+{
+	gb->counter.scheduled &= ~(1 << e);
+	__gb_update_next_event(gb);
+}
 
-		/* Unusable memory area. Reading from this area returns 0xFF.*/
-		if(addr < IO_ADDR)
-			return 0xFF;
+/**
+ * Returns the number of cycles counted towards an event with the given period.
+ * If the event is not scheduled, the counter saved when it was stopped is
+ * returned instead.
+ */
+uint_fast32_t __gb_event_count(struct gb_s *gb, enum gb_event_e e,
+		uint_fast32_t period, uint_fast32_t stopped_count)
+{
+	if(!(gb->counter.scheduled & (1 << e)))
+		return stopped_count;
 
-		/* APU registers. */
-		if((addr >= 0xFF10) && (addr <= 0xFF3F))
-		{
-#if ENABLE_SOUND
-			return audio_read(addr);
-#else
-			static const uint8_t ortab[] = {
-				0x80, 0x3f, 0x00, 0xff, 0xbf,
-				0xff, 0x3f, 0x00, 0xff, 0xbf,
-				0x7f, 0xff, 0x9f, 0xff, 0xbf,
-				0xff, 0xff, 0x00, 0x00, 0xbf,
-				0x00, 0x00, 0x70,
-				0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-			};
-			return gb->hram_io[addr - IO_ADDR] | ortab[addr - IO_ADDR];
-#endif
+	return period - (gb->counter.event[e] - gb->counter.cycles);
+}
+
+/**
+ * Schedules the next LCD mode transition according to the current LCD mode.
+ */
+void __gb_schedule_lcd(struct gb_s *gb)
+{
+	uint32_t deadline = gb->counter.lcd_line_start;
+
+	switch(gb->hram_io[IO_STAT] & STAT_MODE)
+	{
+	case IO_STAT_MODE_HBLANK:
+		deadline += LCD_MODE_2_CYCLES;
+		break;
+
+	case IO_STAT_MODE_SEARCH_OAM:
+		deadline += LCD_MODE_3_CYCLES;
+		break;
+
+	default:
+		deadline += LCD_LINE_CYCLES;
+		break;
+	}
+
+	__gb_schedule_event(gb, GB_EVENT_LCD, deadline);
+}
+
+/**
+ * Calculates the values of DIV and TIMA. These registers are only updated when
+ * read, and when TIMA overflows.
+ */
+PGB_HOT void __gb_update_timer(struct gb_s *gb)
+{
+	gb->hram_io[IO_DIV] = gb->counter.div_offset +
+		(uint8_t)(gb->counter.cycles / DIV_CYCLES);
+
+	if(gb->counter.scheduled & (1 << GB_EVENT_TIMA))
+	{
+		const uint_fast16_t period =
+			TAC_CYCLES[gb->hram_io[IO_TAC] & IO_TAC_RATE_MASK];
+		const uint32_t inc =
+			(gb->counter.cycles - gb->counter.tima_start) / period;
+
+		gb->hram_io[IO_TIMA] += inc;
+		gb->counter.tima_start += inc * period;
+	}
+}
+
+/**
+ * Returns the number of cycles counted towards the next TIMA increment.
+ */
+uint_fast16_t __gb_tima_count(struct gb_s *gb)
+{
+	if(!(gb->counter.scheduled & (1 << GB_EVENT_TIMA)))
+		return gb->counter.tima_count;
+
+	__gb_update_timer(gb);
+	return gb->counter.cycles - gb->counter.tima_start;
+}
+
+/**
+ * Starts or stops the TIMA event depending on TAC. The given number of cycles
+ * are already counted towards the next TIMA increment. The event is scheduled
+ * for the cycle on which TIMA overflows.
+ */
+void __gb_schedule_tima(struct gb_s *gb, uint_fast16_t tima_count)
+{
+	if(gb->hram_io[IO_TAC] & IO_TAC_ENABLE_MASK)
+	{
+		const uint_fast16_t period =
+			TAC_CYCLES[gb->hram_io[IO_TAC] & IO_TAC_RATE_MASK];
+
+		gb->counter.tima_start = gb->counter.cycles - tima_count;
+		__gb_schedule_event(gb, GB_EVENT_TIMA, gb->counter.tima_start +
+			(uint32_t)(0x100 - gb->hram_io[IO_TIMA]) * period);
+	}
+	else
+	{
+		gb->counter.tima_count = tima_count;
+		__gb_cancel_event(gb, GB_EVENT_TIMA);
+	}
+}
+
+/**
+ * Starts or stops the serial event depending on SC. The TX callback is called
+ * at the start of a new transfer.
+ */
+void __gb_schedule_serial(struct gb_s *gb, uint_fast16_t serial_count)
+{
+	if(!(gb->hram_io[IO_SC] & SERIAL_SC_TX_START))
+	{
+		gb->counter.serial_count = serial_count;
+		__gb_cancel_event(gb, GB_EVENT_SERIAL);
+		return;
+	}
+
+	/* If new transfer, call TX function. */
+	if(serial_count == 0 && gb->gb_serial_tx != NULL)
+		(gb->gb_serial_tx)(gb, gb->hram_io[IO_SB]);
+
+	__gb_schedule_event(gb, GB_EVENT_SERIAL,
+		gb->counter.cycles - serial_count + SERIAL_CYCLES);
+}
+
+/**
+ * Adds inc to an RTC counter that wraps to 0 at period. Invalid values past
+ * the period count up to the width of the register and wrap to 0 without a
+ * carry. Returns the carry to the next counter.
+ */
+PGB_COLD uint_fast32_t __gb_rtc_add(uint8_t *counter, uint_fast32_t inc,
+		uint_fast8_t period, uint_fast8_t width)
+{
+	if(PGB_UNLIKELY(*counter >= period))
+	{
+		if(inc < (uint_fast32_t)(width - *counter))
+		{
+			*counter += inc;
+			return 0;
 		}
 
-		/* HRAM */
-		if(addr >= IO_ADDR)
-			return gb->hram_io[addr - IO_ADDR];
+		inc -= width - *counter;
+		*counter = 0;
 	}
 
+	inc += *counter;
+	*counter = inc % period;
+	return inc / period;
+}
 
-	/* Return address that caused read error. */
-	(gb->gb_error)(gb, GB_INVALID_READ, addr);
-	PGB_UNREACHABLE();
+/**
+ * Internal function used to advance the RTC by a number of seconds.
+ */
+PGB_COLD void __gb_rtc_advance(struct gb_s *gb, uint_fast32_t sec)
+{
+	uint_fast32_t days;
+
+	sec = __gb_rtc_add(&gb->rtc_real.reg.sec, sec, 60, 64);
+	sec = __gb_rtc_add(&gb->rtc_real.reg.min, sec, 60, 64);
+	sec = __gb_rtc_add(&gb->rtc_real.reg.hour, sec, 24, 32);
+
+	/* Bit 8 of days */
+	days = gb->rtc_real.reg.yday + ((gb->rtc_real.reg.high & 1) << 8) + sec;
+
+	if(days > 0x1FF)
+		gb->rtc_real.reg.high |= 0x80; /* Overflow bit */
+
+	gb->rtc_real.reg.yday = days & 0xFF;
+	gb->rtc_real.reg.high = (gb->rtc_real.reg.high & 0xFE) | ((days >> 8) & 1);
 }
 
 /**
- * Internal function used to write bytes.
+ * Adds the seconds passed since the last update to the RTC registers, if the
+ * RTC is running.
+ */
+PGB_COLD void __gb_update_rtc(struct gb_s *gb)
+{
+	uint_fast32_t sec;
+
+	if(!(gb->counter.scheduled & (1 << GB_EVENT_RTC)))
+		return;
+
+	sec = (gb->counter.cycles - gb->counter.rtc_start) / RTC_CYCLES;
+	gb->counter.rtc_start += sec * RTC_CYCLES;
+	__gb_rtc_advance(gb, sec);
+}
+
+/**
+ * Returns the number of cycles counted towards the next RTC second.
+ */
+PGB_COLD uint_fast32_t __gb_rtc_count(struct gb_s *gb)
+{
+	if(!(gb->counter.scheduled & (1 << GB_EVENT_RTC)))
+		return gb->counter.rtc_count;
+
+	__gb_update_rtc(gb);
+	return gb->counter.cycles - gb->counter.rtc_start;
+}
+
+/**
+ * Starts or stops the RTC event depending on the RTC halt flag.
+ */
+PGB_COLD void __gb_schedule_rtc(struct gb_s *gb, uint_fast32_t rtc_count)
+{
+	if(gb->mbc == 3 && (gb->rtc_real.reg.high & 0x40) == 0)
+	{
+		gb->counter.rtc_start = gb->counter.cycles - rtc_count;
+		__gb_schedule_event(gb, GB_EVENT_RTC, gb->counter.rtc_start +
+			RTC_UPDATE_SECONDS * RTC_CYCLES);
+	}
+	else
+	{
+		gb->counter.rtc_count = rtc_count;
+		__gb_cancel_event(gb, GB_EVENT_RTC);
+	}
+}
+
+/**
+ * Rebuilds the memory map used by __gb_read() and __gb_write(). Must be called
+ * after any change to the MBC registers, cart RAM enable or boot ROM flag.
+ */
+void __gb_update_memory_map(struct gb_s *gb)
+{
+	uint_fast8_t i;
+	int_fast32_t rom_bank_addr;
+	int_fast32_t cart_ram_rd_addr = -1;
+	int_fast32_t cart_ram_wr_addr = -1;
+
+	/* ROM is mapped directly if the front-end registered a buffer
+	 * containing the selected bank. Otherwise ROM, and the boot ROM, is
+	 * only accessible through the front-end callbacks. */
+	if(gb->mbc == 1 && gb->cart_mode_select)
+		rom_bank_addr = ((gb->selected_rom_bank & 0x1F) - 1) * ROM_BANK_SIZE;
+	else
+		rom_bank_addr = (gb->selected_rom_bank - 1) * ROM_BANK_SIZE;
+
+	for(i = 0x0; i < 0x8; i++)
+	{
+		int_fast32_t addr = (int_fast32_t)i << 12;
+
+		if(i >= 0x4)
+			addr += rom_bank_addr;
+
+		if(gb->host.rom != NULL && addr >= 0 &&
+				(uint_fast32_t)addr + 0x1000 <= gb->host.rom_size)
+			gb->map.read[i] = gb->host.rom + addr;
+		else
+			gb->map.read[i] = NULL;
+
+		/* Writes to ROM are MBC register writes. */
+		gb->map.write[i] = NULL;
+	}
+
+	if(gb->hram_io[IO_BOOT] == 0)
+		gb->map.read[0x0] = NULL;
+
+	/* Cart RAM follows the same bank selection as __gb_read_slow() and
+	 * __gb_write_slow(). RTC registers and MBC2 RAM are always handled
+	 * there. */
+	if(gb->cart_ram && gb->enable_cart_ram && gb->mbc != 2 &&
+			!(gb->mbc == 3 && gb->cart_ram_bank >= 0x08))
+	{
+		if((gb->cart_mode_select || gb->mbc != 1) &&
+				gb->cart_ram_bank < gb->num_ram_banks)
+			cart_ram_rd_addr = gb->cart_ram_bank * CRAM_BANK_SIZE;
+		else
+			cart_ram_rd_addr = 0;
+
+		if(gb->cart_mode_select &&
+				gb->cart_ram_bank < gb->num_ram_banks)
+			cart_ram_wr_addr = gb->cart_ram_bank * CRAM_BANK_SIZE;
+		else if(gb->num_ram_banks)
+			cart_ram_wr_addr = 0;
+	}
+
+	for(i = 0xA; i < 0xC; i++)
+	{
+		const uint_fast32_t page_addr = (uint_fast32_t)(i - 0xA) << 12;
+
+		gb->map.read[i] = NULL;
+		gb->map.write[i] = NULL;
+
+		if(gb->host.cart_ram == NULL)
+			continue;
+
+		if(cart_ram_rd_addr >= 0 && cart_ram_rd_addr + page_addr + 0x1000
+				<= gb->host.cart_ram_size)
+			gb->map.read[i] = gb->host.cart_ram + cart_ram_rd_addr + page_addr;
+
+		if(cart_ram_wr_addr >= 0 && cart_ram_wr_addr + page_addr + 0x1000
+				<= gb->host.cart_ram_size)
+			gb->map.write[i] = gb->host.cart_ram + cart_ram_wr_addr + page_addr;
+	}
+
+	gb->map.read[0x8] = gb->map.write[0x8] = &gb->vram[0x0000];
+	gb->map.read[0x9] = gb->map.write[0x9] = &gb->vram[0x1000];
+#if PEANUT_GB_TILE_CACHE
+	/* Catch writes to tile data. */
+	gb->map.write[0x8] = gb->map.write[0x9] = NULL;
+#endif
+#if PEANUT_GB_DEFERRED_RENDER
+	/* Catch writes to VRAM while lines wait to be drawn. */
+	if(gb->deferred.lines != 0)
+		gb->map.write[0x8] = gb->map.write[0x9] = NULL;
+#endif
+	gb->map.read[0xC] = gb->map.write[0xC] = &gb->wram[0x0000];
+	gb->map.read[0xD] = gb->map.write[0xD] = &gb->wram[0x1000];
+	/* Echo RAM. */
+	gb->map.read[0xE] = gb->map.write[0xE] = &gb->wram[0x0000];
+	/* Remainder of echo RAM, OAM, IO and HRAM. */
+	gb->map.read[0xF] = gb->map.write[0xF] = NULL;
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+	gb->block_cache.rom_bank_addr = rom_bank_addr;
+
+	/* Reading opcodes from directly mapped ROM is faster than looking
+	 * them up in the cache, unless pairs of them are to be fused. */
+	gb->block_cache.bypass = gb->host.rom != NULL &&
+		!PEANUT_GB_USE_SUPERINSTRUCTIONS;
+
+	/* Catch writes to WRAM pages holding cached code. */
+	if(gb->block_cache.ram_code & (1 << 0xC))
+		gb->map.write[0xC] = gb->map.write[0xE] = NULL;
+
+	if(gb->block_cache.ram_code & (1 << 0xD))
+		gb->map.write[0xD] = NULL;
+
+	/* The bank that the current block was decoded from may have been
+	 * switched out. */
+	gb->block_cache.next_count = 0;
+#endif
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	/* Only IO and HRAM are accessible during OAM DMA. */
+	if(gb->counter.scheduled & (1 << GB_EVENT_DMA))
+	{
+		for(i = 0x0; i < 0xF; i++)
+			gb->map.read[i] = gb->map.write[i] = NULL;
+	}
+#endif
+}
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+/**
+ * Invalidates cached blocks in the WRAM or HRAM page written to.
+ */
+void __gb_block_cache_write(struct gb_s *gb, uint_fast16_t addr)
+{
+	uint_fast8_t page;
+
+	/* Echo RAM is mapped to WRAM. */
+	if(addr >= WRAM_0_ADDR && addr < OAM_ADDR)
+		page = 0xC + (((addr - WRAM_0_ADDR) >> 12) & 1);
+	else if(addr >= HRAM_ADDR && addr < INTR_EN_ADDR)
+		page = 0xF;
+	else
+		return;
+
+	if(PGB_LIKELY(!(gb->block_cache.ram_code & (1 << page))))
+		return;
+
+	gb->block_cache.ram_code &= ~(1 << page);
+	gb->block_cache.ram_gen[page]++;
+	__gb_update_memory_map(gb);
+}
+
+/**
+ * Drops all cached blocks.
+ */
+PGB_COLD void __gb_block_cache_reset(struct gb_s *gb)
+{
+	uint_fast16_t i;
+
+	for(i = 0; i < PEANUT_GB_BLOCK_CACHE_SIZE; i++)
+		gb->block_cache.block[i].key = -1;
+
+	gb->block_cache.next_count = 0;
+	gb->block_cache.ram_code = 0;
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+	memset(gb->block_cache.fused_count, 0,
+			sizeof(gb->block_cache.fused_count));
+#endif
+#if PEANUT_GB_USE_JIT
+	gb->jit.used = 0;
+#endif
+}
+#endif
+
+/**
+ * Internal functions used to access the switchable ROM bank, the MBC registers
+ * and cart RAM. These are only called with a constant mbc by the handlers in
+ * gb_mbc_handlers, so that the handlers of each MBC type are compiled without
+ * branches on the MBC type.
  */
-void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
+static PGB_ALWAYS_INLINE uint8_t __gb_mbc_rom_read(struct gb_s *gb,
+		const int_fast8_t mbc, uint_fast16_t addr)
+{
+	if(mbc == 1 && gb->cart_mode_select)
+		return gb->gb_rom_read(gb,
+				       addr + ((gb->selected_rom_bank & 0x1F) - 1) * ROM_BANK_SIZE);
+	else
+		return gb->gb_rom_read(gb, addr + (gb->selected_rom_bank - 1) * ROM_BANK_SIZE);
+}
+
+static PGB_ALWAYS_INLINE void __gb_mbc_rom_write(struct gb_s *gb,
+		const int_fast8_t mbc, uint_fast16_t addr, uint8_t val)
 {
 	switch(PEANUT_GB_GET_MSN16(addr))
 	{
 	case 0x0:
 	case 0x1:
 		/* Set RAM enable bit. MBC2 is handled in fall-through. */
-		if(gb->mbc > 0 && gb->mbc != 2 && gb->cart_ram)
+		if(mbc > 0 && mbc != 2 && gb->cart_ram)
 		{
 			gb->enable_cart_ram = ((val & 0x0F) == 0x0A);
 			return;
@@ -868,7 +1791,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 
 	/* Intentional fall through. */
 	case 0x2:
-		if(gb->mbc == 5)
+		if(mbc == 5)
 		{
 			gb->selected_rom_bank = (gb->selected_rom_bank & 0x100) | val;
 			gb->selected_rom_bank =
@@ -878,7 +1801,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 
 	/* Intentional fall through. */
 	case 0x3:
-		if(gb->mbc == 1)
+		if(mbc == 1)
 		{
 			//selected_rom_bank = val & 0x7;
 			gb->selected_rom_bank = (val & 0x1F) | (gb->selected_rom_bank & 0x60);
@@ -886,7 +1809,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 			if((gb->selected_rom_bank & 0x1F) == 0x00)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 2)
+		else if(mbc == 2)
 		{
 			/* If bit 8 is 1, then set ROM bank number. */
 			if(addr & 0x100)
@@ -903,14 +1826,14 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 				return;
 			}
 		}
-		else if(gb->mbc == 3)
+		else if(mbc == 3)
 		{
 			gb->selected_rom_bank = val & 0x7F;
 
 			if(!gb->selected_rom_bank)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 5)
+		else if(mbc == 5)
 			gb->selected_rom_bank = (val & 0x01) << 8 | (gb->selected_rom_bank & 0xFF);
 
 		gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
@@ -918,15 +1841,15 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 
 	case 0x4:
 	case 0x5:
-		if(gb->mbc == 1)
+		if(mbc == 1)
 		{
 			gb->cart_ram_bank = (val & 3);
 			gb->selected_rom_bank = ((val & 3) << 5) | (gb->selected_rom_bank & 0x1F);
 			gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
 		}
-		else if(gb->mbc == 3)
+		else if(mbc == 3)
 			gb->cart_ram_bank = val;
-		else if(gb->mbc == 5)
+		else if(mbc == 5)
 			gb->cart_ram_bank = (val & 0x0F);
 
 		return;
@@ -934,2541 +1857,4417 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 	case 0x6:
 	case 0x7:
 		val &= 1;
-		if(gb->mbc == 3 && val && gb->cart_mode_select == 0)
+		if(mbc == 3 && val && gb->cart_mode_select == 0)
+		{
+			__gb_update_rtc(gb);
 			memcpy(&gb->rtc_latched.bytes, &gb->rtc_real.bytes, sizeof(gb->rtc_latched.bytes));
+		}
 
 		gb->cart_mode_select = val;
 		return;
+	}
+}
 
-	case 0x8:
-	case 0x9:
-		gb->vram[addr - VRAM_ADDR] = val;
-		return;
+static PGB_ALWAYS_INLINE uint8_t __gb_mbc_ram_read(struct gb_s *gb,
+		const int_fast8_t mbc, uint_fast16_t addr)
+{
+	if(mbc == 3 && gb->cart_ram_bank >= 0x08)
+	{
+		/* Only registers 0x08-0x0C exist. */
+		if(gb->cart_ram_bank > 0x0C)
+			return 0xFF;
 
-	case 0xA:
-	case 0xB:
-		if(gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
+		return gb->rtc_latched.bytes[gb->cart_ram_bank - 0x08];
+	}
+	else if(gb->cart_ram && gb->enable_cart_ram)
+	{
+		if(mbc == 2)
 		{
-			const uint8_t rtc_reg_mask[5] = {
-				0x3F, 0x3F, 0x1F, 0xFF, 0xC1
-			};
-			uint8_t reg = gb->cart_ram_bank - 0x08;
-			//if(reg == 0) gb->counter.rtc_count = 0;
-
-			gb->rtc_real.bytes[reg] = val & rtc_reg_mask[reg];
+			/* Only 9 bits are available in address. */
+			addr &= 0x1FF;
+			return gb->gb_cart_ram_read(gb, addr);
 		}
-		/* Do not write to RAM if unavailable or disabled. */
-		else if(gb->cart_ram && gb->enable_cart_ram)
+		else if((gb->cart_mode_select || mbc != 1) &&
+				gb->cart_ram_bank < gb->num_ram_banks)
 		{
-			if(gb->mbc == 2)
-			{
-				/* Only 9 bits are available in address. */
-				addr &= 0x1FF;
-				/* Data is only 4 bits wide in MBC2 RAM. */
-				val &= 0x0F;
-				gb->gb_cart_ram_write(gb, addr, val);
-			}
-			else if(gb->cart_mode_select &&
-					gb->cart_ram_bank < gb->num_ram_banks)
-			{
-				gb->gb_cart_ram_write(gb,
-						      addr - CART_RAM_ADDR + (gb->cart_ram_bank * CRAM_BANK_SIZE), val);
-			}
-			else if(gb->num_ram_banks)
-				gb->gb_cart_ram_write(gb, addr - CART_RAM_ADDR, val);
+			return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR +
+						    (gb->cart_ram_bank * CRAM_BANK_SIZE));
 		}
+		else
+			return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR);
+	}
 
-		return;
-
-	case 0xC:
-		gb->wram[addr - WRAM_0_ADDR] = val;
-		return;
-
-	case 0xD:
-		gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE] = val;
-		return;
-
-	case 0xE:
-		gb->wram[addr - ECHO_ADDR] = val;
-		return;
+	return 0xFF;
+}
 
-	case 0xF:
-		if(addr < OAM_ADDR)
-		{
-			gb->wram[addr - ECHO_ADDR] = val;
-			return;
-		}
+static PGB_ALWAYS_INLINE void __gb_mbc_ram_write(struct gb_s *gb,
+		const int_fast8_t mbc, uint_fast16_t addr, uint8_t val)
+{
+	if(mbc == 3 && gb->cart_ram_bank >= 0x08)
+	{
+		const uint8_t rtc_reg_mask[5] = {
+			0x3F, 0x3F, 0x1F, 0xFF, 0xC1
+		};
+		uint8_t reg = gb->cart_ram_bank - 0x08;
+		//if(reg == 0) gb->counter.rtc_count = 0;
 
-		if(addr < UNUSED_ADDR)
+		/* Writes to registers past 0x0C are ignored. */
+		if(reg < sizeof(rtc_reg_mask))
 		{
-			gb->oam[addr - OAM_ADDR] = val;
-			return;
-		}
+			uint_fast32_t rtc_count = __gb_rtc_count(gb);
 
-		/* Unusable memory area. */
-		if(addr < IO_ADDR)
-			return;
+			gb->rtc_real.bytes[reg] = val & rtc_reg_mask[reg];
 
-		if(HRAM_ADDR <= addr && addr < INTR_EN_ADDR)
+			/* The RTC may have been halted or resumed. */
+			__gb_schedule_rtc(gb, rtc_count);
+		}
+	}
+	/* Do not write to RAM if unavailable or disabled. */
+	else if(gb->cart_ram && gb->enable_cart_ram)
+	{
+		if(mbc == 2)
 		{
-			gb->hram_io[addr - IO_ADDR] = val;
-			return;
+			/* Only 9 bits are available in address. */
+			addr &= 0x1FF;
+			/* Data is only 4 bits wide in MBC2 RAM. */
+			val &= 0x0F;
+			gb->gb_cart_ram_write(gb, addr, val);
 		}
-
-		if((addr >= 0xFF10) && (addr <= 0xFF3F))
+		else if(gb->cart_mode_select &&
+				gb->cart_ram_bank < gb->num_ram_banks)
 		{
-#if ENABLE_SOUND
-			audio_write(addr, val);
-#else
-			gb->hram_io[addr - IO_ADDR] = val;
-#endif
-			return;
+			gb->gb_cart_ram_write(gb,
+					      addr - CART_RAM_ADDR + (gb->cart_ram_bank * CRAM_BANK_SIZE), val);
 		}
+		else if(gb->num_ram_banks)
+			gb->gb_cart_ram_write(gb, addr - CART_RAM_ADDR, val);
+	}
+}
 
-		/* IO and Interrupts. */
-		switch(PEANUT_GB_GET_LSB16(addr))
-		{
-		/* Joypad */
-		case 0x00:
-			/* Only bits 5 and 4 are R/W.
-			 * The lower bits are overwritten later, and the two most
-			 * significant bits are unused. */
-			gb->hram_io[IO_JOYP] = val;
+#define PGB_MBC_INSTANTIATE(n)						\
+	uint8_t __gb_mbc##n##_rom_read(struct gb_s *gb, uint_fast16_t addr)	\
+	{								\
+		return __gb_mbc_rom_read(gb, n, addr);			\
+	}								\
+	void __gb_mbc##n##_rom_write(struct gb_s *gb, uint_fast16_t addr,	\
+			uint8_t val)					\
+	{								\
+		__gb_mbc_rom_write(gb, n, addr, val);			\
+	}								\
+	uint8_t __gb_mbc##n##_ram_read(struct gb_s *gb, uint_fast16_t addr)	\
+	{								\
+		return __gb_mbc_ram_read(gb, n, addr);			\
+	}								\
+	void __gb_mbc##n##_ram_write(struct gb_s *gb, uint_fast16_t addr,	\
+			uint8_t val)					\
+	{								\
+		__gb_mbc_ram_write(gb, n, addr, val);			\
+	}
 
-			/* Direction keys selected */
-			if((gb->hram_io[IO_JOYP] & 0x10) == 0)
-				gb->hram_io[IO_JOYP] |= (gb->direct.joypad >> 4);
-			/* Button keys selected */
-			else
-				gb->hram_io[IO_JOYP] |= (gb->direct.joypad & 0x0F);
+PGB_MBC_INSTANTIATE(0)
+PGB_MBC_INSTANTIATE(1)
+PGB_MBC_INSTANTIATE(2)
+PGB_MBC_INSTANTIATE(3)
+PGB_MBC_INSTANTIATE(5)
 
-			return;
+#define PGB_MBC_HANDLERS(n)						\
+	{								\
+		__gb_mbc##n##_rom_read, __gb_mbc##n##_rom_write,	\
+		__gb_mbc##n##_ram_read, __gb_mbc##n##_ram_write	\
+	}
 
-		/* Serial */
-		case 0x01:
-			gb->hram_io[IO_SB] = val;
+/* Indexed by gb->mbc. There is no MBC4. */
+static const struct gb_mbc_handlers_s gb_mbc_handlers[6] =
+{
+	PGB_MBC_HANDLERS(0), PGB_MBC_HANDLERS(1), PGB_MBC_HANDLERS(2),
+	PGB_MBC_HANDLERS(3), PGB_MBC_HANDLERS(0), PGB_MBC_HANDLERS(5)
+};
+
+/**
+ * Reports an unrecoverable error to the front-end.
+ */
+PGB_COLD void __gb_error(struct gb_s *gb, const enum gb_error_e err,
+		const uint16_t addr)
+{
+	(gb->gb_error)(gb, err, addr);
+}
+
+/**
+ * Internal function used to read bytes that are not backed by a page in the
+ * memory map.
+ */
+PGB_HOT uint8_t __gb_read_slow(struct gb_s *gb, uint16_t addr)
+{
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	if(PGB_UNLIKELY(gb->counter.scheduled & (1 << GB_EVENT_DMA)) &&
+			addr < IO_ADDR)
+		return 0xFF;
+#endif
+
+	switch(PEANUT_GB_GET_MSN16(addr))
+	{
+	case 0x0:
+		/* IO_BOOT is only set to 1 if gb->gb_bootrom_read was not NULL
+		 * on reset. */
+		if(gb->hram_io[IO_BOOT] == 0 && addr < 0x0100)
+		{
+			return gb->gb_bootrom_read(gb, addr);
+		}
+
+		/* Fallthrough */
+	case 0x1:
+	case 0x2:
+	case 0x3:
+		return gb->gb_rom_read(gb, addr);
+
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		return gb->mbc_handlers->rom_read(gb, addr);
+
+	case 0x8:
+	case 0x9:
+		return gb->vram[addr - VRAM_ADDR];
+
+	case 0xA:
+	case 0xB:
+		return gb->mbc_handlers->ram_read(gb, addr);
+
+	case 0xC:
+	case 0xD:
+		return gb->wram[addr - WRAM_0_ADDR];
+
+	case 0xE:
+		return gb->wram[addr - ECHO_ADDR];
+
+	case 0xF:
+		if(addr < OAM_ADDR)
+			return gb->wram[addr - ECHO_ADDR];
+
+		if(addr < UNUSED_ADDR)
+			return gb->oam[addr - OAM_ADDR];
+
+		/* Unusable memory area. Reading from this area returns 0xFF.*/
+		if(addr < IO_ADDR)
+			return 0xFF;
+
+		/* APU registers. */
+		if((addr >= 0xFF10) && (addr <= 0xFF3F))
+		{
+#if ENABLE_SOUND
+			return audio_read(addr);
+#else
+			static const uint8_t ortab[] = {
+				0x80, 0x3f, 0x00, 0xff, 0xbf,
+				0xff, 0x3f, 0x00, 0xff, 0xbf,
+				0x7f, 0xff, 0x9f, 0xff, 0xbf,
+				0xff, 0xff, 0x00, 0x00, 0xbf,
+				0x00, 0x00, 0x70,
+				0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+			};
+			return gb->hram_io[addr - IO_ADDR] | ortab[addr - 0xFF10];
+#endif
+		}
+
+		/* DIV and TIMA are only calculated when read. */
+		if(addr == (IO_ADDR | IO_DIV) || addr == (IO_ADDR | IO_TIMA))
+		{
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+			/* The value changes without an event, so a loop
+			 * reading it is not idle. */
+			gb->idle.valid = false;
+#endif
+			__gb_update_timer(gb);
+			return gb->hram_io[addr - IO_ADDR];
+		}
+
+		/* HRAM */
+		if(addr >= IO_ADDR)
+			return gb->hram_io[addr - IO_ADDR];
+	}
+
+
+	/* Return address that caused read error. */
+	__gb_error(gb, GB_INVALID_READ, addr);
+	PGB_UNREACHABLE();
+}
+
+/**
+ * Internal function used to read bytes.
+ * addr is host platform endian.
+ */
+static PGB_ALWAYS_INLINE uint8_t __gb_read_inline(struct gb_s *gb,
+		uint16_t addr)
+{
+	const uint8_t *page = gb->map.read[PEANUT_GB_GET_MSN16(addr)];
+
+	if(PGB_LIKELY(page != NULL))
+		return page[addr & 0x0FFF];
+
+	return __gb_read_slow(gb, addr);
+}
+
+/**
+ * Reads a byte for an instruction. Only the opcode fetch is inlined, since
+ * inlining every read made __gb_run_cpu() a fifth larger.
+ */
+PGB_HOT PGB_NOINLINE uint8_t __gb_read(struct gb_s *gb, uint16_t addr)
+{
+	return __gb_read_inline(gb, addr);
+}
+
+/**
+ * Copies the source of an OAM DMA transfer to dest. Sources in WRAM, VRAM and
+ * mapped ROM or cart RAM banks are copied directly, since a transfer never
+ * crosses a page of the memory map.
+ */
+void __gb_dma_copy(struct gb_s *gb, uint8_t *dest, uint8_t val)
+{
+	const uint_fast16_t dma_addr = (uint_fast16_t)val << 8;
+	const uint8_t *page = gb->map.read[PEANUT_GB_GET_MSN16(dma_addr)];
+	uint_fast16_t i;
+
+	if(PGB_LIKELY(page != NULL))
+	{
+		memcpy(dest, page + (dma_addr & 0x0FFF), OAM_SIZE);
+		return;
+	}
+
+	for(i = 0; i < OAM_SIZE; i++)
+		dest[i] = __gb_read(gb, dma_addr + i);
+}
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+/**
+ * Copies the bytes transferred by OAM DMA up to the current cycle to OAM.
+ */
+void __gb_update_dma(struct gb_s *gb)
+{
+	uint_fast32_t n;
+
+	if(!(gb->counter.scheduled & (1 << GB_EVENT_DMA)))
+		return;
+
+	n = (uint32_t)(gb->counter.cycles - gb->counter.dma_start) /
+		DMA_BYTE_CYCLES;
+
+	if(n > OAM_SIZE)
+		n = OAM_SIZE;
+
+	memcpy(gb->oam + gb->dma.copied, gb->dma.src + gb->dma.copied,
+		n - gb->dma.copied);
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+	if(n != gb->dma.copied)
+		gb->display.line_sprites_valid = false;
+#endif
+	gb->dma.copied = n;
+}
+#endif
+
+#if PEANUT_GB_DEFERRED_RENDER
+void __gb_draw_deferred_lines(struct gb_s *gb);
+
+/**
+ * Logs a write made while lines wait to be drawn if it changes what is drawn,
+ * so that the lines can be drawn with the value from before the write.
+ */
+PGB_HOT void __gb_defer_write(struct gb_s *gb, uint_fast16_t addr,
+		uint8_t val)
+{
+	uint8_t old;
+
+	if(addr >= VRAM_ADDR && addr < CART_RAM_ADDR)
+		old = gb->vram[addr - VRAM_ADDR];
+	else if(addr >= OAM_ADDR && addr < UNUSED_ADDR)
+		old = gb->oam[addr - OAM_ADDR];
+	else if(addr >= IO_ADDR)
+	{
+		switch(addr - IO_ADDR)
+		{
+		case IO_LCDC:
+			/* LY is reset when the LCD is switched off. */
+			if(!(val & LCDC_ENABLE))
+			{
+				__gb_draw_deferred_lines(gb);
+				return;
+			}
+			break;
+
+		case IO_DMA:
+			/* OAM DMA replaces all of OAM, so draw the lines
+			 * first instead of logging every byte. */
+			__gb_draw_deferred_lines(gb);
 			return;
 
-		case 0x02:
-			gb->hram_io[IO_SC] = val;
+		case IO_SCY:
+		case IO_SCX:
+		case IO_BGP:
+		case IO_OBP0:
+		case IO_OBP1:
+		case IO_WX:
+			break;
+
+		default:
 			return;
+		}
 
-		/* Timer Registers */
-		case 0x04:
-			gb->hram_io[IO_DIV] = 0x00;
+		old = gb->hram_io[addr - IO_ADDR];
+	}
+	else
+		return;
+
+	if(old == val)
+		return;
+
+	if(gb->deferred.count == PEANUT_GB_DEFERRED_LOG_SIZE)
+	{
+		__gb_draw_deferred_lines(gb);
+		return;
+	}
+
+	gb->deferred.log[gb->deferred.count].addr = addr;
+	gb->deferred.log[gb->deferred.count].old = old;
+	gb->deferred.log[gb->deferred.count].val = val;
+	gb->deferred.log[gb->deferred.count].line = gb->deferred.lines;
+	gb->deferred.count++;
+}
+#endif
+
+/**
+ * Internal function used to write bytes that are not backed by a page in the
+ * memory map.
+ */
+PGB_HOT void __gb_write_slow(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
+{
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	if(PGB_UNLIKELY(gb->counter.scheduled & (1 << GB_EVENT_DMA)) &&
+			addr < IO_ADDR)
+		return;
+#endif
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+	__gb_block_cache_write(gb, addr);
+#endif
+
+#if PEANUT_GB_DEFERRED_RENDER
+	if(gb->deferred.lines != 0)
+		__gb_defer_write(gb, addr, val);
+#endif
+
+	switch(PEANUT_GB_GET_MSN16(addr))
+	{
+	case 0x0:
+	case 0x1:
+	case 0x2:
+	case 0x3:
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		gb->mbc_handlers->rom_write(gb, addr, val);
+		return;
+
+	case 0x8:
+	case 0x9:
+#if PEANUT_GB_TILE_CACHE
+		if(addr < VRAM_ADDR + VRAM_BMAP_1
+				&& gb->vram[addr - VRAM_ADDR] != val)
+		{
+			uint_fast16_t tile = (addr - VRAM_ADDR) >> 4;
+			gb->tile_cache.dirty[tile / 32] |= (uint32_t)1 << (tile % 32);
+		}
+#endif
+		gb->vram[addr - VRAM_ADDR] = val;
+		return;
+
+	case 0xA:
+	case 0xB:
+		gb->mbc_handlers->ram_write(gb, addr, val);
+		return;
+
+	case 0xC:
+		gb->wram[addr - WRAM_0_ADDR] = val;
+		return;
+
+	case 0xD:
+		gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE] = val;
+		return;
+
+	case 0xE:
+		gb->wram[addr - ECHO_ADDR] = val;
+		return;
+
+	case 0xF:
+		if(addr < OAM_ADDR)
+		{
+			gb->wram[addr - ECHO_ADDR] = val;
 			return;
+		}
 
-		case 0x05:
-			gb->hram_io[IO_TIMA] = val;
+		if(addr < UNUSED_ADDR)
+		{
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+			/* Sprite Y or X position. */
+			if(addr % 4 < 2 && gb->oam[addr - OAM_ADDR] != val)
+				gb->display.line_sprites_valid = false;
+#endif
+			gb->oam[addr - OAM_ADDR] = val;
 			return;
+		}
 
-		case 0x06:
-			gb->hram_io[IO_TMA] = val;
+		/* Unusable memory area. */
+		if(addr < IO_ADDR)
 			return;
 
-		case 0x07:
-			gb->hram_io[IO_TAC] = val;
+		if(HRAM_ADDR <= addr && addr < INTR_EN_ADDR)
+		{
+			gb->hram_io[addr - IO_ADDR] = val;
+			return;
+		}
+
+		if((addr >= 0xFF10) && (addr <= 0xFF3F))
+		{
+#if ENABLE_SOUND
+			audio_write(addr, val);
+#else
+			gb->hram_io[addr - IO_ADDR] = val;
+#endif
 			return;
+		}
+
+		/* IO and Interrupts. */
+		switch(PEANUT_GB_GET_LSB16(addr))
+		{
+		/* Joypad */
+		case 0x00:
+			/* Only bits 5 and 4 are R/W.
+			 * The lower bits are overwritten later, and the two most
+			 * significant bits are unused. */
+			gb->hram_io[IO_JOYP] = val;
+
+			/* Direction keys selected */
+			if((gb->hram_io[IO_JOYP] & 0x10) == 0)
+				gb->hram_io[IO_JOYP] |= (gb->direct.joypad >> 4);
+			/* Button keys selected */
+			else
+				gb->hram_io[IO_JOYP] |= (gb->direct.joypad & 0x0F);
+
+			return;
+
+		/* Serial */
+		case 0x01:
+			gb->hram_io[IO_SB] = val;
+			return;
+
+		case 0x02:
+		{
+			uint_fast16_t serial_count = __gb_event_count(gb,
+				GB_EVENT_SERIAL, SERIAL_CYCLES,
+				gb->counter.serial_count);
+
+			gb->hram_io[IO_SC] = val;
+			__gb_schedule_serial(gb, serial_count);
+			return;
+		}
+
+		/* Timer Registers */
+		case 0x04:
+			gb->counter.div_offset =
+				-(uint8_t)(gb->counter.cycles / DIV_CYCLES);
+			return;
+
+		case 0x05:
+		{
+			/* The overflow moves with the new value. */
+			uint_fast16_t tima_count = __gb_tima_count(gb);
+
+			gb->hram_io[IO_TIMA] = val;
+			__gb_schedule_tima(gb, tima_count);
+			return;
+		}
+
+		case 0x06:
+			gb->hram_io[IO_TMA] = val;
+			return;
+
+		case 0x07:
+		{
+			/* Keep the cycles counted so far using the old rate. */
+			uint_fast16_t tima_count = __gb_tima_count(gb);
+
+			gb->hram_io[IO_TAC] = val;
+			__gb_schedule_tima(gb, tima_count);
+			return;
+		}
+
+		/* Interrupt Flag Register */
+		case 0x0F:
+			gb->hram_io[IO_IF] = (val | 0xE0);
+			__gb_update_intr_pending(gb);
+			return;
+
+		/* LCD Registers */
+		case 0x40:
+		{
+			uint8_t lcd_enabled;
+
+			/* Check if LCD is already enabled. */
+			lcd_enabled = (gb->hram_io[IO_LCDC] & LCDC_ENABLE);
+
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+			if((gb->hram_io[IO_LCDC] ^ val) & LCDC_OBJ_SIZE)
+				gb->display.line_sprites_valid = false;
+#endif
+			gb->hram_io[IO_LCDC] = val;
+
+			/* Check if LCD is going to be switched on. */
+			if (!lcd_enabled && (val & LCDC_ENABLE))
+			{
+				gb->lcd_blank = true;
+				/* Start LCD timer. */
+				gb->counter.lcd_line_start = gb->counter.cycles;
+				__gb_schedule_lcd(gb);
+			}
+			/* Check if LCD is being switched off. */
+			else if (lcd_enabled && !(val & LCDC_ENABLE))
+			{
+				/* Peanut-GB will happily turn off LCD outside
+				 * of VBLANK even though this damages real
+				 * hardware. */
+
+				/* Set LCD to Mode 0. */
+				gb->hram_io[IO_STAT] =
+					(gb->hram_io[IO_STAT] & ~STAT_MODE) |
+					IO_STAT_MODE_HBLANK;
+				/* LY fixed to 0 when LCD turned off. */
+				gb->hram_io[IO_LY] = 0;
+				/* Stop LCD timer. */
+				__gb_cancel_event(gb, GB_EVENT_LCD);
+			}
+			return;
+		}
+
+		case 0x41:
+			gb->hram_io[IO_STAT] = (val & STAT_USER_BITS) | (gb->hram_io[IO_STAT] & STAT_MODE);
+			return;
+
+		case 0x42:
+			gb->hram_io[IO_SCY] = val;
+			return;
+
+		case 0x43:
+			gb->hram_io[IO_SCX] = val;
+			return;
+
+		/* LY (0xFF44) is read only. */
+		case 0x45:
+			gb->hram_io[IO_LYC] = val;
+			return;
+
+		/* DMA Register */
+		case 0x46:
+			gb->hram_io[IO_DMA] = val;
+#if PEANUT_GB_ACCURATE_OAM_DMA
+			/* A new transfer replaces the one in progress. */
+			__gb_update_dma(gb);
+			gb->counter.scheduled &= ~(1 << GB_EVENT_DMA);
+
+			__gb_dma_copy(gb, gb->dma.src, val);
+			gb->dma.copied = 0;
+			gb->counter.dma_start = gb->counter.cycles;
+			__gb_schedule_event(gb, GB_EVENT_DMA, gb->counter.cycles +
+				OAM_SIZE * DMA_BYTE_CYCLES);
+			__gb_update_memory_map(gb);
+#else
+			__gb_dma_copy(gb, gb->oam, val);
+# if PEANUT_GB_HIGH_LCD_ACCURACY
+			gb->display.line_sprites_valid = false;
+# endif
+#endif
+			return;
+
+		/* DMG Palette Registers */
+		case 0x47:
+			gb->hram_io[IO_BGP] = val;
+			gb->display.bg_palette[0] = (gb->hram_io[IO_BGP] & 0x03);
+			gb->display.bg_palette[1] = (gb->hram_io[IO_BGP] >> 2) & 0x03;
+			gb->display.bg_palette[2] = (gb->hram_io[IO_BGP] >> 4) & 0x03;
+			gb->display.bg_palette[3] = (gb->hram_io[IO_BGP] >> 6) & 0x03;
+			return;
+
+		case 0x48:
+			gb->hram_io[IO_OBP0] = val;
+			gb->display.sp_palette[0] = (gb->hram_io[IO_OBP0] & 0x03);
+			gb->display.sp_palette[1] = (gb->hram_io[IO_OBP0] >> 2) & 0x03;
+			gb->display.sp_palette[2] = (gb->hram_io[IO_OBP0] >> 4) & 0x03;
+			gb->display.sp_palette[3] = (gb->hram_io[IO_OBP0] >> 6) & 0x03;
+			return;
+
+		case 0x49:
+			gb->hram_io[IO_OBP1] = val;
+			gb->display.sp_palette[4] = (gb->hram_io[IO_OBP1] & 0x03);
+			gb->display.sp_palette[5] = (gb->hram_io[IO_OBP1] >> 2) & 0x03;
+			gb->display.sp_palette[6] = (gb->hram_io[IO_OBP1] >> 4) & 0x03;
+			gb->display.sp_palette[7] = (gb->hram_io[IO_OBP1] >> 6) & 0x03;
+			return;
+
+		/* Window Position Registers */
+		case 0x4A:
+			gb->hram_io[IO_WY] = val;
+			return;
+
+		case 0x4B:
+			gb->hram_io[IO_WX] = val;
+			return;
+
+		/* Turn off boot ROM */
+		case 0x50:
+			gb->hram_io[IO_BOOT] = 0x01;
+			return;
+
+		/* Interrupt Enable Register */
+		case 0xFF:
+			gb->hram_io[IO_IE] = val;
+			__gb_update_intr_pending(gb);
+			return;
+		}
+	}
+
+	/* Invalid writes are ignored. */
+	return;
+}
+
+/**
+ * Internal function used to write bytes.
+ */
+PGB_HOT void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
+{
+	uint8_t *page = gb->map.write[PEANUT_GB_GET_MSN16(addr)];
+
+	if(PGB_LIKELY(page != NULL))
+	{
+		page[addr & 0x0FFF] = val;
+		return;
+	}
+
+	__gb_write_slow(gb, addr, val);
+
+	/* Writes to the MBC registers or the boot ROM flag may change which
+	 * memory is mapped. */
+	if(addr < VRAM_ADDR || addr == (IO_ADDR | IO_BOOT))
+		__gb_update_memory_map(gb);
+}
+
+/* Offset of the register selected by the low three bits of a CB opcode.
+ * Entry 6 is (HL), which is read from memory instead. */
+static const uint8_t cb_reg[8] =
+{
+	offsetof(struct cpu_registers_s, bc.bytes.b),
+	offsetof(struct cpu_registers_s, bc.bytes.c),
+	offsetof(struct cpu_registers_s, de.bytes.d),
+	offsetof(struct cpu_registers_s, de.bytes.e),
+	offsetof(struct cpu_registers_s, hl.bytes.h),
+	offsetof(struct cpu_registers_s, hl.bytes.l),
+	0,
+	offsetof(struct cpu_registers_s, a)
+};
+
+/**
+ * Executes a CB prefixed opcode and returns the number of clock cycles taken.
+ * Bits 6-7 select the operation group, bits 3-5 the shift operation or bit
+ * index, and bits 0-2 the register.
+ */
+PGB_HOT uint8_t __gb_execute_cb(struct gb_s *gb, uint8_t cbop)
+{
+	const uint8_t r = cbop & 0x07;
+	const uint8_t b = (cbop >> 3) & 0x07;
+	uint8_t *reg = (uint8_t *)&gb->cpu_reg + cb_reg[r];
+	uint8_t val;
+
+	if(r == 6)
+		val = __gb_read(gb, gb->cpu_reg.hl.reg);
+	else
+		val = *reg;
+
+	switch(cbop >> 6)
+	{
+	case 0x0:
+	{
+		uint8_t carry;
+
+		switch(b)
+		{
+		case 0x0: /* RLC R */
+			carry = val >> 7;
+			val = (val << 1) | carry;
+			break;
+
+		case 0x1: /* RRC R */
+			carry = val & 0x01;
+			val = (val >> 1) | (carry << 7);
+			break;
+
+		case 0x2: /* RL R */
+			carry = val >> 7;
+			val = (val << 1) | PGB_FLAG_C();
+			break;
+
+		case 0x3: /* RR R */
+			carry = val & 0x01;
+			val = (val >> 1) | (PGB_FLAG_C() << 7);
+			break;
+
+		case 0x4: /* SLA R */
+			carry = val >> 7;
+			val = val << 1;
+			break;
+
+		case 0x5: /* SRA R */
+			carry = val & 0x01;
+			val = (val >> 1) | (val & 0x80);
+			break;
+
+		case 0x6: /* SWAP R */
+			carry = 0;
+			val = (val >> 4) | (val << 4);
+			break;
+
+		default: /* SRL R */
+			carry = val & 0x01;
+			val = val >> 1;
+			break;
+		}
+
+		PGB_SET_FLAGS_RESULT(val, 0, 0, carry << 8);
+		break;
+	}
+
+	case 0x1: /* BIT B, R */
+		PGB_SET_FLAG_Z(!((val >> b) & 0x1));
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H(1);
+
+		/* BIT does not write back, so (HL) takes one less access. */
+		return r == 6 ? 12 : 8;
+
+	case 0x2: /* RES B, R */
+		val &= ~(0x1 << b);
+		break;
+
+	default: /* SET B, R */
+		val |= (0x1 << b);
+		break;
+	}
+
+	if(r == 6)
+	{
+		__gb_write(gb, gb->cpu_reg.hl.reg, val);
+		return 16;
+	}
+
+	*reg = val;
+	return 8;
+}
+
+#if ENABLE_LCD
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+/**
+ * Finds the sprites drawn on each line. Up to ten sprites are drawn on each
+ * line, prioritised by X coordinate and then by location in OAM.
+ */
+PGB_HOT void __gb_find_line_sprites(struct gb_s *gb)
+{
+	const int_fast16_t height =
+		(gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE) ? 16 : 8;
+	uint8_t s;
+
+	memset(gb->display.line_sprite_count, 0,
+		sizeof(gb->display.line_sprite_count));
+
+	/* Sprites are inserted in OAM order, so each sprite goes after those
+	 * with the same X coordinate. */
+	for(s = 0; s < NUM_SPRITES; s++)
+	{
+		/* Line of the top of the sprite. */
+		const int_fast16_t top = (int_fast16_t)gb->oam[4 * s + 0] - 16;
+		/* Sprite X position. */
+		const uint8_t OX = gb->oam[4 * s + 1];
+		int_fast16_t ly;
+
+		for(ly = top < 0 ? 0 : top; ly < top + height && ly < LCD_HEIGHT;
+				ly++)
+		{
+			uint8_t *line = gb->display.line_sprites[ly];
+			uint_fast8_t n = gb->display.line_sprite_count[ly];
+
+			if(n == MAX_SPRITES_LINE)
+			{
+				/* Replace the lowest priority sprite if this
+				 * one has a higher priority. */
+				if(gb->oam[4 * line[n - 1] + 1] <= OX)
+					continue;
+
+				n--;
+			}
+			else
+				gb->display.line_sprite_count[ly] = n + 1;
+
+			for(; n > 0 && gb->oam[4 * line[n - 1] + 1] > OX; n--)
+				line[n] = line[n - 1];
+
+			line[n] = s;
+		}
+	}
+
+	gb->display.line_sprites_valid = true;
+}
+#endif
+
+#if PEANUT_GB_SWAR_RENDERER
+/* Position of pixel k of a tile row in a 64-bit integer, such that pixel k is
+ * byte k of the integer in memory. */
+# if PEANUT_GB_IS_LITTLE_ENDIAN
+#  define PGB_PIXEL_SHIFT(k) (8 * (k))
+# else
+#  define PGB_PIXEL_SHIFT(k) (8 * (7 - (k)))
+# endif
+
+/* Moves bit 7 - k of b to the lowest bit of pixel k. */
+# define PGB_SPREAD(b)							\
+	(((uint64_t)((b) >> 7 & 1) << PGB_PIXEL_SHIFT(0))		\
+	 | ((uint64_t)((b) >> 6 & 1) << PGB_PIXEL_SHIFT(1))		\
+	 | ((uint64_t)((b) >> 5 & 1) << PGB_PIXEL_SHIFT(2))		\
+	 | ((uint64_t)((b) >> 4 & 1) << PGB_PIXEL_SHIFT(3))		\
+	 | ((uint64_t)((b) >> 3 & 1) << PGB_PIXEL_SHIFT(4))		\
+	 | ((uint64_t)((b) >> 2 & 1) << PGB_PIXEL_SHIFT(5))		\
+	 | ((uint64_t)((b) >> 1 & 1) << PGB_PIXEL_SHIFT(6))		\
+	 | ((uint64_t)((b) >> 0 & 1) << PGB_PIXEL_SHIFT(7)))
+# define PGB_SPREAD_4(b)						\
+	PGB_SPREAD(b), PGB_SPREAD(b + 1), PGB_SPREAD(b + 2), PGB_SPREAD(b + 3)
+# define PGB_SPREAD_16(b)						\
+	PGB_SPREAD_4(b), PGB_SPREAD_4(b + 4),				\
+	PGB_SPREAD_4(b + 8), PGB_SPREAD_4(b + 12)
+# define PGB_SPREAD_64(b)						\
+	PGB_SPREAD_16(b), PGB_SPREAD_16(b + 16),			\
+	PGB_SPREAD_16(b + 32), PGB_SPREAD_16(b + 48)
+
+/* Copies x to every byte of a 64-bit integer. */
+# define PGB_BYTES(x) ((x) * (uint64_t)0x0101010101010101)
+
+/* Bit plane byte spread over the eight pixels of a tile row. */
+static const uint64_t tile_row_spread[0x100] = {
+	PGB_SPREAD_64(0x00), PGB_SPREAD_64(0x40),
+	PGB_SPREAD_64(0x80), PGB_SPREAD_64(0xC0)
+};
+
+/**
+ * Decodes the two bit planes of a tile row to the colour index of each of its
+ * eight pixels.
+ */
+static PGB_ALWAYS_INLINE uint64_t __gb_decode_row(uint8_t t1, uint8_t t2)
+{
+	return tile_row_spread[t1] | (tile_row_spread[t2] << 1);
+}
+
+/**
+ * Mirrors a decoded tile row horizontally.
+ */
+static PGB_ALWAYS_INLINE uint64_t __gb_flip_row(uint64_t row)
+{
+# if __has_builtin(__builtin_bswap64)
+	return __builtin_bswap64(row);
+# else
+	row = ((row & 0x00FF00FF00FF00FF) << 8)
+		| ((row >> 8) & 0x00FF00FF00FF00FF);
+	row = ((row & 0x0000FFFF0000FFFF) << 16)
+		| ((row >> 16) & 0x0000FFFF0000FFFF);
+	return (row << 32) | (row >> 32);
+# endif
+}
+
+/**
+ * Looks up the colours of the pixels of a decoded tile row in a palette of
+ * four colours.
+ */
+static PGB_ALWAYS_INLINE uint64_t __gb_colour_row(uint64_t row,
+		const uint8_t *palette)
+{
+	/* Set every bit of the pixels with each colour index bit set. */
+	const uint64_t lo = (row & PGB_BYTES(1)) * 0xFF;
+	const uint64_t hi = ((row >> 1) & PGB_BYTES(1)) * 0xFF;
+	const uint64_t c01 = PGB_BYTES(palette[0])
+		^ (PGB_BYTES(palette[0] ^ palette[1]) & lo);
+	const uint64_t c23 = PGB_BYTES(palette[2])
+		^ (PGB_BYTES(palette[2] ^ palette[3]) & lo);
+
+	return c01 ^ ((c01 ^ c23) & hi);
+}
+
+/**
+ * Returns pixels x to x + 7 of a line. Pixels beyond either side of the line
+ * are returned as 0.
+ */
+static PGB_ALWAYS_INLINE uint64_t __gb_load_pixels(const uint8_t *pixels,
+		int_fast16_t x)
+{
+	uint8_t p[8] = {0};
+	uint64_t row;
+	int_fast16_t i;
+
+	if(x >= 0 && x <= LCD_WIDTH - 8)
+	{
+		memcpy(&row, &pixels[x], 8);
+		return row;
+	}
+
+	for(i = 0; i < 8; i++)
+	{
+		if(x + i >= 0 && x + i < LCD_WIDTH)
+			p[i] = pixels[x + i];
+	}
+
+	memcpy(&row, p, 8);
+	return row;
+}
+
+/**
+ * Stores row to pixels x to x + 7 of a line, except for pixels beyond either
+ * side of the line.
+ */
+static PGB_ALWAYS_INLINE void __gb_store_pixels(uint8_t *pixels,
+		int_fast16_t x, uint64_t row)
+{
+	uint8_t p[8];
+	int_fast16_t i;
+
+	if(x >= 0 && x <= LCD_WIDTH - 8)
+	{
+		memcpy(&pixels[x], &row, 8);
+		return;
+	}
+
+	memcpy(p, &row, 8);
+
+	for(i = 0; i < 8; i++)
+	{
+		if(x + i >= 0 && x + i < LCD_WIDTH)
+			pixels[x + i] = p[i];
+	}
+}
+#endif
+
+#if PEANUT_GB_TILE_CACHE
+/**
+ * Returns the colour indexes of row py of the given tile, decoding the tile
+ * again first if it was written to since it was last decoded.
+ */
+PGB_HOT const uint8_t *__gb_tile_row(struct gb_s *gb, uint_fast16_t tile,
+		uint_fast8_t py)
+{
+	const uint32_t bit = (uint32_t)1 << (tile % 32);
+
+	if(gb->tile_cache.dirty[tile / 32] & bit)
+	{
+		const uint8_t *t = &gb->vram[VRAM_TILES_1 + tile * 0x10];
+		uint_fast8_t y;
+
+		for(y = 0; y < 8; y++, t += 2)
+		{
+#if PEANUT_GB_SWAR_RENDERER
+			const uint64_t row = __gb_decode_row(t[0], t[1]);
+			memcpy(gb->tile_cache.pixels[tile][y], &row, 8);
+#else
+			uint_fast8_t x;
+
+			for(x = 0; x < 8; x++)
+			{
+				gb->tile_cache.pixels[tile][y][x] =
+					((t[0] >> (7 - x)) & 0x1)
+					| (((t[1] >> (7 - x)) & 0x1) << 1);
+			}
+#endif
+		}
+
+		gb->tile_cache.dirty[tile / 32] &= ~bit;
+	}
+
+	return gb->tile_cache.pixels[tile][py];
+}
+#endif
+
+#if PEANUT_GB_SWAR_RENDERER
+/**
+ * Draws pixels disp_x to LCD_WIDTH - 1 of the background or window from the
+ * map row at the VRAM address map, starting at pixel x of the map row.
+ */
+PGB_HOT void __gb_draw_tiles(struct gb_s *gb, uint8_t *pixels,
+		uint_fast16_t map, uint_fast8_t x, uint_fast8_t py,
+		uint_fast8_t disp_x)
+{
+	uint8_t palette[4];
+	int_fast16_t pos = (int_fast16_t)disp_x - (x & 0x07);
+	uint_fast8_t i;
+
+	for(i = 0; i < 4; i++)
+	{
+		palette[i] = gb->display.bg_palette[i];
+#if PEANUT_GB_12_COLOUR
+		palette[i] |= LCD_PALETTE_BG;
+#endif
+	}
+
+	for(x >>= 3; pos < LCD_WIDTH; pos += 8, x++)
+	{
+		uint_fast16_t tile = gb->vram[map + (x & 0x1F)];
+		uint64_t row;
+
+		/* Select addressing mode. */
+		if(!(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT))
+			tile = VRAM_TILES_2 / 0x10 + ((tile + 0x80) % 0x100);
+
+#if PEANUT_GB_TILE_CACHE
+		memcpy(&row, __gb_tile_row(gb, tile, py), 8);
+#else
+		tile = VRAM_TILES_1 + tile * 0x10 + 2 * py;
+		row = __gb_decode_row(gb->vram[tile], gb->vram[tile + 1]);
+#endif
+		__gb_store_pixels(pixels, pos, __gb_colour_row(row, palette));
+	}
+}
+#elif PEANUT_GB_TILE_CACHE
+/**
+ * Draws pixels disp_x to LCD_WIDTH - 1 of the background or window from the
+ * map row at the VRAM address map, starting at pixel x of the map row.
+ */
+PGB_HOT void __gb_draw_tiles(struct gb_s *gb, uint8_t *pixels,
+		uint_fast16_t map, uint_fast8_t x, uint_fast8_t py,
+		uint_fast8_t disp_x)
+{
+	uint8_t palette[4];
+	uint_fast8_t i;
+
+	for(i = 0; i < 4; i++)
+	{
+		palette[i] = gb->display.bg_palette[i];
+#if PEANUT_GB_12_COLOUR
+		palette[i] |= LCD_PALETTE_BG;
+#endif
+	}
+
+	while(disp_x < LCD_WIDTH)
+	{
+		uint_fast16_t tile = gb->vram[map + ((x >> 3) & 0x1F)];
+		const uint8_t *row;
+		uint_fast8_t px = x & 0x07;
+		uint_fast8_t count = MIN(8 - px, LCD_WIDTH - disp_x);
+
+		/* Select addressing mode. */
+		if(!(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT))
+			tile = VRAM_TILES_2 / 0x10 + ((tile + 0x80) % 0x100);
+
+		row = __gb_tile_row(gb, tile, py) + px;
+
+		for(i = 0; i < count; i++)
+			pixels[disp_x + i] = palette[row[i]];
+
+		disp_x += count;
+		x += count;
+	}
+}
+#endif
+
+PGB_HOT void __gb_draw_line(struct gb_s *gb)
+{
+	uint8_t line[LCD_WIDTH];
+	uint8_t *pixels = line;
+
+	/* If LCD not initialised by front-end, don't render anything. */
+	if(gb->display.lcd_draw_line == NULL && gb->display.framebuffer == NULL)
+		return;
+
+	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
+		return;
+
+	/* If interlaced mode is activated, check if we need to draw the current
+	 * line. */
+	if(gb->direct.interlace)
+	{
+		if((!gb->display.interlace_count
+				&& (gb->hram_io[IO_LY] & 1) == 0)
+				|| (gb->display.interlace_count
+				    && (gb->hram_io[IO_LY] & 1) == 1))
+		{
+			/* Compensate for missing window draw if required. */
+			if(gb->hram_io[IO_LCDC] & LCDC_WINDOW_ENABLE
+					&& gb->hram_io[IO_LY] >= gb->display.WY
+					&& gb->hram_io[IO_WX] <= 166)
+				gb->display.window_clear++;
+
+			return;
+		}
+	}
+
+	if(gb->display.framebuffer != NULL)
+	{
+		pixels = gb->display.framebuffer
+			+ gb->hram_io[IO_LY] * gb->display.framebuffer_stride;
+	}
+
+	/* If background is enabled, draw it. */
+	if(gb->hram_io[IO_LCDC] & LCDC_BG_ENABLE)
+	{
+#if PEANUT_GB_SWAR_RENDERER || PEANUT_GB_TILE_CACHE
+		const uint8_t bg_y = gb->hram_io[IO_LY] + gb->hram_io[IO_SCY];
+
+		__gb_draw_tiles(gb, pixels,
+				((gb->hram_io[IO_LCDC] & LCDC_BG_MAP) ?
+				 VRAM_BMAP_2 : VRAM_BMAP_1)
+				+ (bg_y >> 3) * 0x20,
+				gb->hram_io[IO_SCX], bg_y & 0x07, 0);
+#else
+		uint8_t bg_y, disp_x, bg_x, idx, py, px, t1, t2;
+		uint16_t bg_map, tile;
+
+		/* Calculate current background line to draw. Constant because
+		 * this function draws only this one line each time it is
+		 * called. */
+		bg_y = gb->hram_io[IO_LY] + gb->hram_io[IO_SCY];
+
+		/* Get selected background map address for first tile
+		 * corresponding to current line.
+		 * 0x20 (32) is the width of a background tile, and the bit
+		 * shift is to calculate the address. */
+		bg_map =
+			((gb->hram_io[IO_LCDC] & LCDC_BG_MAP) ?
+			 VRAM_BMAP_2 : VRAM_BMAP_1)
+			+ (bg_y >> 3) * 0x20;
+
+		/* The displays (what the player sees) X coordinate, drawn right
+		 * to left. */
+		disp_x = LCD_WIDTH - 1;
+
+		/* The X coordinate to begin drawing the background at. */
+		bg_x = disp_x + gb->hram_io[IO_SCX];
+
+		/* Get tile index for current background tile. */
+		idx = gb->vram[bg_map + (bg_x >> 3)];
+		/* Y coordinate of tile pixel to draw. */
+		py = (bg_y & 0x07);
+		/* X coordinate of tile pixel to draw. */
+		px = 7 - (bg_x & 0x07);
+
+		/* Select addressing mode. */
+		if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
+			tile = VRAM_TILES_1 + idx * 0x10;
+		else
+			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+		tile += 2 * py;
+
+		/* fetch first tile */
+		t1 = gb->vram[tile] >> px;
+		t2 = gb->vram[tile + 1] >> px;
+
+		for(; disp_x != 0xFF; disp_x--)
+		{
+			uint8_t c;
+
+			if(px == 8)
+			{
+				/* fetch next tile */
+				px = 0;
+				bg_x = disp_x + gb->hram_io[IO_SCX];
+				idx = gb->vram[bg_map + (bg_x >> 3)];
+
+				if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
+					tile = VRAM_TILES_1 + idx * 0x10;
+				else
+					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+				tile += 2 * py;
+				t1 = gb->vram[tile];
+				t2 = gb->vram[tile + 1];
+			}
+
+			/* copy background */
+			c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+			pixels[disp_x] = gb->display.bg_palette[c];
+#if PEANUT_GB_12_COLOUR
+			pixels[disp_x] |= LCD_PALETTE_BG;
+#endif
+			t1 = t1 >> 1;
+			t2 = t2 >> 1;
+			px++;
+		}
+#endif
+	}
+	else
+		memset(pixels, 0, LCD_WIDTH);
+
+	/* draw window */
+	if(gb->hram_io[IO_LCDC] & LCDC_WINDOW_ENABLE
+			&& gb->hram_io[IO_LY] >= gb->display.WY
+			&& gb->hram_io[IO_WX] <= 166)
+	{
+#if PEANUT_GB_SWAR_RENDERER || PEANUT_GB_TILE_CACHE
+		const uint8_t start = gb->hram_io[IO_WX] < 7 ?
+				0 : gb->hram_io[IO_WX] - 7;
+
+		__gb_draw_tiles(gb, pixels,
+				((gb->hram_io[IO_LCDC] & LCDC_WINDOW_MAP) ?
+				 VRAM_BMAP_2 : VRAM_BMAP_1)
+				+ (gb->display.window_clear >> 3) * 0x20,
+				(uint8_t)(start - gb->hram_io[IO_WX] + 7),
+				gb->display.window_clear & 0x07, start);
+#else
+		uint16_t win_line, tile;
+		uint8_t disp_x, win_x, py, px, idx, t1, t2, end;
+
+		/* Calculate Window Map Address. */
+		win_line = (gb->hram_io[IO_LCDC] & LCDC_WINDOW_MAP) ?
+				    VRAM_BMAP_2 : VRAM_BMAP_1;
+		win_line += (gb->display.window_clear >> 3) * 0x20;
+
+		disp_x = LCD_WIDTH - 1;
+		win_x = disp_x - gb->hram_io[IO_WX] + 7;
+
+		// look up tile
+		py = gb->display.window_clear & 0x07;
+		px = 7 - (win_x & 0x07);
+		idx = gb->vram[win_line + (win_x >> 3)];
+
+		if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
+			tile = VRAM_TILES_1 + idx * 0x10;
+		else
+			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+		tile += 2 * py;
+
+		// fetch first tile
+		t1 = gb->vram[tile] >> px;
+		t2 = gb->vram[tile + 1] >> px;
+
+		// loop & copy window
+		end = (gb->hram_io[IO_WX] < 7 ? 0 : gb->hram_io[IO_WX] - 7) - 1;
+
+		for(; disp_x != end; disp_x--)
+		{
+			uint8_t c;
+
+			if(px == 8)
+			{
+				// fetch next tile
+				px = 0;
+				win_x = disp_x - gb->hram_io[IO_WX] + 7;
+				idx = gb->vram[win_line + (win_x >> 3)];
+
+				if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
+					tile = VRAM_TILES_1 + idx * 0x10;
+				else
+					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+				tile += 2 * py;
+				t1 = gb->vram[tile];
+				t2 = gb->vram[tile + 1];
+			}
+
+			// copy window
+			c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+			pixels[disp_x] = gb->display.bg_palette[c];
+#if PEANUT_GB_12_COLOUR
+			pixels[disp_x] |= LCD_PALETTE_BG;
+#endif
+			t1 = t1 >> 1;
+			t2 = t2 >> 1;
+			px++;
+		}
+#endif
+
+		gb->display.window_clear++; // advance window line
+	}
+
+	// draw sprites
+	if(gb->hram_io[IO_LCDC] & LCDC_OBJ_ENABLE)
+	{
+#if PEANUT_GB_ACCURATE_OAM_DMA
+		__gb_update_dma(gb);
+#endif
+		uint8_t sprite_number;
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+		const uint8_t *line_sprites;
+		uint8_t number_of_sprites;
+
+		if(!gb->display.line_sprites_valid)
+			__gb_find_line_sprites(gb);
+
+		line_sprites = gb->display.line_sprites[gb->hram_io[IO_LY]];
+		number_of_sprites =
+			gb->display.line_sprite_count[gb->hram_io[IO_LY]];
+#endif
+
+		/* Render each sprite, from low priority to high priority. */
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+		/* Render the top ten prioritised sprites on this scanline. */
+		for(sprite_number = number_of_sprites - 1;
+				sprite_number != 0xFF;
+				sprite_number--)
+		{
+			uint8_t s = line_sprites[sprite_number];
+#else
+		for (sprite_number = NUM_SPRITES - 1;
+			sprite_number != 0xFF;
+			sprite_number--)
+		{
+			uint8_t s = sprite_number;
+#endif
+			uint8_t py, t1, t2;
+#if !PEANUT_GB_SWAR_RENDERER
+			uint8_t dir, start, end, shift, disp_x;
+#endif
+			/* Sprite Y position. */
+			uint8_t OY = gb->oam[4 * s + 0];
+			/* Sprite X position. */
+			uint8_t OX = gb->oam[4 * s + 1];
+			/* Sprite Tile/Pattern Number. */
+			uint8_t OT = gb->oam[4 * s + 2]
+				     & (gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 0xFE : 0xFF);
+			/* Additional attributes. */
+			uint8_t OF = gb->oam[4 * s + 3];
+
+#if !PEANUT_GB_HIGH_LCD_ACCURACY
+			/* If sprite isn't on this line, continue. */
+			if(gb->hram_io[IO_LY] +
+					(gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 0 : 8) >= OY ||
+					gb->hram_io[IO_LY] + 16 < OY)
+				continue;
+#endif
+
+			/* Continue if sprite not visible. */
+			if(OX == 0 || OX >= 168)
+				continue;
+
+			// y flip
+			py = gb->hram_io[IO_LY] - OY + 16;
+
+			if(OF & OBJ_FLIP_Y)
+				py = (gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 15 : 7) - py;
+
+			// fetch the tile
+			t1 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py];
+			t2 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
+
+#if PEANUT_GB_SWAR_RENDERER
+			{
+				uint64_t row = __gb_decode_row(t1, t2);
+				uint64_t colours, mask, dst;
+
+				if(OF & OBJ_FLIP_X)
+					row = __gb_flip_row(row);
+
+				colours = __gb_colour_row(row,
+						&gb->display.sp_palette[
+						(OF & OBJ_PALETTE) ? 4 : 0]);
+#if PEANUT_GB_12_COLOUR
+				/* Set pixel palette (OBJ0 or OBJ1). */
+				colours |= PGB_BYTES(OF & OBJ_PALETTE);
+#endif
+
+				/* Colour index 0 is transparent. */
+				mask = ((row | (row >> 1)) & PGB_BYTES(1)) * 0xFF;
+				dst = __gb_load_pixels(pixels, OX - 8);
+
+				/* Only draw over background colour 0 if the
+				 * sprite is behind the background. */
+				if(OF & OBJ_PRIORITY)
+				{
+					const uint64_t diff = (dst & PGB_BYTES(0x3))
+						^ PGB_BYTES(gb->display.bg_palette[0]);
+					const uint64_t nonzero =
+						((diff + PGB_BYTES(0x7F))
+						 & PGB_BYTES(0x80)) >> 7;
+
+					mask &= (nonzero ^ PGB_BYTES(1)) * 0xFF;
+				}
+
+				dst ^= (dst ^ colours) & mask;
+				__gb_store_pixels(pixels, OX - 8, dst);
+			}
+#else
+			// handle x flip
+			if(OF & OBJ_FLIP_X)
+			{
+				dir = 1;
+				start = (OX < 8 ? 0 : OX - 8);
+				end = MIN(OX, LCD_WIDTH);
+				shift = 8 - OX + start;
+			}
+			else
+			{
+				dir = (uint8_t)-1;
+				start = MIN(OX, LCD_WIDTH) - 1;
+				end = (OX < 8 ? 0 : OX - 8) - 1;
+				shift = OX - (start + 1);
+			}
+
+			// copy tile
+			t1 >>= shift;
+			t2 >>= shift;
+
+			/* TODO: Put for loop within the to if statements
+			 * because the BG priority bit will be the same for
+			 * all the pixels in the tile. */
+			for(disp_x = start; disp_x != end; disp_x += dir)
+			{
+				uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+				// check transparency / sprite overlap / background overlap
+
+				if(c && !(OF & OBJ_PRIORITY && !((pixels[disp_x] & 0x3) == gb->display.bg_palette[0])))
+				{
+					/* Set pixel colour. */
+					pixels[disp_x] = (OF & OBJ_PALETTE)
+						? gb->display.sp_palette[c + 4]
+						: gb->display.sp_palette[c];
+#if PEANUT_GB_12_COLOUR
+					/* Set pixel palette (OBJ0 or OBJ1). */
+					pixels[disp_x] |= (OF & OBJ_PALETTE);
+#endif
+				}
+
+				t1 = t1 >> 1;
+				t2 = t2 >> 1;
+			}
+#endif
+		}
+	}
+
+	if(gb->display.framebuffer == NULL)
+		gb->display.lcd_draw_line(gb, pixels, gb->hram_io[IO_LY]);
+}
+
+#if PEANUT_GB_DEFERRED_RENDER
+/**
+ * Marks the current line as waiting to be drawn.
+ */
+PGB_HOT void __gb_defer_line(struct gb_s *gb)
+{
+	/* Lines that __gb_draw_line() would not draw are not logged. */
+	if(gb->display.lcd_draw_line == NULL && gb->display.framebuffer == NULL)
+		return;
+
+	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
+		return;
+
+	if(gb->deferred.lines++ == 0)
+	{
+		gb->deferred.first_line = gb->hram_io[IO_LY];
+		__gb_update_memory_map(gb);
+	}
+}
+
+/**
+ * Draws the lines waiting to be drawn. The logged writes are undone, and then
+ * replayed between the lines, so that each line is drawn as it was when
+ * reached.
+ */
+PGB_HOT void __gb_draw_deferred_lines(struct gb_s *gb)
+{
+	const uint_fast16_t count = gb->deferred.count;
+	const uint_fast8_t lines = gb->deferred.lines;
+	const uint8_t ly = gb->hram_io[IO_LY];
+	uint_fast16_t i;
+	uint_fast8_t line;
+
+	if(lines == 0)
+		return;
+
+	/* Stop logging, so that the writes below are not logged again. */
+	gb->deferred.lines = 0;
+	gb->deferred.count = 0;
+
+	for(i = count; i > 0; i--)
+	{
+		__gb_write_slow(gb, gb->deferred.log[i - 1].addr,
+				gb->deferred.log[i - 1].old);
+	}
+
+	for(line = 0; line < lines; line++)
+	{
+		for(; i < count && gb->deferred.log[i].line <= line; i++)
+		{
+			__gb_write_slow(gb, gb->deferred.log[i].addr,
+					gb->deferred.log[i].val);
+		}
+
+		gb->hram_io[IO_LY] = gb->deferred.first_line + line;
+		__gb_draw_line(gb);
+	}
+
+	for(; i < count; i++)
+	{
+		__gb_write_slow(gb, gb->deferred.log[i].addr,
+				gb->deferred.log[i].val);
+	}
+
+	gb->hram_io[IO_LY] = ly;
+	__gb_update_memory_map(gb);
+}
+#endif
+#endif
+
+/**
+ * Internal function used to advance the LCD to its next mode.
+ */
+PGB_HOT void __gb_lcd_event(struct gb_s *gb)
+{
+	uint32_t lcd_count = gb->counter.cycles - gb->counter.lcd_line_start;
+
+	/* New Scanline */
+	if(lcd_count >= LCD_LINE_CYCLES)
+	{
+		gb->counter.lcd_line_start += LCD_LINE_CYCLES;
+
+		/* Next line */
+		gb->hram_io[IO_LY] = (gb->hram_io[IO_LY] + 1) % LCD_VERT_LINES;
+
+		/* LYC Update */
+		if(gb->hram_io[IO_LY] == gb->hram_io[IO_LYC])
+		{
+			gb->hram_io[IO_STAT] |= STAT_LYC_COINC;
 
-		/* Interrupt Flag Register */
-		case 0x0F:
-			gb->hram_io[IO_IF] = (val | 0xE0);
-			return;
+			if(gb->hram_io[IO_STAT] & STAT_LYC_INTR)
+				gb->hram_io[IO_IF] |= LCDC_INTR;
+		}
+		else
+			gb->hram_io[IO_STAT] &= 0xFB;
 
-		/* LCD Registers */
-		case 0x40:
+		/* VBLANK Start */
+		if(gb->hram_io[IO_LY] == LCD_HEIGHT)
 		{
-			uint8_t lcd_enabled;
+			gb->hram_io[IO_STAT] =
+				(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_VBLANK;
+			gb->gb_frame = true;
+			gb->hram_io[IO_IF] |= VBLANK_INTR;
+			gb->lcd_blank = false;
 
-			/* Check if LCD is already enabled. */
-			lcd_enabled = (gb->hram_io[IO_LCDC] & LCDC_ENABLE);
+			if(gb->hram_io[IO_STAT] & STAT_MODE_1_INTR)
+				gb->hram_io[IO_IF] |= LCDC_INTR;
 
-			gb->hram_io[IO_LCDC] = val;
+#if ENABLE_LCD
+# if PEANUT_GB_DEFERRED_RENDER
+			__gb_draw_deferred_lines(gb);
+# endif
 
-			/* Check if LCD is going to be switched on. */
-			if (!lcd_enabled && (val & LCDC_ENABLE))
+			/* If frame skip is activated, check if we need to draw
+			 * the frame or skip it. */
+			if(gb->direct.frame_skip)
 			{
-				gb->lcd_blank = true;
+				gb->display.frame_skip_count =
+					!gb->display.frame_skip_count;
 			}
-			/* Check if LCD is being switched off. */
-			else if (lcd_enabled && !(val & LCDC_ENABLE))
-			{
-				/* Peanut-GB will happily turn off LCD outside
-				 * of VBLANK even though this damages real
-				 * hardware. */
 
-				/* Set LCD to Mode 0. */
-				gb->hram_io[IO_STAT] =
-					(gb->hram_io[IO_STAT] & ~STAT_MODE) |
-					IO_STAT_MODE_HBLANK;
-				/* LY fixed to 0 when LCD turned off. */
-				gb->hram_io[IO_LY] = 0;
-				/* Reset LCD timer. */
-				gb->counter.lcd_count = 0;
+			/* If interlaced is activated, change which lines get
+			 * updated. Also, only update lines on frames that are
+			 * actually drawn when frame skip is enabled. */
+			if(gb->direct.interlace &&
+					(!gb->direct.frame_skip ||
+					 gb->display.frame_skip_count))
+			{
+				gb->display.interlace_count =
+					!gb->display.interlace_count;
 			}
-			return;
+#endif
 		}
+		/* Normal Line */
+		else if(gb->hram_io[IO_LY] < LCD_HEIGHT)
+		{
+			if(gb->hram_io[IO_LY] == 0)
+			{
+				/* Clear Screen */
+				gb->display.WY = gb->hram_io[IO_WY];
+				gb->display.window_clear = 0;
+			}
 
-		case 0x41:
-			gb->hram_io[IO_STAT] = (val & STAT_USER_BITS) | (gb->hram_io[IO_STAT] & STAT_MODE);
-			return;
+			gb->hram_io[IO_STAT] =
+				(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_HBLANK;
 
-		case 0x42:
-			gb->hram_io[IO_SCY] = val;
-			return;
+			if(gb->hram_io[IO_STAT] & STAT_MODE_0_INTR)
+				gb->hram_io[IO_IF] |= LCDC_INTR;
+		}
+	}
+	/* OAM access */
+	else if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_HBLANK &&
+			lcd_count >= LCD_MODE_2_CYCLES)
+	{
+		gb->hram_io[IO_STAT] =
+			(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_SEARCH_OAM;
 
-		case 0x43:
-			gb->hram_io[IO_SCX] = val;
-			return;
+		if(gb->hram_io[IO_STAT] & STAT_MODE_2_INTR)
+			gb->hram_io[IO_IF] |= LCDC_INTR;
+	}
+	/* Update LCD */
+	else if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_SEARCH_OAM &&
+			lcd_count >= LCD_MODE_3_CYCLES)
+	{
+		gb->hram_io[IO_STAT] =
+			(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_SEARCH_TRANSFER;
+#if ENABLE_LCD
+		if(!gb->lcd_blank)
+		{
+# if PEANUT_GB_DEFERRED_RENDER
+			__gb_defer_line(gb);
+# else
+			__gb_draw_line(gb);
+# endif
+		}
+#endif
+	}
 
-		/* LY (0xFF44) is read only. */
-		case 0x45:
-			gb->hram_io[IO_LYC] = val;
-			return;
+	__gb_schedule_lcd(gb);
+}
 
-		/* DMA Register */
-		case 0x46:
-		{
-			uint16_t dma_addr;
-			uint16_t i;
+/**
+ * Internal function used to complete a serial transfer.
+ */
+PGB_COLD void __gb_serial_event(struct gb_s *gb)
+{
+	/* If RX can be done, do it. */
+	/* If RX failed, do not change SB if using external
+	 * clock, or set to 0xFF if using internal clock. */
+	uint8_t rx;
+
+	if(gb->gb_serial_rx != NULL &&
+		(gb->gb_serial_rx(gb, &rx) ==
+			GB_SERIAL_RX_SUCCESS))
+	{
+		gb->hram_io[IO_SB] = rx;
 
-			dma_addr = (uint_fast16_t)val << 8;
-			gb->hram_io[IO_DMA] = val;
+		/* Inform game of serial TX/RX completion. */
+		gb->hram_io[IO_SC] &= 0x01;
+		gb->hram_io[IO_IF] |= SERIAL_INTR;
+	}
+	else if(gb->hram_io[IO_SC] & SERIAL_SC_CLOCK_SRC)
+	{
+		/* If using internal clock, and console is not
+		 * attached to any external peripheral, shifted
+		 * bits are replaced with logic 1. */
+		gb->hram_io[IO_SB] = 0xFF;
+
+		/* Inform game of serial TX/RX completion. */
+		gb->hram_io[IO_SC] &= 0x01;
+		gb->hram_io[IO_IF] |= SERIAL_INTR;
+	}
+	else
+	{
+		/* If using external clock, and console is not
+		 * attached to any external peripheral, bits are
+		 * not shifted, so SB is not modified. */
+	}
 
-			for(i = 0; i < OAM_SIZE; i++)
-			{
-				gb->oam[i] = __gb_read(gb, dma_addr + i);
-			}
+	/* A transfer that is still pending is started again. */
+	__gb_schedule_serial(gb, 0);
+}
 
-			return;
-		}
+/**
+ * Internal function used to handle all events that are due.
+ */
+PGB_HOT void __gb_handle_events(struct gb_s *gb)
+{
+#define PGB_EVENT_DUE(e)						\
+	((gb->counter.scheduled & (1 << (e))) &&			\
+	 (int32_t)(gb->counter.cycles - gb->counter.event[e]) >= 0)
 
-		/* DMG Palette Registers */
-		case 0x47:
-			gb->hram_io[IO_BGP] = val;
-			gb->display.bg_palette[0] = (gb->hram_io[IO_BGP] & 0x03);
-			gb->display.bg_palette[1] = (gb->hram_io[IO_BGP] >> 2) & 0x03;
-			gb->display.bg_palette[2] = (gb->hram_io[IO_BGP] >> 4) & 0x03;
-			gb->display.bg_palette[3] = (gb->hram_io[IO_BGP] >> 6) & 0x03;
-			return;
+	/* Update the RTC before the elapsed cycles overflow. */
+	if(PGB_UNLIKELY(PGB_EVENT_DUE(GB_EVENT_RTC)))
+	{
+		__gb_update_rtc(gb);
+		gb->counter.event[GB_EVENT_RTC] = gb->counter.rtc_start +
+			RTC_UPDATE_SECONDS * RTC_CYCLES;
+	}
 
-		case 0x48:
-			gb->hram_io[IO_OBP0] = val;
-			gb->display.sp_palette[0] = (gb->hram_io[IO_OBP0] & 0x03);
-			gb->display.sp_palette[1] = (gb->hram_io[IO_OBP0] >> 2) & 0x03;
-			gb->display.sp_palette[2] = (gb->hram_io[IO_OBP0] >> 4) & 0x03;
-			gb->display.sp_palette[3] = (gb->hram_io[IO_OBP0] >> 6) & 0x03;
-			return;
+	/* Check serial transmission. */
+	if(PGB_EVENT_DUE(GB_EVENT_SERIAL))
+		__gb_serial_event(gb);
 
-		case 0x49:
-			gb->hram_io[IO_OBP1] = val;
-			gb->display.sp_palette[4] = (gb->hram_io[IO_OBP1] & 0x03);
-			gb->display.sp_palette[5] = (gb->hram_io[IO_OBP1] >> 2) & 0x03;
-			gb->display.sp_palette[6] = (gb->hram_io[IO_OBP1] >> 4) & 0x03;
-			gb->display.sp_palette[7] = (gb->hram_io[IO_OBP1] >> 6) & 0x03;
-			return;
+	/* TIMA overflow */
+	while(PGB_EVENT_DUE(GB_EVENT_TIMA))
+	{
+		gb->counter.tima_start = gb->counter.event[GB_EVENT_TIMA];
+		gb->counter.event[GB_EVENT_TIMA] +=
+			(uint32_t)(0x100 - gb->hram_io[IO_TMA]) *
+			TAC_CYCLES[gb->hram_io[IO_TAC] & IO_TAC_RATE_MASK];
+
+		gb->hram_io[IO_IF] |= TIMER_INTR;
+		/* On overflow, set TMA to TIMA. */
+		gb->hram_io[IO_TIMA] = gb->hram_io[IO_TMA];
+	}
 
-		/* Window Position Registers */
-		case 0x4A:
-			gb->hram_io[IO_WY] = val;
-			return;
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	if(PGB_EVENT_DUE(GB_EVENT_DMA))
+	{
+		__gb_update_dma(gb);
+		gb->counter.scheduled &= ~(1 << GB_EVENT_DMA);
+		__gb_update_memory_map(gb);
+	}
+#endif
 
-		case 0x4B:
-			gb->hram_io[IO_WX] = val;
-			return;
+	/* Only one LCD mode change is made at a time. */
+	if(PGB_EVENT_DUE(GB_EVENT_LCD))
+		__gb_lcd_event(gb);
 
-		/* Turn off boot ROM */
-		case 0x50:
-			gb->hram_io[IO_BOOT] = 0x01;
-			return;
+#undef PGB_EVENT_DUE
 
-		/* Interrupt Enable Register */
-		case 0xFF:
-			gb->hram_io[IO_IE] = val;
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+	/* Memory may have changed, so the loop must be checked again. */
+	gb->idle.valid = false;
+#endif
+
+	/* Interrupts are only requested by events. */
+	__gb_update_intr_pending(gb);
+	__gb_update_next_event(gb);
+}
+
+/* Index of the lowest set bit of each interrupt mask. The interrupt with the
+ * lowest bit has the highest priority, and its handler is at
+ * VBLANK_INTR_ADDR + 8 * index. */
+static const uint8_t intr_ctz[ANY_INTR + 1] =
+{
+	0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
+
+/* Number of clock cycles taken by each instruction. Conditional jumps,
+ * calls and returns add their extra cycles when taken. */
+static const uint8_t op_cycles[0x100] =
+{
+	/* *INDENT-OFF* */
+	/*0 1 2  3  4  5  6  7  8  9  A  B  C  D  E  F	*/
+	4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,	/* 0x00 */
+	4,12, 8, 8, 4, 4, 8, 4,12, 8, 8, 8, 4, 4, 8, 4,	/* 0x10 */
+	8,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x20 */
+	8,12, 8, 8,12,12,12, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x30 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x40 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x50 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x60 */
+	8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4, /* 0x70 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x80 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x90 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xA0 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xB0 */
+	8,12,12,16,12,16, 8,16, 8,16,12, 8,12,24, 8,16,	/* 0xC0 */
+	8,12,12, 0,12,16, 8,16, 8,16,12, 0,12, 0, 8,16,	/* 0xD0 */
+	12,12,8, 0, 0,16, 8,16,16, 4,16, 0, 0, 0, 8,16,	/* 0xE0 */
+	12,12,8, 4, 0,16, 8,16,12, 8,16, 4, 0, 0, 8,16	/* 0xF0 */
+	/* *INDENT-ON* */
+};
+
+/* Number of bytes in each instruction, including the opcode. */
+static const uint8_t op_length[0x100] =
+{
+	/* *INDENT-OFF* */
+	/*0 1 2 3 4 5 6 7 8 9 A B C D E F	*/
+	1,3,1,1,1,1,2,1,3,1,1,1,1,1,2,1,	/* 0x00 */
+	1,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,	/* 0x10 */
+	2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,	/* 0x20 */
+	2,3,1,1,1,1,2,1,2,1,1,1,1,1,2,1,	/* 0x30 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0x40 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0x50 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0x60 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0x70 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0x80 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0x90 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0xA0 */
+	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,	/* 0xB0 */
+	1,1,3,3,3,1,2,1,1,1,3,2,3,3,2,1,	/* 0xC0 */
+	1,1,3,1,3,1,2,1,1,1,3,1,3,1,2,1,	/* 0xD0 */
+	2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1,	/* 0xE0 */
+	2,1,1,1,1,1,2,1,2,1,3,1,1,1,2,1	/* 0xF0 */
+	/* *INDENT-ON* */
+};
+
+#if PEANUT_GB_USE_SUPERINSTRUCTIONS
+/* First and second opcode of each superinstruction. */
+static const uint8_t fused_op[GB_FUSED_MAX][2] =
+{
+	{ 0x00, 0x00 },
+	{ 0x2A, 0x12 },
+	{ 0x05, 0x20 },
+	{ 0x0D, 0x20 },
+	{ 0xB1, 0x20 },
+	{ 0xFE, 0x28 },
+	{ 0xFE, 0x20 }
+};
+
+/**
+ * Returns the superinstruction that runs the two opcodes, or GB_FUSED_NONE.
+ */
+uint8_t __gb_fuse(uint8_t first, uint8_t second)
+{
+	uint_fast8_t i;
+
+	for(i = GB_FUSED_NONE + 1; i < GB_FUSED_MAX; i++)
+	{
+		if(fused_op[i][0] == first && fused_op[i][1] == second)
+			return i;
+	}
+
+	return GB_FUSED_NONE;
+}
+#endif
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+/**
+ * Decodes a block of instructions starting at addr. Decoding stops after any
+ * instruction that may change the program counter or interrupt state, or
+ * before an instruction that would cross the end address.
+ */
+PGB_COLD void __gb_block_decode(struct gb_s *gb, struct gb_block_s *block,
+		int_fast32_t key, uint_fast16_t addr, uint_fast32_t end)
+{
+	block->key = key;
+	block->count = 0;
+
+	while(block->count < PEANUT_GB_BLOCK_MAX_INST)
+	{
+		struct gb_block_inst_s *inst = &block->inst[block->count];
+		const uint8_t opcode = __gb_read(gb, addr);
+
+		if(addr + op_length[opcode] > end)
+			break;
+
+		inst->opcode = opcode;
+		inst->length = op_length[opcode];
+		inst->imm = 0;
+#if PEANUT_GB_USE_JIT
+		inst->jit = NULL;
+#endif
+#if PEANUT_GB_USE_SUPERINSTRUCTIONS
+		inst->fused = GB_FUSED_NONE;
+
+		/* Only code in ROM is fused, since it cannot be modified
+		 * between the two instructions. */
+		if(block->count != 0 && !(key & PEANUT_GB_BLOCK_RAM_KEY))
+			inst[-1].fused = __gb_fuse(inst[-1].opcode, opcode);
+#endif
+
+		if(inst->length >= 2)
+			inst->imm = __gb_read(gb, addr + 1);
+
+		if(inst->length == 3)
+			inst->imm |= __gb_read(gb, addr + 2) << 8;
+
+		addr += inst->length;
+		block->count++;
+
+		switch(opcode)
+		{
+		/* STOP, HALT, DI, EI */
+		case 0x10: case 0x76: case 0xF3: case 0xFB:
+		/* JR */
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+		/* JP */
+		case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:
+		/* CALL */
+		case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+		/* RET */
+		case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:
+		/* RST */
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+		case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		/* Invalid opcodes */
+		case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4:
+		case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
 			return;
+
+		default:
+			break;
 		}
 	}
-
-	/* Invalid writes are ignored. */
-	return;
 }
 
-uint8_t __gb_execute_cb(struct gb_s *gb)
+#if PEANUT_GB_USE_JIT
+/* Maximum size of the code translated for one instruction. */
+#define PEANUT_GB_JIT_MAX_INST_SIZE 48
+
+/**
+ * Returns the value of the F register with the given flags set.
+ */
+uint8_t __gb_jit_flags(uint8_t z, uint8_t n, uint8_t h, uint8_t c)
 {
-	uint8_t inst_cycles;
-	uint8_t cbop = __gb_read(gb, gb->cpu_reg.pc.reg++);
-	uint8_t r = (cbop & 0x7);
-	uint8_t b = (cbop >> 3) & 0x7;
-	uint8_t d = (cbop >> 3) & 0x1;
-	uint8_t val;
-	uint8_t writeback = 1;
+	struct cpu_registers_s r;
+
+	r.f.reg = 0;
+	r.f.f_bits.z = z;
+	r.f.f_bits.n = n;
+	r.f.f_bits.h = h;
+	r.f.f_bits.c = c;
+	return r.f.reg;
+}
 
-	inst_cycles = 8;
-	/* Add an additional 8 cycles to these sets of instructions. */
-	switch(cbop & 0xC7)
+/**
+ * Returns the offset of an 8-bit register, in the order used by the operand
+ * bits of the opcode. (HL) is not a register and must not be given.
+ */
+uint8_t __gb_jit_reg8(uint8_t r)
+{
+	switch(r)
 	{
-	case 0x06:
-	case 0x86:
-    	case 0xC6:
-		inst_cycles += 8;
-    	break;
-    	case 0x46:
-		inst_cycles += 4;
-    	break;
+	case 0: return offsetof(struct cpu_registers_s, bc.bytes.b);
+	case 1: return offsetof(struct cpu_registers_s, bc.bytes.c);
+	case 2: return offsetof(struct cpu_registers_s, de.bytes.d);
+	case 3: return offsetof(struct cpu_registers_s, de.bytes.e);
+	case 4: return offsetof(struct cpu_registers_s, hl.bytes.h);
+	case 5: return offsetof(struct cpu_registers_s, hl.bytes.l);
+	default: return offsetof(struct cpu_registers_s, a);
 	}
+}
 
+/**
+ * Returns the offset of a 16-bit register, in the order used by the operand
+ * bits of the opcode.
+ */
+uint8_t __gb_jit_reg16(uint8_t r)
+{
 	switch(r)
 	{
-	case 0:
-		val = gb->cpu_reg.bc.bytes.b;
-		break;
+	case 0: return offsetof(struct cpu_registers_s, bc.reg);
+	case 1: return offsetof(struct cpu_registers_s, de.reg);
+	case 2: return offsetof(struct cpu_registers_s, hl.reg);
+	default: return offsetof(struct cpu_registers_s, sp.reg);
+	}
+}
 
-	case 1:
-		val = gb->cpu_reg.bc.bytes.c;
-		break;
+/**
+ * Returns true if the instruction only uses CPU registers, and so can be
+ * translated. Instructions that access memory, change the program counter or
+ * change the interrupt state are left to the interpreter.
+ */
+bool __gb_jit_supported(uint8_t opcode)
+{
+	/* LD r, r */
+	if(opcode >= 0x40 && opcode < 0x80)
+		return (opcode & 0x07) != 6 && ((opcode >> 3) & 0x07) != 6;
 
-	case 2:
-		val = gb->cpu_reg.de.bytes.d;
-		break;
+	/* ALU A, r */
+	if(opcode >= 0x80 && opcode < 0xC0)
+		return (opcode & 0x07) != 6;
 
-	case 3:
-		val = gb->cpu_reg.de.bytes.e;
-		break;
+	/* ALU A, imm */
+	if((opcode & 0xC7) == 0xC6)
+		return true;
 
-	case 4:
-		val = gb->cpu_reg.hl.bytes.h;
-		break;
+	if(opcode >= 0x40)
+		return false;
 
-	case 5:
-		val = gb->cpu_reg.hl.bytes.l;
-		break;
+	switch(opcode & 0x0F)
+	{
+	case 0x0: /* NOP */
+		return opcode == 0x00;
 
-	case 6:
-		val = __gb_read(gb, gb->cpu_reg.hl.reg);
-		break;
+	case 0x1: /* LD rr, imm */
+	case 0x3: /* INC rr */
+	case 0xB: /* DEC rr */
+		return true;
+
+	case 0x4: /* INC r */
+	case 0x5: /* DEC r */
+	case 0x6: /* LD r, imm */
+	case 0xC:
+	case 0xD:
+	case 0xE:
+		/* (HL) */
+		return ((opcode >> 3) & 0x07) != 6;
 
-	/* Only values 0-7 are possible here, so we make the final case
-	 * default to satisfy -Wmaybe-uninitialized warning. */
 	default:
-		val = gb->cpu_reg.a;
-		break;
+		return false;
 	}
+}
 
-	switch(cbop >> 6)
+/**
+ * Emits code that stores AL in the register at offset dst, if dst is not 0xFF,
+ * and sets the F register from the flags of the last x86 instruction.
+ * Flags in take are copied, flags in set are set and flags in keep are left
+ * unchanged. All other flags are cleared.
+ */
+uint8_t *__gb_jit_emit_flags(struct gb_s *gb, uint8_t *p, uint8_t dst,
+		uint8_t take, uint8_t set, uint8_t keep)
+{
+	const uint8_t f = offsetof(struct cpu_registers_s, f.reg);
+	const uint64_t lut = (uint64_t)(uintptr_t)gb->jit.flags;
+	uint_fast8_t i;
+
+	/* lahf */
+	*p++ = 0x9F;
+
+	/* mov [rdi+dst], al */
+	if(dst != 0xFF)
 	{
-	case 0x0:
-		cbop = (cbop >> 4) & 0x3;
+		*p++ = 0x88; *p++ = 0x47; *p++ = dst;
+	}
+
+	/* movzx ecx, byte [rdi+f]; and ecx, keep */
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0x4F; *p++ = f;
+	*p++ = 0x83; *p++ = 0xE1; *p++ = keep;
+
+	/* movzx edx, ah; mov rax, lut; movzx edx, byte [rax+rdx] */
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0xD4;
+	*p++ = 0x48; *p++ = 0xB8;
+	for(i = 0; i < 8; i++)
+		*p++ = (uint8_t)(lut >> (i * 8));
+	*p++ = 0x0F; *p++ = 0xB6; *p++ = 0x14; *p++ = 0x10;
+
+	/* and edx, take; or edx, set; or edx, ecx */
+	*p++ = 0x83; *p++ = 0xE2; *p++ = take;
+	*p++ = 0x83; *p++ = 0xCA; *p++ = set;
+	*p++ = 0x09; *p++ = 0xCA;
+
+	/* mov [rdi+f], dl */
+	*p++ = 0x88; *p++ = 0x57; *p++ = f;
+	return p;
+}
+
+/**
+ * Emits code for one supported instruction.
+ */
+uint8_t *__gb_jit_emit(struct gb_s *gb, uint8_t *p,
+		const struct gb_block_inst_s *inst)
+{
+	const uint8_t opcode = inst->opcode;
+	const uint8_t a = offsetof(struct cpu_registers_s, a);
+	const uint8_t f = offsetof(struct cpu_registers_s, f.reg);
+	const uint8_t z = __gb_jit_flags(1, 0, 0, 0);
+	const uint8_t n = __gb_jit_flags(0, 1, 0, 0);
+	const uint8_t h = __gb_jit_flags(0, 0, 1, 0);
+	const uint8_t c = __gb_jit_flags(0, 0, 0, 1);
+	const uint8_t all = z | n | h | c;
+
+	/* LD r, r */
+	if(opcode >= 0x40 && opcode < 0x80)
+	{
+		/* mov al, [rdi+src]; mov [rdi+dst], al */
+		*p++ = 0x8A; *p++ = 0x47; *p++ = __gb_jit_reg8(opcode & 0x07);
+		*p++ = 0x88; *p++ = 0x47; *p++ = __gb_jit_reg8((opcode >> 3) & 0x07);
+		return p;
+	}
+
+	/* ALU A, r and ALU A, imm */
+	if(opcode >= 0x80)
+	{
+		/* add, adc, sub, sbb, and, xor, or, cmp al, cl */
+		static const uint8_t alu[8] = {
+			0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38
+		};
+		const uint8_t op = (opcode >> 3) & 0x07;
 
-		switch(cbop)
+		/* mov al, [rdi+a] */
+		*p++ = 0x8A; *p++ = 0x47; *p++ = a;
+
+		if(opcode < 0xC0)
 		{
-		case 0x0: /* RdC R */
-		case 0x1: /* Rd R */
-			if(d) /* RRC R / RR R */
-			{
-				uint8_t temp = val;
-				val = (val >> 1);
-				val |= cbop ? (gb->cpu_reg.f.f_bits.c << 7) : (temp << 7);
-				gb->cpu_reg.f.reg = 0;
-				gb->cpu_reg.f.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f.f_bits.c = (temp & 0x01);
-			}
-			else /* RLC R / RL R */
-			{
-				uint8_t temp = val;
-				val = (val << 1);
-				val |= cbop ? gb->cpu_reg.f.f_bits.c : (temp >> 7);
-				gb->cpu_reg.f.reg = 0;
-				gb->cpu_reg.f.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f.f_bits.c = (temp >> 7);
-			}
+			/* mov cl, [rdi+src] */
+			*p++ = 0x8A; *p++ = 0x4F; *p++ = __gb_jit_reg8(opcode & 0x07);
+		}
+		else
+		{
+			/* mov cl, imm */
+			*p++ = 0xB1; *p++ = (uint8_t)inst->imm;
+		}
 
-			break;
+		/* ADC and SBC: movzx edx, byte [rdi+f]; bt edx, carry bit */
+		if(op == 1 || op == 3)
+		{
+			uint8_t bit = 0;
 
-		case 0x2:
-			if(d) /* SRA R */
-			{
-				gb->cpu_reg.f.reg = 0;
-				gb->cpu_reg.f.f_bits.c = val & 0x01;
-				val = (val >> 1) | (val & 0x80);
-				gb->cpu_reg.f.f_bits.z = (val == 0x00);
-			}
-			else /* SLA R */
-			{
-				gb->cpu_reg.f.reg = 0;
-				gb->cpu_reg.f.f_bits.c = (val >> 7);
-				val = val << 1;
-				gb->cpu_reg.f.f_bits.z = (val == 0x00);
-			}
+			while(!(c & (1 << bit)))
+				bit++;
 
-			break;
+			*p++ = 0x0F; *p++ = 0xB6; *p++ = 0x57; *p++ = f;
+			*p++ = 0x0F; *p++ = 0xBA; *p++ = 0xE2; *p++ = bit;
+		}
 
-		case 0x3:
-			if(d) /* SRL R */
-			{
-				gb->cpu_reg.f.reg = 0;
-				gb->cpu_reg.f.f_bits.c = val & 0x01;
-				val = val >> 1;
-				gb->cpu_reg.f.f_bits.z = (val == 0x00);
-			}
-			else /* SWAP R */
-			{
-				uint8_t temp = (val >> 4) & 0x0F;
-				temp |= (val << 4) & 0xF0;
-				val = temp;
-				gb->cpu_reg.f.reg = 0;
-				gb->cpu_reg.f.f_bits.z = (val == 0x00);
-			}
+		*p++ = alu[op]; *p++ = 0xC8;
+
+		switch(op)
+		{
+		case 0: /* ADD */
+		case 1: /* ADC */
+			return __gb_jit_emit_flags(gb, p, a, z | h | c, 0, ~all);
+
+		case 2: /* SUB */
+		case 3: /* SBC */
+			return __gb_jit_emit_flags(gb, p, a, z | h | c, n, ~all);
+
+		case 4: /* AND */
+			return __gb_jit_emit_flags(gb, p, a, z, h, 0);
+
+		case 5: /* XOR */
+		case 6: /* OR */
+			return __gb_jit_emit_flags(gb, p, a, z, 0, 0);
 
-			break;
+		default: /* CP */
+			return __gb_jit_emit_flags(gb, p, 0xFF, z | h | c, n, ~all);
 		}
+	}
 
+	switch(opcode & 0x0F)
+	{
+	case 0x1: /* LD rr, imm */
+		/* mov word [rdi+rr], imm */
+		*p++ = 0x66; *p++ = 0xC7; *p++ = 0x47; *p++ = __gb_jit_reg16(opcode >> 4);
+		*p++ = (uint8_t)inst->imm; *p++ = (uint8_t)(inst->imm >> 8);
 		break;
 
-	case 0x1: /* BIT B, R */
-		gb->cpu_reg.f.f_bits.z = !((val >> b) & 0x1);
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h = 1;
-		writeback = 0;
+	case 0x3: /* INC rr */
+		/* inc word [rdi+rr] */
+		*p++ = 0x66; *p++ = 0xFF; *p++ = 0x47; *p++ = __gb_jit_reg16(opcode >> 4);
 		break;
 
-	case 0x2: /* RES B, R */
-		val &= (0xFE << b) | (0xFF >> (8 - b));
+	case 0xB: /* DEC rr */
+		/* dec word [rdi+rr] */
+		*p++ = 0x66; *p++ = 0xFF; *p++ = 0x4F; *p++ = __gb_jit_reg16(opcode >> 4);
 		break;
 
-	case 0x3: /* SET B, R */
-		val |= (0x1 << b);
+	case 0x4: /* INC r */
+	case 0xC:
+	{
+		const uint8_t r = __gb_jit_reg8(opcode >> 3);
+
+		/* mov al, [rdi+r]; inc al */
+		*p++ = 0x8A; *p++ = 0x47; *p++ = r;
+		*p++ = 0xFE; *p++ = 0xC0;
+		p = __gb_jit_emit_flags(gb, p, r, z | h, 0, ~(z | n | h));
 		break;
 	}
 
-	if(writeback)
+	case 0x5: /* DEC r */
+	case 0xD:
 	{
-		switch(r)
-		{
-		case 0:
-			gb->cpu_reg.bc.bytes.b = val;
-			break;
+		const uint8_t r = __gb_jit_reg8(opcode >> 3);
 
-		case 1:
-			gb->cpu_reg.bc.bytes.c = val;
-			break;
+		/* mov al, [rdi+r]; dec al */
+		*p++ = 0x8A; *p++ = 0x47; *p++ = r;
+		*p++ = 0xFE; *p++ = 0xC8;
+		p = __gb_jit_emit_flags(gb, p, r, z | h, n, ~(z | n | h));
+		break;
+	}
 
-		case 2:
-			gb->cpu_reg.de.bytes.d = val;
-			break;
+	case 0x6: /* LD r, imm */
+	case 0xE:
+		/* mov byte [rdi+r], imm */
+		*p++ = 0xC6; *p++ = 0x47; *p++ = __gb_jit_reg8(opcode >> 3);
+		*p++ = (uint8_t)inst->imm;
+		break;
 
-		case 3:
-			gb->cpu_reg.de.bytes.e = val;
-			break;
+	default: /* NOP */
+		break;
+	}
 
-		case 4:
-			gb->cpu_reg.hl.bytes.h = val;
-			break;
+	return p;
+}
 
-		case 5:
-			gb->cpu_reg.hl.bytes.l = val;
-			break;
+/**
+ * Discards all translated code.
+ */
+PGB_COLD void __gb_jit_flush(struct gb_s *gb)
+{
+	uint_fast16_t i;
+	uint_fast8_t j;
 
-		case 6:
-			__gb_write(gb, gb->cpu_reg.hl.reg, val);
-			break;
+	for(i = 0; i < PEANUT_GB_BLOCK_CACHE_SIZE; i++)
+		for(j = 0; j < PEANUT_GB_BLOCK_MAX_INST; j++)
+			gb->block_cache.block[i].inst[j].jit = NULL;
 
-		case 7:
-			gb->cpu_reg.a = val;
-			break;
-		}
-	}
-	return inst_cycles;
+	gb->jit.used = 0;
 }
 
-#if ENABLE_LCD
-struct sprite_data {
-	uint8_t sprite_number;
-	uint8_t x;
-};
-
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-static int compare_sprites(const void *in1, const void *in2)
+/**
+ * Translates each run of at least two supported instructions in a block.
+ */
+PGB_COLD void __gb_jit_compile(struct gb_s *gb, struct gb_block_s *block)
 {
-	const struct sprite_data *sd1, *sd2;
-	int x_res;
+	uint_fast8_t i = 0;
+
+	if(gb->jit.code == NULL)
+		return;
+
+	while(i < block->count)
+	{
+		struct gb_block_inst_s *first = &block->inst[i];
+		uint_fast8_t count = 0;
+		size_t need;
+		uint8_t *p;
+
+		while(i + count < block->count &&
+				__gb_jit_supported(block->inst[i + count].opcode))
+			count++;
+
+		if(count < 2)
+		{
+			i += count + 1;
+			continue;
+		}
+
+		need = (size_t)count * PEANUT_GB_JIT_MAX_INST_SIZE + 1;
 
-	sd1 = (struct sprite_data *)in1;
-	sd2 = (struct sprite_data *)in2;
-	x_res = (int)sd1->x - (int)sd2->x;
-	if(x_res != 0)
-		return x_res;
+		if(gb->jit.size - gb->jit.used < need)
+		{
+			__gb_jit_flush(gb);
+
+			/* Buffer is too small. */
+			if(gb->jit.size < need)
+				return;
+		}
+
+		p = gb->jit.code + gb->jit.used;
+		first->jit = (void (*)(struct cpu_registers_s *))(void *)p;
+		first->jit_count = count;
+		first->jit_length = 0;
+		first->jit_cycles = 0;
+
+		for(; count > 0; count--, i++)
+		{
+			const struct gb_block_inst_s *inst = &block->inst[i];
+
+			p = __gb_jit_emit(gb, p, inst);
+			first->jit_length += inst->length;
+			first->jit_cycles += op_cycles[inst->opcode];
+		}
 
-	return (int)sd1->sprite_number - (int)sd2->sprite_number;
+		/* ret */
+		*p++ = 0xC3;
+		gb->jit.used = p - gb->jit.code;
+	}
 }
 #endif
 
-void __gb_draw_line(struct gb_s *gb)
+/**
+ * Returns the decoded instruction at pc, or NULL if code at this address is not
+ * cached.
+ */
+PGB_HOT const struct gb_block_inst_s *__gb_block_fetch(struct gb_s *gb,
+		const uint_fast16_t pc)
 {
-	uint8_t pixels[160] = {0};
+	const struct gb_block_inst_s *inst;
+	struct gb_block_s *block;
+	int_fast32_t key;
+	uint_fast32_t end;
+	uint_fast8_t page = 0;
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	/* Code outside HRAM cannot be read during OAM DMA. */
+	if(PGB_UNLIKELY(gb->counter.scheduled & (1 << GB_EVENT_DMA)) &&
+			pc < IO_ADDR)
+	{
+		gb->block_cache.next_count = 0;
+		return NULL;
+	}
+#endif
 
-	/* If LCD not initialised by front-end, don't render anything. */
-	if(gb->display.lcd_draw_line == NULL)
-		return;
+	/* Continue with the current block. */
+	if(PGB_LIKELY(gb->block_cache.next_count != 0 &&
+			gb->block_cache.next_pc == pc))
+	{
+		inst = gb->block_cache.next++;
+		gb->block_cache.next_count--;
+		gb->block_cache.next_pc += inst->length;
+		return inst;
+	}
 
-	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
-		return;
+	gb->block_cache.next_count = 0;
 
-	/* If interlaced mode is activated, check if we need to draw the current
-	 * line. */
-	if(gb->direct.interlace)
+	/* Only ROM, WRAM and HRAM are cached. The boot ROM is not. */
+	if(pc < ROM_N_ADDR)
 	{
-		if((!gb->display.interlace_count
-				&& (gb->hram_io[IO_LY] & 1) == 0)
-				|| (gb->display.interlace_count
-				    && (gb->hram_io[IO_LY] & 1) == 1))
-		{
-			/* Compensate for missing window draw if required. */
-			if(gb->hram_io[IO_LCDC] & LCDC_WINDOW_ENABLE
-					&& gb->hram_io[IO_LY] >= gb->display.WY
-					&& gb->hram_io[IO_WX] <= 166)
-				gb->display.window_clear++;
+		if(gb->hram_io[IO_BOOT] == 0 && pc < 0x0100)
+			return NULL;
 
-			return;
-		}
+		key = pc;
+		end = ROM_N_ADDR;
+	}
+	else if(pc < VRAM_ADDR)
+	{
+		key = pc + gb->block_cache.rom_bank_addr;
+		end = VRAM_ADDR;
+	}
+	else if(pc >= WRAM_0_ADDR && pc < ECHO_ADDR)
+	{
+		page = PEANUT_GB_GET_MSN16(pc);
+		key = PEANUT_GB_BLOCK_RAM_KEY | pc;
+		end = (pc & 0xF000) + 0x1000;
 	}
+	else if(pc >= HRAM_ADDR && pc < INTR_EN_ADDR)
+	{
+		page = 0xF;
+		key = PEANUT_GB_BLOCK_RAM_KEY | pc;
+		end = INTR_EN_ADDR;
+	}
+	else
+		return NULL;
 
-	/* If background is enabled, draw it. */
-	if(gb->hram_io[IO_LCDC] & LCDC_BG_ENABLE)
+	block = &gb->block_cache.block[key & (PEANUT_GB_BLOCK_CACHE_SIZE - 1)];
+
+	if(block->key != key ||
+			(page != 0 && block->gen != gb->block_cache.ram_gen[page]))
 	{
-		uint8_t bg_y, disp_x, bg_x, idx, py, px, t1, t2;
-		uint16_t bg_map, tile;
+		__gb_block_decode(gb, block, key, pc, end);
+#if PEANUT_GB_USE_JIT
+		__gb_jit_compile(gb, block);
+#endif
 
-		/* Calculate current background line to draw. Constant because
-		 * this function draws only this one line each time it is
-		 * called. */
-		bg_y = gb->hram_io[IO_LY] + gb->hram_io[IO_SCY];
+		if(page != 0)
+		{
+			block->gen = gb->block_cache.ram_gen[page];
+			gb->block_cache.ram_code |= (1 << page);
+			__gb_update_memory_map(gb);
+		}
+	}
 
-		/* Get selected background map address for first tile
-		 * corresponding to current line.
-		 * 0x20 (32) is the width of a background tile, and the bit
-		 * shift is to calculate the address. */
-		bg_map =
-			((gb->hram_io[IO_LCDC] & LCDC_BG_MAP) ?
-			 VRAM_BMAP_2 : VRAM_BMAP_1)
-			+ (bg_y >> 3) * 0x20;
+	if(block->count == 0)
+		return NULL;
 
-		/* The displays (what the player sees) X coordinate, drawn right
-		 * to left. */
-		disp_x = LCD_WIDTH - 1;
+	gb->block_cache.next = &block->inst[1];
+	gb->block_cache.next_count = block->count - 1;
+	gb->block_cache.next_pc = pc + block->inst[0].length;
+	return &block->inst[0];
+}
+#endif
 
-		/* The X coordinate to begin drawing the background at. */
-		bg_x = disp_x + gb->hram_io[IO_SCX];
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+/**
+ * Returns true if the instructions from addr up to end do not write to
+ * memory, change control flow or interrupts, or read registers with side
+ * effects. Executing them again with the same registers then gives the same
+ * result until the next event.
+ */
+PGB_COLD bool __gb_idle_loop_pure(struct gb_s *gb, uint_fast16_t addr,
+		uint_fast16_t end)
+{
+	while(addr < end)
+	{
+		const uint8_t opcode = __gb_read(gb, addr);
 
-		/* Get tile index for current background tile. */
-		idx = gb->vram[bg_map + (bg_x >> 3)];
-		/* Y coordinate of tile pixel to draw. */
-		py = (bg_y & 0x07);
-		/* X coordinate of tile pixel to draw. */
-		px = 7 - (bg_x & 0x07);
+		switch(opcode)
+		{
+		/* Stores. */
+		case 0x02: case 0x12: case 0x22: case 0x32:
+		case 0x08: case 0x34: case 0x35: case 0x36:
+		case 0x70: case 0x71: case 0x72: case 0x73:
+		case 0x74: case 0x75: case 0x77:
+		case 0xE0: case 0xE2: case 0xEA:
+		/* Jumps, HALT and STOP. */
+		case 0x10: case 0x18: case 0x20: case 0x28:
+		case 0x30: case 0x38: case 0x76:
+			return false;
 
-		/* Select addressing mode. */
-		if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
-			tile = VRAM_TILES_1 + idx * 0x10;
-		else
-			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+#if ENABLE_SOUND
+		/* Reads that may be passed to audio_read(). */
+		case 0x0A: case 0x1A: case 0x2A: case 0x3A:
+		case 0x46: case 0x4E: case 0x56: case 0x5E:
+		case 0x66: case 0x6E: case 0x7E:
+		case 0x86: case 0x8E: case 0x96: case 0x9E:
+		case 0xA6: case 0xAE: case 0xB6: case 0xBE:
+		case 0xF2:
+			return false;
+
+		case 0xF0:
+		case 0xFA:
+		{
+			uint_fast16_t a = __gb_read(gb, addr + 1);
 
-		tile += 2 * py;
+			if(opcode == 0xF0)
+				a |= 0xFF00;
+			else
+				a |= __gb_read(gb, addr + 2) << 8;
 
-		/* fetch first tile */
-		t1 = gb->vram[tile] >> px;
-		t2 = gb->vram[tile + 1] >> px;
+			if(a >= 0xFF10 && a <= 0xFF3F)
+				return false;
 
-		for(; disp_x != 0xFF; disp_x--)
+			break;
+		}
+#endif
+
+		case 0xCB:
 		{
-			uint8_t c;
+			const uint8_t cbop = __gb_read(gb, addr + 1);
 
-			if(px == 8)
-			{
-				/* fetch next tile */
-				px = 0;
-				bg_x = disp_x + gb->hram_io[IO_SCX];
-				idx = gb->vram[bg_map + (bg_x >> 3)];
+			/* Only BIT may use (HL). */
+			if((cbop & 0x07) == 6 && (ENABLE_SOUND ||
+					cbop < 0x40 || cbop >= 0x80))
+				return false;
 
-				if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
-					tile = VRAM_TILES_1 + idx * 0x10;
-				else
-					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+			break;
+		}
 
-				tile += 2 * py;
-				t1 = gb->vram[tile];
-				t2 = gb->vram[tile + 1];
-			}
+		default:
+			/* Apart from ALU A, imm, loads from IO and the stack
+			 * pointer arithmetic, these are stack operations, calls,
+			 * returns, interrupt control and invalid opcodes. */
+			if(opcode >= 0xC0 && (opcode & 0x07) != 6 &&
+					opcode != 0xF0 && opcode != 0xF2 &&
+					opcode != 0xF8 && opcode != 0xF9 &&
+					opcode != 0xFA && opcode != 0xE8)
+				return false;
 
-			/* copy background */
-			c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-			pixels[disp_x] = gb->display.bg_palette[c];
-#if PEANUT_GB_12_COLOUR
-			pixels[disp_x] |= LCD_PALETTE_BG;
-#endif
-			t1 = t1 >> 1;
-			t2 = t2 >> 1;
-			px++;
+			break;
 		}
-	}
 
-	/* draw window */
-	if(gb->hram_io[IO_LCDC] & LCDC_WINDOW_ENABLE
-			&& gb->hram_io[IO_LY] >= gb->display.WY
-			&& gb->hram_io[IO_WX] <= 166)
-	{
-		uint16_t win_line, tile;
-		uint8_t disp_x, win_x, py, px, idx, t1, t2, end;
+		addr += op_length[opcode];
+	}
 
-		/* Calculate Window Map Address. */
-		win_line = (gb->hram_io[IO_LCDC] & LCDC_WINDOW_MAP) ?
-				    VRAM_BMAP_2 : VRAM_BMAP_1;
-		win_line += (gb->display.window_clear >> 3) * 0x20;
+	return true;
+}
 
-		disp_x = LCD_WIDTH - 1;
-		win_x = disp_x - gb->hram_io[IO_WX] + 7;
+/**
+ * Called after a backward relative jump was taken. If the registers are the
+ * same as at the previous time this jump was taken, and the loop has no side
+ * effects, every following iteration is identical until an event is handled.
+ * As many whole iterations as fit before the next event, or before the run
+ * ends at cycle end, are then skipped.
+ */
+PGB_COLD void __gb_idle_loop(struct gb_s *gb, uint_fast16_t branch,
+		uint_fast16_t inst_cycles, uint32_t end)
+{
+	const uint32_t now = gb->counter.cycles + inst_cycles;
+	const struct cpu_registers_s *prev = &gb->idle.reg;
+	int32_t remaining = gb->counter.next_event - now;
+
+	if((int32_t)(end - now) < remaining)
+		remaining = end - now;
+
+	if(gb->idle.valid && gb->idle.branch == branch && remaining > 0 &&
+			prev->pc.reg == gb->cpu_reg.pc.reg &&
+			prev->sp.reg == gb->cpu_reg.sp.reg &&
+			prev->a == gb->cpu_reg.a &&
+			prev->bc.reg == gb->cpu_reg.bc.reg &&
+			prev->de.reg == gb->cpu_reg.de.reg &&
+			prev->hl.reg == gb->cpu_reg.hl.reg &&
+#if PEANUT_GB_LAZY_FLAGS
+			prev->flags.z == gb->cpu_reg.flags.z &&
+			prev->flags.n == gb->cpu_reg.flags.n &&
+			prev->flags.h == gb->cpu_reg.flags.h &&
+			prev->flags.c == gb->cpu_reg.flags.c &&
+#else
+			prev->f.reg == gb->cpu_reg.f.reg &&
+#endif
+			__gb_idle_loop_pure(gb, gb->cpu_reg.pc.reg, branch))
+	{
+		const uint32_t period = now - gb->idle.cycles;
+		const uint32_t skip = remaining - remaining % period;
 
-		// look up tile
-		py = gb->display.window_clear & 0x07;
-		px = 7 - (win_x & 0x07);
-		idx = gb->vram[win_line + (win_x >> 3)];
+		gb->counter.cycles += skip;
+		gb->idle.skipped_cycles += skip;
+		gb->idle.valid = false;
+		return;
+	}
 
-		if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
-			tile = VRAM_TILES_1 + idx * 0x10;
-		else
-			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+	gb->idle.reg = gb->cpu_reg;
+	gb->idle.branch = branch;
+	gb->idle.cycles = now;
+	gb->idle.valid = true;
+}
+#endif
 
-		tile += 2 * py;
+/**
+ * Rarely used instructions, kept out of __gb_run_cpu() so that the common
+ * instructions take less space in the instruction cache. These use the
+ * registers in gb->cpu_reg.
+ */
+PGB_COLD void __gb_daa(struct gb_s *gb)
+{
+	/* The following is from SameBoy. MIT License. */
+	int16_t a = gb->cpu_reg.a;
 
-		// fetch first tile
-		t1 = gb->vram[tile] >> px;
-		t2 = gb->vram[tile + 1] >> px;
+	if(PGB_FLAG_N())
+	{
+		if(PGB_FLAG_H())
+			a = (a - 0x06) & 0xFF;
 
-		// loop & copy window
-		end = (gb->hram_io[IO_WX] < 7 ? 0 : gb->hram_io[IO_WX] - 7) - 1;
+		if(PGB_FLAG_C())
+			a -= 0x60;
+	}
+	else
+	{
+		if(PGB_FLAG_H() || (a & 0x0F) > 9)
+			a += 0x06;
 
-		for(; disp_x != end; disp_x--)
-		{
-			uint8_t c;
+		if(PGB_FLAG_C() || a > 0x9F)
+			a += 0x60;
+	}
 
-			if(px == 8)
-			{
-				// fetch next tile
-				px = 0;
-				win_x = disp_x - gb->hram_io[IO_WX] + 7;
-				idx = gb->vram[win_line + (win_x >> 3)];
+	if((a & 0x100) == 0x100)
+		PGB_SET_FLAG_C(1);
 
-				if(gb->hram_io[IO_LCDC] & LCDC_TILE_SELECT)
-					tile = VRAM_TILES_1 + idx * 0x10;
-				else
-					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+	gb->cpu_reg.a = a;
+	PGB_SET_FLAG_Z_RESULT(gb->cpu_reg.a);
+	PGB_SET_FLAG_H(0);
+}
 
-				tile += 2 * py;
-				t1 = gb->vram[tile];
-				t2 = gb->vram[tile + 1];
-			}
+/**
+ * Returns SP plus a signed immediate, and sets the flags of ADD SP, imm and
+ * LD HL, SP+/-imm.
+ */
+PGB_COLD uint16_t __gb_sp_offset(struct gb_s *gb, uint8_t imm)
+{
+	/* Taken from SameBoy, which is released under MIT Licence. */
+	const uint16_t sp = gb->cpu_reg.sp.reg;
+	int8_t offset = (int8_t) imm;
+
+	PGB_CLEAR_FLAGS();
+	PGB_SET_FLAG_H(((sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0);
+	PGB_SET_FLAG_C(((sp & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 : 0);
+	return sp + offset;
+}
 
-			// copy window
-			c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-			pixels[disp_x] = gb->display.bg_palette[c];
-#if PEANUT_GB_12_COLOUR
-			pixels[disp_x] |= LCD_PALETTE_BG;
-#endif
-			t1 = t1 >> 1;
-			t2 = t2 >> 1;
-			px++;
-		}
+/**
+ * Pushes the program counter for RST. Returns the new stack pointer.
+ */
+PGB_COLD uint16_t __gb_rst(struct gb_s *gb, uint16_t sp, uint16_t pc)
+{
+	__gb_write(gb, --sp, pc >> 8);
+	__gb_write(gb, --sp, pc & 0xFF);
+	return sp;
+}
 
-		gb->display.window_clear++; // advance window line
-	}
+/**
+ * Halts the CPU until the next interrupt. Returns the cycles to skip, up to
+ * the next event or the end of the run.
+ */
+PGB_COLD uint_fast16_t __gb_halt(struct gb_s *gb, const uint32_t end)
+{
+	int32_t halt_cycles;
 
-	// draw sprites
-	if(gb->hram_io[IO_LCDC] & LCDC_OBJ_ENABLE)
-	{
-		uint8_t sprite_number;
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-		uint8_t number_of_sprites = 0;
+	/* TODO: Emulate HALT bug? */
+	gb->gb_halt = true;
 
-		struct sprite_data sprites_to_render[NUM_SPRITES];
+	if (gb->hram_io[IO_IE] == 0)
+	{
+		/* Return program counter where this halt forever state started. */
+		/* This may be intentional, but this is required to stop an infinite
+		 * loop. */
+		__gb_error(gb, GB_HALT_FOREVER, gb->cpu_reg.pc.reg - 1);
+		PGB_UNREACHABLE();
+	}
 
-		/* Record number of sprites on the line being rendered, limited
-		 * to the maximum number sprites that the Game Boy is able to
-		 * render on each line (10 sprites). */
-		for(sprite_number = 0;
-				sprite_number < PEANUT_GB_ARRAYSIZE(sprites_to_render);
-				sprite_number++)
-		{
-			/* Sprite Y position. */
-			uint8_t OY = gb->oam[4 * sprite_number + 0];
-			/* Sprite X position. */
-			uint8_t OX = gb->oam[4 * sprite_number + 1];
+	/* Jump straight to the next event. Interrupts are only raised by
+	 * events, so the CPU wakes on the exact cycle of the interrupt that
+	 * ends the HALT. */
+	halt_cycles = (int32_t)(gb->counter.next_event - gb->counter.cycles);
 
-			/* If sprite isn't on this line, continue. */
-			if (gb->hram_io[IO_LY] +
-				(gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 0 : 8) >= OY
-					|| gb->hram_io[IO_LY] + 16 < OY)
-				continue;
+	/* The next event may already be due, so make sure we don't underflow
+	 * here. */
+	if(halt_cycles <= 0)
+		halt_cycles = 4;
 
+	/* Stop at the end of the run instead if it comes first. The next run
+	 * then continues waiting for the event. */
+	if((int32_t)(end - gb->counter.cycles) > 0 &&
+			(int32_t)(end - gb->counter.cycles) < halt_cycles)
+		halt_cycles = (int32_t)(end - gb->counter.cycles);
 
-			sprites_to_render[number_of_sprites].sprite_number = sprite_number;
-			sprites_to_render[number_of_sprites].x = OX;
-			number_of_sprites++;
-		}
+	return (uint_fast16_t)halt_cycles;
+}
 
-		/* If maximum number of sprites reached, prioritise X
-		 * coordinate and object location in OAM. */
-		qsort(&sprites_to_render[0], number_of_sprites,
-				sizeof(sprites_to_render[0]), compare_sprites);
-		if(number_of_sprites > MAX_SPRITES_LINE)
-			number_of_sprites = MAX_SPRITES_LINE;
-#endif
+/**
+ * Internal function used to step the CPU.
+ */
+#undef PGB_CPU_REG
+#define PGB_CPU_REG	cpu_reg
 
-		/* Render each sprite, from low priority to high priority. */
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-		/* Render the top ten prioritised sprites on this scanline. */
-		for(sprite_number = number_of_sprites - 1;
-				sprite_number != 0xFF;
-				sprite_number--)
-		{
-			uint8_t s = sprites_to_render[sprite_number].sprite_number;
-#else
-		for (sprite_number = NUM_SPRITES - 1;
-			sprite_number != 0xFF;
-			sprite_number--)
+/**
+ * Skips to each following event while the CPU is halted, until an interrupt
+ * occurs or the run ends. The next run then continues waiting.
+ */
+static PGB_ALWAYS_INLINE void __gb_halt_wait(struct gb_s *gb,
+		const uint32_t end)
+{
+	while(gb->gb_halt && (gb->hram_io[IO_IF] & gb->hram_io[IO_IE]) == 0 &&
+			(int32_t)(gb->counter.cycles - end) < 0)
+	{
+		if((int32_t)(gb->counter.next_event - end) > 0)
 		{
-			uint8_t s = sprite_number;
-#endif
-			uint8_t py, t1, t2, dir, start, end, shift, disp_x;
-			/* Sprite Y position. */
-			uint8_t OY = gb->oam[4 * s + 0];
-			/* Sprite X position. */
-			uint8_t OX = gb->oam[4 * s + 1];
-			/* Sprite Tile/Pattern Number. */
-			uint8_t OT = gb->oam[4 * s + 2]
-				     & (gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 0xFE : 0xFF);
-			/* Additional attributes. */
-			uint8_t OF = gb->oam[4 * s + 3];
+			gb->counter.cycles = end;
+			break;
+		}
 
-#if !PEANUT_GB_HIGH_LCD_ACCURACY
-			/* If sprite isn't on this line, continue. */
-			if(gb->hram_io[IO_LY] +
-					(gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 0 : 8) >= OY ||
-					gb->hram_io[IO_LY] + 16 < OY)
-				continue;
-#endif
+		if((int32_t)(gb->counter.next_event - gb->counter.cycles) > 0)
+			gb->counter.cycles = gb->counter.next_event;
 
-			/* Continue if sprite not visible. */
-			if(OX == 0 || OX >= 168)
-				continue;
+		__gb_handle_events(gb);
+	}
+}
 
-			// y flip
-			py = gb->hram_io[IO_LY] - OY + 16;
+/**
+ * Ends a HALT, and calls the pending interrupt with the highest priority if
+ * interrupts are enabled.
+ */
+static PGB_ALWAYS_INLINE void __gb_interrupt(struct gb_s *gb,
+		struct cpu_registers_s *regs)
+{
+	/* If gb_halt is positive, then an interrupt must have occurred by the
+	 * time we reach here, because on HALT, we jump to the next interrupt
+	 * immediately. */
+	if(PGB_UNLIKELY(gb->gb_halt || (gb->gb_ime && gb->intr_pending)))
+	{
+		gb->gb_halt = false;
 
-			if(OF & OBJ_FLIP_Y)
-				py = (gb->hram_io[IO_LCDC] & LCDC_OBJ_SIZE ? 15 : 7) - py;
+		if(gb->gb_ime)
+		{
+			/* Disable interrupts */
+			gb->gb_ime = false;
 
-			// fetch the tile
-			t1 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py];
-			t2 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
+			/* Push Program Counter */
+			regs->sp.reg = __gb_rst(gb, regs->sp.reg, regs->pc.reg);
 
-			// handle x flip
-			if(OF & OBJ_FLIP_X)
-			{
-				dir = 1;
-				start = (OX < 8 ? 0 : OX - 8);
-				end = MIN(OX, LCD_WIDTH);
-				shift = 8 - OX + start;
-			}
-			else
+			/* Call the interrupt handler with the highest priority. */
+			if(gb->intr_pending)
 			{
-				dir = (uint8_t)-1;
-				start = MIN(OX, LCD_WIDTH) - 1;
-				end = (OX < 8 ? 0 : OX - 8) - 1;
-				shift = OX - (start + 1);
+				const uint_fast8_t n = intr_ctz[gb->intr_pending];
+
+				regs->pc.reg = VBLANK_INTR_ADDR + n * 8;
+				gb->hram_io[IO_IF] ^= 1 << n;
+				__gb_update_intr_pending(gb);
 			}
+		}
+	}
+}
 
-			// copy tile
-			t1 >>= shift;
-			t2 >>= shift;
+/**
+ * Reads the opcode at PC and its immediate operand. PC is left pointing to the
+ * next instruction, as it is while the opcode is executed.
+ */
+static PGB_ALWAYS_INLINE uint8_t __gb_fetch(struct gb_s *gb,
+		struct cpu_registers_s *regs, uint16_t *imm)
+{
+	const uint8_t opcode = __gb_read_inline(gb, regs->pc.reg++);
 
-			/* TODO: Put for loop within the to if statements
-			 * because the BG priority bit will be the same for
-			 * all the pixels in the tile. */
-			for(disp_x = start; disp_x != end; disp_x += dir)
-			{
-				uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-				// check transparency / sprite overlap / background overlap
+	*imm = 0;
 
-				if(c && !(OF & OBJ_PRIORITY && !((pixels[disp_x] & 0x3) == gb->display.bg_palette[0])))
-				{
-					/* Set pixel colour. */
-					pixels[disp_x] = (OF & OBJ_PALETTE)
-						? gb->display.sp_palette[c + 4]
-						: gb->display.sp_palette[c];
-#if PEANUT_GB_12_COLOUR
-					/* Set pixel palette (OBJ0 or OBJ1). */
-					pixels[disp_x] |= (OF & OBJ_PALETTE);
-#endif
-				}
+	if(op_length[opcode] >= 2)
+		*imm = __gb_read_inline(gb, regs->pc.reg++);
 
-				t1 = t1 >> 1;
-				t2 = t2 >> 1;
-			}
-		}
-	}
+	if(op_length[opcode] == 3)
+		*imm |= __gb_read_inline(gb, regs->pc.reg++) << 8;
 
-	gb->display.lcd_draw_line(gb, pixels, gb->hram_io[IO_LY]);
+	return opcode;
 }
+
+/**
+ * Adds the cycles of an instruction that was run. Returns whether the run
+ * continues with the next instruction: no event is due, the run has not ended
+ * and the CPU is not halted.
+ */
+static PGB_ALWAYS_INLINE bool __gb_retire(struct gb_s *gb,
+		const struct cpu_registers_s *regs, const uint8_t opcode,
+		const uint16_t imm, const uint_fast16_t inst_cycles,
+		const uint32_t end)
+{
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+	/* Taken backward JR. */
+	if(((opcode & 0xE7) == 0x20 || opcode == 0x18) && (int8_t)imm < 0 &&
+			inst_cycles == 12)
+	{
+		gb->cpu_reg = *regs;
+		__gb_idle_loop(gb, (regs->pc.reg - (int8_t)imm - 2) & 0xFFFF,
+				inst_cycles, end);
+	}
+#else
+	(void)regs;
+	(void)opcode;
+	(void)imm;
 #endif
 
+	gb->counter.cycles += inst_cycles;
+	return (int32_t)(gb->counter.cycles - gb->counter.next_event) < 0 &&
+		(int32_t)(gb->counter.cycles - end) < 0 && !gb->gb_halt;
+}
+
 /**
- * Internal function used to step the CPU.
+ * Ends a run once an event is due, the CPU is halted or the cycle counter
+ * reaches end. Timers, serial, RTC and LCD are only updated when an event is
+ * due.
  */
-void __gb_step_cpu(struct gb_s *gb)
+static PGB_ALWAYS_INLINE void __gb_end_run(struct gb_s *gb, const uint32_t end)
+{
+	if(PGB_UNLIKELY((int32_t)(gb->counter.cycles - gb->counter.next_event) >= 0))
+		__gb_handle_events(gb);
+
+	__gb_halt_wait(gb, end);
+}
+
+#if PEANUT_GB_USE_MUSTTAIL
+/**
+ * Executes opcode with its immediate operand on the registers in *regs.
+ * Returns the cycles taken, given the cycles without a taken branch. With a
+ * constant opcode, only the code of that opcode remains.
+ */
+static PGB_ALWAYS_INLINE uint_fast16_t __gb_execute(struct gb_s *gb,
+		struct cpu_registers_s *regs, const uint8_t opcode,
+		const uint16_t imm, uint_fast16_t inst_cycles, const uint32_t end)
+{
+	struct cpu_registers_s cpu_reg = *regs;
+#else
+/**
+ * Internal function used to run the CPU until an event is due, the CPU is
+ * halted or the cycle counter reaches end. At least one instruction is run.
+ * The CPU registers are kept in local variables meanwhile, and are only
+ * written back to gb->cpu_reg for the functions that use them.
+ */
+PGB_HOT void __gb_run_cpu(struct gb_s *gb, const uint32_t end)
 {
+	struct cpu_registers_s cpu_reg = gb->cpu_reg;
 	uint8_t opcode;
+	uint16_t imm;
 	uint_fast16_t inst_cycles;
-	static const uint8_t op_cycles[0x100] =
-	{
-		/* *INDENT-OFF* */
-		/*0 1 2  3  4  5  6  7  8  9  A  B  C  D  E  F	*/
-		4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,	/* 0x00 */
-		4,12, 8, 8, 4, 4, 8, 4,12, 8, 8, 8, 4, 4, 8, 4,	/* 0x10 */
-		8,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x20 */
-		8,12, 8, 8,12,12,12, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x30 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x40 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x50 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x60 */
-		8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4, /* 0x70 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x80 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x90 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xA0 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xB0 */
-		8,12,12,16,12,16, 8,16, 8,16,12, 8,12,24, 8,16,	/* 0xC0 */
-		8,12,12, 0,12,16, 8,16, 8,16,12, 0,12, 0, 8,16,	/* 0xD0 */
-		12,12,8, 0, 0,16, 8,16,16, 4,16, 0, 0, 0, 8,16,	/* 0xE0 */
-		12,12,8, 4, 0,16, 8,16,12, 8,16, 4, 0, 0, 8,16	/* 0xF0 */
-		/* *INDENT-ON* */
+#if PEANUT_GB_USE_BLOCK_CACHE
+	const struct gb_block_inst_s *inst;
+#endif
+#if PEANUT_GB_USE_COMPUTED_GOTO
+	static const void *const op_labels[0x100] =
+	{
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03,
+		&&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+		&&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B,
+		&&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13,
+		&&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+		&&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B,
+		&&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23,
+		&&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+		&&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B,
+		&&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33,
+		&&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+		&&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B,
+		&&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43,
+		&&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+		&&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B,
+		&&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53,
+		&&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+		&&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B,
+		&&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63,
+		&&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+		&&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B,
+		&&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73,
+		&&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+		&&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B,
+		&&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83,
+		&&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+		&&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B,
+		&&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93,
+		&&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+		&&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B,
+		&&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3,
+		&&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+		&&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB,
+		&&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3,
+		&&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+		&&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB,
+		&&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3,
+		&&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+		&&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB,
+		&&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_invalid,
+		&&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+		&&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_invalid,
+		&&op_0xDC, &&op_invalid, &&op_0xDE, &&op_0xDF,
+		&&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_invalid,
+		&&op_invalid, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+		&&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_invalid,
+		&&op_invalid, &&op_invalid, &&op_0xEE, &&op_0xEF,
+		&&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3,
+		&&op_invalid, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+		&&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB,
+		&&op_invalid, &&op_invalid, &&op_0xFE, &&op_0xFF
 	};
-	static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
+#endif
 
-	/* Handle interrupts */
-	/* If gb_halt is positive, then an interrupt must have occurred by the
-	 * time we reach here, because on HALT, we jump to the next interrupt
-	 * immediately. */
-	while(gb->gb_halt || (gb->gb_ime &&
-			gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & ANY_INTR))
+	/* Continue waiting if the previous run ended while halted. */
+	if(PGB_UNLIKELY(gb->gb_halt &&
+			(gb->hram_io[IO_IF] & gb->hram_io[IO_IE]) == 0))
 	{
-		gb->gb_halt = false;
+		__gb_halt_wait(gb, end);
+		return;
+	}
 
-		if(!gb->gb_ime)
-			break;
+next_inst:
+	__gb_interrupt(gb, &cpu_reg);
 
-		/* Disable interrupts */
-		gb->gb_ime = false;
+	/* Obtain opcode and immediate operand. PC points to the next
+	 * instruction while the opcode is executed. */
+#if PEANUT_GB_USE_BLOCK_CACHE
+	inst = gb->block_cache.bypass ? NULL :
+		__gb_block_fetch(gb, cpu_reg.pc.reg);
 
-		/* Push Program Counter */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
+	if(inst != NULL)
+	{
+		opcode = inst->opcode;
+		imm = inst->imm;
+		cpu_reg.pc.reg += inst->length;
+	}
+	else
+#endif
+	{
+		opcode = __gb_fetch(gb, &cpu_reg, &imm);
+	}
 
-		/* Call interrupt handler if required. */
-		if(gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & VBLANK_INTR)
-		{
-			gb->cpu_reg.pc.reg = VBLANK_INTR_ADDR;
-			gb->hram_io[IO_IF] ^= VBLANK_INTR;
-		}
-		else if(gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & LCDC_INTR)
+	inst_cycles = op_cycles[opcode];
+
+#if PEANUT_GB_USE_JIT
+	/* Run translated code instead if no event is due and the run does not
+	 * end before it completes. The code only modifies CPU registers, so the
+	 * LCD, timers and interrupts cannot observe the instructions in
+	 * between. */
+	if(inst != NULL && inst->jit != NULL && !gb->direct.interpreter_only &&
+			(int32_t)(gb->counter.next_event - gb->counter.cycles) >=
+			inst->jit_cycles &&
+			(int32_t)(end - gb->counter.cycles) >= inst->jit_cycles)
+	{
+		const uint_fast8_t skip = inst->jit_length - inst->length;
+
+		gb->cpu_reg = cpu_reg;
+		inst->jit(&gb->cpu_reg);
+		cpu_reg = gb->cpu_reg;
+		inst_cycles = inst->jit_cycles;
+		cpu_reg.pc.reg += skip;
+		gb->block_cache.next += inst->jit_count - 1;
+		gb->block_cache.next_count -= inst->jit_count - 1;
+		gb->block_cache.next_pc += skip;
+	}
+	else
+#endif
+#if PEANUT_GB_USE_SUPERINSTRUCTIONS
+	/* Run a pair of instructions together if nothing can happen in between:
+	 * no event is due and the run does not end after the first instruction.
+	 * None of the first instructions write memory or change interrupts. The
+	 * cycles of the first instruction are added before the second one runs,
+	 * which is left in opcode, imm and inst_cycles as if it had been run on
+	 * its own. */
+	if(inst != NULL && inst->fused != GB_FUSED_NONE &&
+			(int32_t)(gb->counter.next_event - gb->counter.cycles) >
+			(int32_t)inst_cycles &&
+			(int32_t)(end - gb->counter.cycles) > (int32_t)inst_cycles)
+	{
+		const struct gb_block_inst_s *const second =
+			gb->block_cache.next++;
+
+		gb->block_cache.next_count--;
+		gb->block_cache.next_pc += second->length;
+		cpu_reg.pc.reg += second->length;
+		opcode = second->opcode;
+		imm = second->imm;
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+		gb->block_cache.fused_count[inst->fused]++;
+#endif
+
+		switch(inst->fused)
 		{
-			gb->cpu_reg.pc.reg = LCDC_INTR_ADDR;
-			gb->hram_io[IO_IF] ^= LCDC_INTR;
-		}
-		else if(gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & TIMER_INTR)
+		case GB_FUSED_LD_A_HLI_LD_DE_A:
+			cpu_reg.a = __gb_read(gb, cpu_reg.hl.reg++);
+			gb->counter.cycles += inst_cycles;
+			__gb_write(gb, cpu_reg.de.reg, cpu_reg.a);
+			inst_cycles = 8;
+			break;
+
+		case GB_FUSED_DEC_B_JR_NZ:
+			PGB_INSTR_DEC_R8(cpu_reg.bc.bytes.b);
+			gb->counter.cycles += inst_cycles;
+			inst_cycles = 8;
+
+			if(!PGB_FLAG_Z())
+			{
+				cpu_reg.pc.reg += (int8_t)imm;
+				inst_cycles += 4;
+			}
+
+			break;
+
+		case GB_FUSED_DEC_C_JR_NZ:
+			PGB_INSTR_DEC_R8(cpu_reg.bc.bytes.c);
+			gb->counter.cycles += inst_cycles;
+			inst_cycles = 8;
+
+			if(!PGB_FLAG_Z())
+			{
+				cpu_reg.pc.reg += (int8_t)imm;
+				inst_cycles += 4;
+			}
+
+			break;
+
+		case GB_FUSED_OR_C_JR_NZ:
+			PGB_INSTR_OR_R8(cpu_reg.bc.bytes.c);
+			gb->counter.cycles += inst_cycles;
+			inst_cycles = 8;
+
+			if(!PGB_FLAG_Z())
+			{
+				cpu_reg.pc.reg += (int8_t)imm;
+				inst_cycles += 4;
+			}
+
+			break;
+
+		case GB_FUSED_CP_JR_Z:
 		{
-			gb->cpu_reg.pc.reg = TIMER_INTR_ADDR;
-			gb->hram_io[IO_IF] ^= TIMER_INTR;
+			uint8_t val = inst->imm;
+			PGB_INSTR_CP_R8(val);
+			gb->counter.cycles += inst_cycles;
+			inst_cycles = 8;
+
+			if(PGB_FLAG_Z())
+			{
+				cpu_reg.pc.reg += (int8_t)imm;
+				inst_cycles += 4;
+			}
+
+			break;
 		}
-		else if(gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & SERIAL_INTR)
+
+		case GB_FUSED_CP_JR_NZ:
 		{
-			gb->cpu_reg.pc.reg = SERIAL_INTR_ADDR;
-			gb->hram_io[IO_IF] ^= SERIAL_INTR;
+			uint8_t val = inst->imm;
+			PGB_INSTR_CP_R8(val);
+			gb->counter.cycles += inst_cycles;
+			inst_cycles = 8;
+
+			if(!PGB_FLAG_Z())
+			{
+				cpu_reg.pc.reg += (int8_t)imm;
+				inst_cycles += 4;
+			}
+
+			break;
 		}
-		else if(gb->hram_io[IO_IF] & gb->hram_io[IO_IE] & CONTROL_INTR)
-		{
-			gb->cpu_reg.pc.reg = CONTROL_INTR_ADDR;
-			gb->hram_io[IO_IF] ^= CONTROL_INTR;
 		}
-
-		break;
 	}
-
-	/* Obtain opcode */
-	opcode = __gb_read(gb, gb->cpu_reg.pc.reg++);
-	inst_cycles = op_cycles[opcode];
-
+	else
+#endif
+#endif /* PEANUT_GB_USE_MUSTTAIL */
 	/* Execute opcode */
-	switch(opcode)
+	PGB_OPCODE_SWITCH(opcode)
 	{
-	case 0x00: /* NOP */
+	PGB_OPCODE(0x00): /* NOP */
 		break;
 
-	case 0x01: /* LD BC, imm */
-		gb->cpu_reg.bc.bytes.c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.bc.bytes.b = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x01): /* LD BC, imm */
+		cpu_reg.bc.reg = imm;
 		break;
 
-	case 0x02: /* LD (BC), A */
-		__gb_write(gb, gb->cpu_reg.bc.reg, gb->cpu_reg.a);
+	PGB_OPCODE(0x02): /* LD (BC), A */
+		__gb_write(gb, cpu_reg.bc.reg, cpu_reg.a);
 		break;
 
-	case 0x03: /* INC BC */
-		gb->cpu_reg.bc.reg++;
+	PGB_OPCODE(0x03): /* INC BC */
+		cpu_reg.bc.reg++;
 		break;
 
-	case 0x04: /* INC B */
-		PGB_INSTR_INC_R8(gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0x04): /* INC B */
+		PGB_INSTR_INC_R8(cpu_reg.bc.bytes.b);
 		break;
 
-	case 0x05: /* DEC B */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0x05): /* DEC B */
+		PGB_INSTR_DEC_R8(cpu_reg.bc.bytes.b);
 		break;
 
-	case 0x06: /* LD B, imm */
-		gb->cpu_reg.bc.bytes.b = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x06): /* LD B, imm */
+		cpu_reg.bc.bytes.b = imm;
 		break;
 
-	case 0x07: /* RLCA */
-		gb->cpu_reg.a = (gb->cpu_reg.a << 1) | (gb->cpu_reg.a >> 7);
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.c = (gb->cpu_reg.a & 0x01);
+	PGB_OPCODE(0x07): /* RLCA */
+		cpu_reg.a = (cpu_reg.a << 1) | (cpu_reg.a >> 7);
+		PGB_CLEAR_FLAGS();
+		PGB_SET_FLAG_C(cpu_reg.a & 0x01);
 		break;
 
-	case 0x08: /* LD (imm), SP */
+	PGB_OPCODE(0x08): /* LD (imm), SP */
 	{
-		uint8_t h, l;
-		uint16_t temp;
-		l = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		h = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		temp = PEANUT_GB_U8_TO_U16(h,l);
-		__gb_write(gb, temp++, gb->cpu_reg.sp.bytes.p);
-		__gb_write(gb, temp, gb->cpu_reg.sp.bytes.s);
+		uint16_t temp = imm;
+		__gb_write(gb, temp++, cpu_reg.sp.bytes.p);
+		__gb_write(gb, temp, cpu_reg.sp.bytes.s);
 		break;
 	}
 
-	case 0x09: /* ADD HL, BC */
+	PGB_OPCODE(0x09): /* ADD HL, BC */
 	{
-		uint_fast32_t temp = gb->cpu_reg.hl.reg + gb->cpu_reg.bc.reg;
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h =
-			(temp ^ gb->cpu_reg.hl.reg ^ gb->cpu_reg.bc.reg) & 0x1000 ? 1 : 0;
-		gb->cpu_reg.f.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
-		gb->cpu_reg.hl.reg = (temp & 0x0000FFFF);
+		uint_fast32_t temp = cpu_reg.hl.reg + cpu_reg.bc.reg;
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H((temp ^ cpu_reg.hl.reg ^ cpu_reg.bc.reg) & 0x1000 ? 1 : 0);
+		PGB_SET_FLAG_C((temp & 0xFFFF0000) ? 1 : 0);
+		cpu_reg.hl.reg = (temp & 0x0000FFFF);
 		break;
 	}
 
-	case 0x0A: /* LD A, (BC) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.bc.reg);
+	PGB_OPCODE(0x0A): /* LD A, (BC) */
+		cpu_reg.a = __gb_read(gb, cpu_reg.bc.reg);
 		break;
 
-	case 0x0B: /* DEC BC */
-		gb->cpu_reg.bc.reg--;
+	PGB_OPCODE(0x0B): /* DEC BC */
+		cpu_reg.bc.reg--;
 		break;
 
-	case 0x0C: /* INC C */
-		PGB_INSTR_INC_R8(gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0x0C): /* INC C */
+		PGB_INSTR_INC_R8(cpu_reg.bc.bytes.c);
 		break;
 
-	case 0x0D: /* DEC C */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0x0D): /* DEC C */
+		PGB_INSTR_DEC_R8(cpu_reg.bc.bytes.c);
 		break;
 
-	case 0x0E: /* LD C, imm */
-		gb->cpu_reg.bc.bytes.c = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x0E): /* LD C, imm */
+		cpu_reg.bc.bytes.c = imm;
 		break;
 
-	case 0x0F: /* RRCA */
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.c = gb->cpu_reg.a & 0x01;
-		gb->cpu_reg.a = (gb->cpu_reg.a >> 1) | (gb->cpu_reg.a << 7);
+	PGB_OPCODE(0x0F): /* RRCA */
+		PGB_CLEAR_FLAGS();
+		PGB_SET_FLAG_C(cpu_reg.a & 0x01);
+		cpu_reg.a = (cpu_reg.a >> 1) | (cpu_reg.a << 7);
 		break;
 
-	case 0x10: /* STOP */
+	PGB_OPCODE(0x10): /* STOP */
 		//gb->gb_halt = true;
 		break;
 
-	case 0x11: /* LD DE, imm */
-		gb->cpu_reg.de.bytes.e = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.de.bytes.d = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x11): /* LD DE, imm */
+		cpu_reg.de.reg = imm;
 		break;
 
-	case 0x12: /* LD (DE), A */
-		__gb_write(gb, gb->cpu_reg.de.reg, gb->cpu_reg.a);
+	PGB_OPCODE(0x12): /* LD (DE), A */
+		__gb_write(gb, cpu_reg.de.reg, cpu_reg.a);
 		break;
 
-	case 0x13: /* INC DE */
-		gb->cpu_reg.de.reg++;
+	PGB_OPCODE(0x13): /* INC DE */
+		cpu_reg.de.reg++;
 		break;
 
-	case 0x14: /* INC D */
-		PGB_INSTR_INC_R8(gb->cpu_reg.de.bytes.d);
+	PGB_OPCODE(0x14): /* INC D */
+		PGB_INSTR_INC_R8(cpu_reg.de.bytes.d);
 		break;
 
-	case 0x15: /* DEC D */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.de.bytes.d);
+	PGB_OPCODE(0x15): /* DEC D */
+		PGB_INSTR_DEC_R8(cpu_reg.de.bytes.d);
 		break;
 
-	case 0x16: /* LD D, imm */
-		gb->cpu_reg.de.bytes.d = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x16): /* LD D, imm */
+		cpu_reg.de.bytes.d = imm;
 		break;
 
-	case 0x17: /* RLA */
+	PGB_OPCODE(0x17): /* RLA */
 	{
-		uint8_t temp = gb->cpu_reg.a;
-		gb->cpu_reg.a = (gb->cpu_reg.a << 1) | gb->cpu_reg.f.f_bits.c;
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.c = (temp >> 7) & 0x01;
+		uint8_t temp = cpu_reg.a;
+		cpu_reg.a = (cpu_reg.a << 1) | PGB_FLAG_C();
+		PGB_CLEAR_FLAGS();
+		PGB_SET_FLAG_C((temp >> 7) & 0x01);
 		break;
 	}
 
-	case 0x18: /* JR imm */
+	PGB_OPCODE(0x18): /* JR imm */
 	{
-		int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.pc.reg += temp;
+		int8_t temp = (int8_t) imm;
+		cpu_reg.pc.reg += temp;
 		break;
 	}
 
-	case 0x19: /* ADD HL, DE */
+	PGB_OPCODE(0x19): /* ADD HL, DE */
 	{
-		uint_fast32_t temp = gb->cpu_reg.hl.reg + gb->cpu_reg.de.reg;
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h =
-			(temp ^ gb->cpu_reg.hl.reg ^ gb->cpu_reg.de.reg) & 0x1000 ? 1 : 0;
-		gb->cpu_reg.f.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
-		gb->cpu_reg.hl.reg = (temp & 0x0000FFFF);
+		uint_fast32_t temp = cpu_reg.hl.reg + cpu_reg.de.reg;
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H((temp ^ cpu_reg.hl.reg ^ cpu_reg.de.reg) & 0x1000 ? 1 : 0);
+		PGB_SET_FLAG_C((temp & 0xFFFF0000) ? 1 : 0);
+		cpu_reg.hl.reg = (temp & 0x0000FFFF);
 		break;
 	}
 
-	case 0x1A: /* LD A, (DE) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.de.reg);
+	PGB_OPCODE(0x1A): /* LD A, (DE) */
+		cpu_reg.a = __gb_read(gb, cpu_reg.de.reg);
 		break;
 
-	case 0x1B: /* DEC DE */
-		gb->cpu_reg.de.reg--;
+	PGB_OPCODE(0x1B): /* DEC DE */
+		cpu_reg.de.reg--;
 		break;
 
-	case 0x1C: /* INC E */
-		PGB_INSTR_INC_R8(gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0x1C): /* INC E */
+		PGB_INSTR_INC_R8(cpu_reg.de.bytes.e);
 		break;
 
-	case 0x1D: /* DEC E */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0x1D): /* DEC E */
+		PGB_INSTR_DEC_R8(cpu_reg.de.bytes.e);
 		break;
 
-	case 0x1E: /* LD E, imm */
-		gb->cpu_reg.de.bytes.e = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x1E): /* LD E, imm */
+		cpu_reg.de.bytes.e = imm;
 		break;
 
-	case 0x1F: /* RRA */
+	PGB_OPCODE(0x1F): /* RRA */
 	{
-		uint8_t temp = gb->cpu_reg.a;
-		gb->cpu_reg.a = gb->cpu_reg.a >> 1 | (gb->cpu_reg.f.f_bits.c << 7);
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.c = temp & 0x1;
+		uint8_t temp = cpu_reg.a;
+		cpu_reg.a = cpu_reg.a >> 1 | (PGB_FLAG_C() << 7);
+		PGB_CLEAR_FLAGS();
+		PGB_SET_FLAG_C(temp & 0x1);
 		break;
 	}
 
-	case 0x20: /* JR NZ, imm */
-		if(!gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0x20): /* JR NZ, imm */
+		if(!PGB_FLAG_Z())
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-			gb->cpu_reg.pc.reg += temp;
+			int8_t temp = (int8_t) imm;
+			cpu_reg.pc.reg += temp;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg++;
 
 		break;
 
-	case 0x21: /* LD HL, imm */
-		gb->cpu_reg.hl.bytes.l = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.hl.bytes.h = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x21): /* LD HL, imm */
+		cpu_reg.hl.reg = imm;
 		break;
 
-	case 0x22: /* LDI (HL), A */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.a);
-		gb->cpu_reg.hl.reg++;
+	PGB_OPCODE(0x22): /* LDI (HL), A */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.a);
+		cpu_reg.hl.reg++;
 		break;
 
-	case 0x23: /* INC HL */
-		gb->cpu_reg.hl.reg++;
+	PGB_OPCODE(0x23): /* INC HL */
+		cpu_reg.hl.reg++;
 		break;
 
-	case 0x24: /* INC H */
-		PGB_INSTR_INC_R8(gb->cpu_reg.hl.bytes.h);
+	PGB_OPCODE(0x24): /* INC H */
+		PGB_INSTR_INC_R8(cpu_reg.hl.bytes.h);
 		break;
 
-	case 0x25: /* DEC H */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.hl.bytes.h);
+	PGB_OPCODE(0x25): /* DEC H */
+		PGB_INSTR_DEC_R8(cpu_reg.hl.bytes.h);
 		break;
 
-	case 0x26: /* LD H, imm */
-		gb->cpu_reg.hl.bytes.h = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x26): /* LD H, imm */
+		cpu_reg.hl.bytes.h = imm;
 		break;
 
-	case 0x27: /* DAA */
-	{
-		/* The following is from SameBoy. MIT License. */
-		int16_t a = gb->cpu_reg.a;
-
-		if(gb->cpu_reg.f.f_bits.n)
-		{
-			if(gb->cpu_reg.f.f_bits.h)
-				a = (a - 0x06) & 0xFF;
-
-			if(gb->cpu_reg.f.f_bits.c)
-				a -= 0x60;
-		}
-		else
-		{
-			if(gb->cpu_reg.f.f_bits.h || (a & 0x0F) > 9)
-				a += 0x06;
-
-			if(gb->cpu_reg.f.f_bits.c || a > 0x9F)
-				a += 0x60;
-		}
-
-		if((a & 0x100) == 0x100)
-			gb->cpu_reg.f.f_bits.c = 1;
-
-		gb->cpu_reg.a = a;
-		gb->cpu_reg.f.f_bits.z = (gb->cpu_reg.a == 0);
-		gb->cpu_reg.f.f_bits.h = 0;
-
+	PGB_OPCODE(0x27): /* DAA */
+		gb->cpu_reg = cpu_reg;
+		__gb_daa(gb);
+		cpu_reg = gb->cpu_reg;
 		break;
-	}
 
-	case 0x28: /* JR Z, imm */
-		if(gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0x28): /* JR Z, imm */
+		if(PGB_FLAG_Z())
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-			gb->cpu_reg.pc.reg += temp;
+			int8_t temp = (int8_t) imm;
+			cpu_reg.pc.reg += temp;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg++;
 
 		break;
 
-	case 0x29: /* ADD HL, HL */
+	PGB_OPCODE(0x29): /* ADD HL, HL */
 	{
-		gb->cpu_reg.f.f_bits.c = (gb->cpu_reg.hl.reg & 0x8000) > 0;
-		gb->cpu_reg.hl.reg <<= 1;
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h = (gb->cpu_reg.hl.reg & 0x1000) > 0;
+		PGB_SET_FLAG_C((cpu_reg.hl.reg & 0x8000) > 0);
+		cpu_reg.hl.reg <<= 1;
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H((cpu_reg.hl.reg & 0x1000) > 0);
 		break;
 	}
 
-	case 0x2A: /* LD A, (HL+) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl.reg++);
+	PGB_OPCODE(0x2A): /* LD A, (HL+) */
+		cpu_reg.a = __gb_read(gb, cpu_reg.hl.reg++);
 		break;
 
-	case 0x2B: /* DEC HL */
-		gb->cpu_reg.hl.reg--;
+	PGB_OPCODE(0x2B): /* DEC HL */
+		cpu_reg.hl.reg--;
 		break;
 
-	case 0x2C: /* INC L */
-		PGB_INSTR_INC_R8(gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0x2C): /* INC L */
+		PGB_INSTR_INC_R8(cpu_reg.hl.bytes.l);
 		break;
 
-	case 0x2D: /* DEC L */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0x2D): /* DEC L */
+		PGB_INSTR_DEC_R8(cpu_reg.hl.bytes.l);
 		break;
 
-	case 0x2E: /* LD L, imm */
-		gb->cpu_reg.hl.bytes.l = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x2E): /* LD L, imm */
+		cpu_reg.hl.bytes.l = imm;
 		break;
 
-	case 0x2F: /* CPL */
-		gb->cpu_reg.a = ~gb->cpu_reg.a;
-		gb->cpu_reg.f.f_bits.n = 1;
-		gb->cpu_reg.f.f_bits.h = 1;
+	PGB_OPCODE(0x2F): /* CPL */
+		cpu_reg.a = ~cpu_reg.a;
+		PGB_SET_FLAG_N(1);
+		PGB_SET_FLAG_H(1);
 		break;
 
-	case 0x30: /* JR NC, imm */
-		if(!gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0x30): /* JR NC, imm */
+		if(!PGB_FLAG_C())
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-			gb->cpu_reg.pc.reg += temp;
+			int8_t temp = (int8_t) imm;
+			cpu_reg.pc.reg += temp;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg++;
 
 		break;
 
-	case 0x31: /* LD SP, imm */
-		gb->cpu_reg.sp.bytes.p = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.sp.bytes.s = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x31): /* LD SP, imm */
+		cpu_reg.sp.reg = imm;
 		break;
 
-	case 0x32: /* LD (HL), A */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.a);
-		gb->cpu_reg.hl.reg--;
+	PGB_OPCODE(0x32): /* LD (HL), A */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.a);
+		cpu_reg.hl.reg--;
 		break;
 
-	case 0x33: /* INC SP */
-		gb->cpu_reg.sp.reg++;
+	PGB_OPCODE(0x33): /* INC SP */
+		cpu_reg.sp.reg++;
 		break;
 
-	case 0x34: /* INC (HL) */
+	PGB_OPCODE(0x34): /* INC (HL) */
 	{
-		uint8_t temp = __gb_read(gb, gb->cpu_reg.hl.reg);
+		uint8_t temp = __gb_read(gb, cpu_reg.hl.reg);
 		PGB_INSTR_INC_R8(temp);
-		__gb_write(gb, gb->cpu_reg.hl.reg, temp);
+		__gb_write(gb, cpu_reg.hl.reg, temp);
 		break;
 	}
 
-	case 0x35: /* DEC (HL) */
+	PGB_OPCODE(0x35): /* DEC (HL) */
 	{
-		uint8_t temp = __gb_read(gb, gb->cpu_reg.hl.reg);
+		uint8_t temp = __gb_read(gb, cpu_reg.hl.reg);
 		PGB_INSTR_DEC_R8(temp);
-		__gb_write(gb, gb->cpu_reg.hl.reg, temp);
+		__gb_write(gb, cpu_reg.hl.reg, temp);
 		break;
 	}
 
-	case 0x36: /* LD (HL), imm */
-		__gb_write(gb, gb->cpu_reg.hl.reg, __gb_read(gb, gb->cpu_reg.pc.reg++));
+	PGB_OPCODE(0x36): /* LD (HL), imm */
+		__gb_write(gb, cpu_reg.hl.reg, imm);
 		break;
 
-	case 0x37: /* SCF */
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h = 0;
-		gb->cpu_reg.f.f_bits.c = 1;
+	PGB_OPCODE(0x37): /* SCF */
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H(0);
+		PGB_SET_FLAG_C(1);
 		break;
 
-	case 0x38: /* JR C, imm */
-		if(gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0x38): /* JR C, imm */
+		if(PGB_FLAG_C())
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-			gb->cpu_reg.pc.reg += temp;
+			int8_t temp = (int8_t) imm;
+			cpu_reg.pc.reg += temp;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg++;
 
 		break;
 
-	case 0x39: /* ADD HL, SP */
+	PGB_OPCODE(0x39): /* ADD HL, SP */
 	{
-		uint_fast32_t temp = gb->cpu_reg.hl.reg + gb->cpu_reg.sp.reg;
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h =
-			((gb->cpu_reg.hl.reg & 0xFFF) + (gb->cpu_reg.sp.reg & 0xFFF)) & 0x1000 ? 1 : 0;
-		gb->cpu_reg.f.f_bits.c = temp & 0x10000 ? 1 : 0;
-		gb->cpu_reg.hl.reg = (uint16_t)temp;
+		uint_fast32_t temp = cpu_reg.hl.reg + cpu_reg.sp.reg;
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H(((cpu_reg.hl.reg & 0xFFF) + (cpu_reg.sp.reg & 0xFFF)) & 0x1000 ? 1 : 0);
+		PGB_SET_FLAG_C(temp & 0x10000 ? 1 : 0);
+		cpu_reg.hl.reg = (uint16_t)temp;
 		break;
 	}
 
-	case 0x3A: /* LD A, (HL) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl.reg--);
-		break;
-
-	case 0x3B: /* DEC SP */
-		gb->cpu_reg.sp.reg--;
-		break;
-
-	case 0x3C: /* INC A */
-		PGB_INSTR_INC_R8(gb->cpu_reg.a);
-		break;
-
-	case 0x3D: /* DEC A */
-		PGB_INSTR_DEC_R8(gb->cpu_reg.a);
+	PGB_OPCODE(0x3A): /* LD A, (HL) */
+		cpu_reg.a = __gb_read(gb, cpu_reg.hl.reg--);
 		break;
 
-	case 0x3E: /* LD A, imm */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.pc.reg++);
+	PGB_OPCODE(0x3B): /* DEC SP */
+		cpu_reg.sp.reg--;
 		break;
 
-	case 0x3F: /* CCF */
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h = 0;
-		gb->cpu_reg.f.f_bits.c = ~gb->cpu_reg.f.f_bits.c;
+	PGB_OPCODE(0x3C): /* INC A */
+		PGB_INSTR_INC_R8(cpu_reg.a);
 		break;
 
-	case 0x40: /* LD B, B */
+	PGB_OPCODE(0x3D): /* DEC A */
+		PGB_INSTR_DEC_R8(cpu_reg.a);
 		break;
 
-	case 0x41: /* LD B, C */
-		gb->cpu_reg.bc.bytes.b = gb->cpu_reg.bc.bytes.c;
+	PGB_OPCODE(0x3E): /* LD A, imm */
+		cpu_reg.a = imm;
 		break;
 
-	case 0x42: /* LD B, D */
-		gb->cpu_reg.bc.bytes.b = gb->cpu_reg.de.bytes.d;
+	PGB_OPCODE(0x3F): /* CCF */
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H(0);
+		PGB_SET_FLAG_C(!PGB_FLAG_C());
 		break;
 
-	case 0x43: /* LD B, E */
-		gb->cpu_reg.bc.bytes.b = gb->cpu_reg.de.bytes.e;
+	PGB_OPCODE(0x40): /* LD B, B */
 		break;
 
-	case 0x44: /* LD B, H */
-		gb->cpu_reg.bc.bytes.b = gb->cpu_reg.hl.bytes.h;
+	PGB_OPCODE(0x41): /* LD B, C */
+		cpu_reg.bc.bytes.b = cpu_reg.bc.bytes.c;
 		break;
 
-	case 0x45: /* LD B, L */
-		gb->cpu_reg.bc.bytes.b = gb->cpu_reg.hl.bytes.l;
+	PGB_OPCODE(0x42): /* LD B, D */
+		cpu_reg.bc.bytes.b = cpu_reg.de.bytes.d;
 		break;
 
-	case 0x46: /* LD B, (HL) */
-		gb->cpu_reg.bc.bytes.b = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x43): /* LD B, E */
+		cpu_reg.bc.bytes.b = cpu_reg.de.bytes.e;
 		break;
 
-	case 0x47: /* LD B, A */
-		gb->cpu_reg.bc.bytes.b = gb->cpu_reg.a;
+	PGB_OPCODE(0x44): /* LD B, H */
+		cpu_reg.bc.bytes.b = cpu_reg.hl.bytes.h;
 		break;
 
-	case 0x48: /* LD C, B */
-		gb->cpu_reg.bc.bytes.c = gb->cpu_reg.bc.bytes.b;
+	PGB_OPCODE(0x45): /* LD B, L */
+		cpu_reg.bc.bytes.b = cpu_reg.hl.bytes.l;
 		break;
 
-	case 0x49: /* LD C, C */
+	PGB_OPCODE(0x46): /* LD B, (HL) */
+		cpu_reg.bc.bytes.b = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x4A: /* LD C, D */
-		gb->cpu_reg.bc.bytes.c = gb->cpu_reg.de.bytes.d;
+	PGB_OPCODE(0x47): /* LD B, A */
+		cpu_reg.bc.bytes.b = cpu_reg.a;
 		break;
 
-	case 0x4B: /* LD C, E */
-		gb->cpu_reg.bc.bytes.c = gb->cpu_reg.de.bytes.e;
+	PGB_OPCODE(0x48): /* LD C, B */
+		cpu_reg.bc.bytes.c = cpu_reg.bc.bytes.b;
 		break;
 
-	case 0x4C: /* LD C, H */
-		gb->cpu_reg.bc.bytes.c = gb->cpu_reg.hl.bytes.h;
+	PGB_OPCODE(0x49): /* LD C, C */
 		break;
 
-	case 0x4D: /* LD C, L */
-		gb->cpu_reg.bc.bytes.c = gb->cpu_reg.hl.bytes.l;
+	PGB_OPCODE(0x4A): /* LD C, D */
+		cpu_reg.bc.bytes.c = cpu_reg.de.bytes.d;
 		break;
 
-	case 0x4E: /* LD C, (HL) */
-		gb->cpu_reg.bc.bytes.c = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x4B): /* LD C, E */
+		cpu_reg.bc.bytes.c = cpu_reg.de.bytes.e;
 		break;
 
-	case 0x4F: /* LD C, A */
-		gb->cpu_reg.bc.bytes.c = gb->cpu_reg.a;
+	PGB_OPCODE(0x4C): /* LD C, H */
+		cpu_reg.bc.bytes.c = cpu_reg.hl.bytes.h;
 		break;
 
-	case 0x50: /* LD D, B */
-		gb->cpu_reg.de.bytes.d = gb->cpu_reg.bc.bytes.b;
+	PGB_OPCODE(0x4D): /* LD C, L */
+		cpu_reg.bc.bytes.c = cpu_reg.hl.bytes.l;
 		break;
 
-	case 0x51: /* LD D, C */
-		gb->cpu_reg.de.bytes.d = gb->cpu_reg.bc.bytes.c;
+	PGB_OPCODE(0x4E): /* LD C, (HL) */
+		cpu_reg.bc.bytes.c = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x52: /* LD D, D */
+	PGB_OPCODE(0x4F): /* LD C, A */
+		cpu_reg.bc.bytes.c = cpu_reg.a;
 		break;
 
-	case 0x53: /* LD D, E */
-		gb->cpu_reg.de.bytes.d = gb->cpu_reg.de.bytes.e;
+	PGB_OPCODE(0x50): /* LD D, B */
+		cpu_reg.de.bytes.d = cpu_reg.bc.bytes.b;
 		break;
 
-	case 0x54: /* LD D, H */
-		gb->cpu_reg.de.bytes.d = gb->cpu_reg.hl.bytes.h;
+	PGB_OPCODE(0x51): /* LD D, C */
+		cpu_reg.de.bytes.d = cpu_reg.bc.bytes.c;
 		break;
 
-	case 0x55: /* LD D, L */
-		gb->cpu_reg.de.bytes.d = gb->cpu_reg.hl.bytes.l;
+	PGB_OPCODE(0x52): /* LD D, D */
 		break;
 
-	case 0x56: /* LD D, (HL) */
-		gb->cpu_reg.de.bytes.d = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x53): /* LD D, E */
+		cpu_reg.de.bytes.d = cpu_reg.de.bytes.e;
 		break;
 
-	case 0x57: /* LD D, A */
-		gb->cpu_reg.de.bytes.d = gb->cpu_reg.a;
+	PGB_OPCODE(0x54): /* LD D, H */
+		cpu_reg.de.bytes.d = cpu_reg.hl.bytes.h;
 		break;
 
-	case 0x58: /* LD E, B */
-		gb->cpu_reg.de.bytes.e = gb->cpu_reg.bc.bytes.b;
+	PGB_OPCODE(0x55): /* LD D, L */
+		cpu_reg.de.bytes.d = cpu_reg.hl.bytes.l;
 		break;
 
-	case 0x59: /* LD E, C */
-		gb->cpu_reg.de.bytes.e = gb->cpu_reg.bc.bytes.c;
+	PGB_OPCODE(0x56): /* LD D, (HL) */
+		cpu_reg.de.bytes.d = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x5A: /* LD E, D */
-		gb->cpu_reg.de.bytes.e = gb->cpu_reg.de.bytes.d;
+	PGB_OPCODE(0x57): /* LD D, A */
+		cpu_reg.de.bytes.d = cpu_reg.a;
 		break;
 
-	case 0x5B: /* LD E, E */
+	PGB_OPCODE(0x58): /* LD E, B */
+		cpu_reg.de.bytes.e = cpu_reg.bc.bytes.b;
 		break;
 
-	case 0x5C: /* LD E, H */
-		gb->cpu_reg.de.bytes.e = gb->cpu_reg.hl.bytes.h;
+	PGB_OPCODE(0x59): /* LD E, C */
+		cpu_reg.de.bytes.e = cpu_reg.bc.bytes.c;
 		break;
 
-	case 0x5D: /* LD E, L */
-		gb->cpu_reg.de.bytes.e = gb->cpu_reg.hl.bytes.l;
+	PGB_OPCODE(0x5A): /* LD E, D */
+		cpu_reg.de.bytes.e = cpu_reg.de.bytes.d;
 		break;
 
-	case 0x5E: /* LD E, (HL) */
-		gb->cpu_reg.de.bytes.e = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x5B): /* LD E, E */
 		break;
 
-	case 0x5F: /* LD E, A */
-		gb->cpu_reg.de.bytes.e = gb->cpu_reg.a;
+	PGB_OPCODE(0x5C): /* LD E, H */
+		cpu_reg.de.bytes.e = cpu_reg.hl.bytes.h;
 		break;
 
-	case 0x60: /* LD H, B */
-		gb->cpu_reg.hl.bytes.h = gb->cpu_reg.bc.bytes.b;
+	PGB_OPCODE(0x5D): /* LD E, L */
+		cpu_reg.de.bytes.e = cpu_reg.hl.bytes.l;
 		break;
 
-	case 0x61: /* LD H, C */
-		gb->cpu_reg.hl.bytes.h = gb->cpu_reg.bc.bytes.c;
+	PGB_OPCODE(0x5E): /* LD E, (HL) */
+		cpu_reg.de.bytes.e = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x62: /* LD H, D */
-		gb->cpu_reg.hl.bytes.h = gb->cpu_reg.de.bytes.d;
+	PGB_OPCODE(0x5F): /* LD E, A */
+		cpu_reg.de.bytes.e = cpu_reg.a;
 		break;
 
-	case 0x63: /* LD H, E */
-		gb->cpu_reg.hl.bytes.h = gb->cpu_reg.de.bytes.e;
+	PGB_OPCODE(0x60): /* LD H, B */
+		cpu_reg.hl.bytes.h = cpu_reg.bc.bytes.b;
 		break;
 
-	case 0x64: /* LD H, H */
+	PGB_OPCODE(0x61): /* LD H, C */
+		cpu_reg.hl.bytes.h = cpu_reg.bc.bytes.c;
 		break;
 
-	case 0x65: /* LD H, L */
-		gb->cpu_reg.hl.bytes.h = gb->cpu_reg.hl.bytes.l;
+	PGB_OPCODE(0x62): /* LD H, D */
+		cpu_reg.hl.bytes.h = cpu_reg.de.bytes.d;
 		break;
 
-	case 0x66: /* LD H, (HL) */
-		gb->cpu_reg.hl.bytes.h = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x63): /* LD H, E */
+		cpu_reg.hl.bytes.h = cpu_reg.de.bytes.e;
 		break;
 
-	case 0x67: /* LD H, A */
-		gb->cpu_reg.hl.bytes.h = gb->cpu_reg.a;
+	PGB_OPCODE(0x64): /* LD H, H */
 		break;
 
-	case 0x68: /* LD L, B */
-		gb->cpu_reg.hl.bytes.l = gb->cpu_reg.bc.bytes.b;
+	PGB_OPCODE(0x65): /* LD H, L */
+		cpu_reg.hl.bytes.h = cpu_reg.hl.bytes.l;
 		break;
 
-	case 0x69: /* LD L, C */
-		gb->cpu_reg.hl.bytes.l = gb->cpu_reg.bc.bytes.c;
+	PGB_OPCODE(0x66): /* LD H, (HL) */
+		cpu_reg.hl.bytes.h = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x6A: /* LD L, D */
-		gb->cpu_reg.hl.bytes.l = gb->cpu_reg.de.bytes.d;
+	PGB_OPCODE(0x67): /* LD H, A */
+		cpu_reg.hl.bytes.h = cpu_reg.a;
 		break;
 
-	case 0x6B: /* LD L, E */
-		gb->cpu_reg.hl.bytes.l = gb->cpu_reg.de.bytes.e;
+	PGB_OPCODE(0x68): /* LD L, B */
+		cpu_reg.hl.bytes.l = cpu_reg.bc.bytes.b;
 		break;
 
-	case 0x6C: /* LD L, H */
-		gb->cpu_reg.hl.bytes.l = gb->cpu_reg.hl.bytes.h;
+	PGB_OPCODE(0x69): /* LD L, C */
+		cpu_reg.hl.bytes.l = cpu_reg.bc.bytes.c;
 		break;
 
-	case 0x6D: /* LD L, L */
+	PGB_OPCODE(0x6A): /* LD L, D */
+		cpu_reg.hl.bytes.l = cpu_reg.de.bytes.d;
 		break;
 
-	case 0x6E: /* LD L, (HL) */
-		gb->cpu_reg.hl.bytes.l = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x6B): /* LD L, E */
+		cpu_reg.hl.bytes.l = cpu_reg.de.bytes.e;
 		break;
 
-	case 0x6F: /* LD L, A */
-		gb->cpu_reg.hl.bytes.l = gb->cpu_reg.a;
+	PGB_OPCODE(0x6C): /* LD L, H */
+		cpu_reg.hl.bytes.l = cpu_reg.hl.bytes.h;
 		break;
 
-	case 0x70: /* LD (HL), B */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0x6D): /* LD L, L */
 		break;
 
-	case 0x71: /* LD (HL), C */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0x6E): /* LD L, (HL) */
+		cpu_reg.hl.bytes.l = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x72: /* LD (HL), D */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.de.bytes.d);
-		break;
-
-	case 0x73: /* LD (HL), E */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.de.bytes.e);
-		break;
-
-	case 0x74: /* LD (HL), H */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.hl.bytes.h);
-		break;
-
-	case 0x75: /* LD (HL), L */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.hl.bytes.l);
-		break;
-
-	case 0x76: /* HALT */
-	{
-		int_fast16_t halt_cycles = INT_FAST16_MAX;
-
-		/* TODO: Emulate HALT bug? */
-		gb->gb_halt = true;
-
-		if (gb->hram_io[IO_IE] == 0)
-		{
-			/* Return program counter where this halt forever state started. */
-			/* This may be intentional, but this is required to stop an infinite
-			 * loop. */
-			(gb->gb_error)(gb, GB_HALT_FOREVER, gb->cpu_reg.pc.reg - 1);
-			PGB_UNREACHABLE();
-		}
-
-		if(gb->hram_io[IO_SC] & SERIAL_SC_TX_START)
-		{
-			int serial_cycles = SERIAL_CYCLES -
-				gb->counter.serial_count;
-
-			if(serial_cycles < halt_cycles)
-				halt_cycles = serial_cycles;
-		}
+	PGB_OPCODE(0x6F): /* LD L, A */
+		cpu_reg.hl.bytes.l = cpu_reg.a;
+		break;
 
-		if(gb->hram_io[IO_TAC] & IO_TAC_ENABLE_MASK)
-		{
-			int tac_cycles = TAC_CYCLES[gb->hram_io[IO_TAC] & IO_TAC_RATE_MASK] -
-				gb->counter.tima_count;
+	PGB_OPCODE(0x70): /* LD (HL), B */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.bc.bytes.b);
+		break;
 
-			if(tac_cycles < halt_cycles)
-				halt_cycles = tac_cycles;
-		}
+	PGB_OPCODE(0x71): /* LD (HL), C */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.bc.bytes.c);
+		break;
 
-		if((gb->hram_io[IO_LCDC] & LCDC_ENABLE))
-		{
-			int lcd_cycles;
+	PGB_OPCODE(0x72): /* LD (HL), D */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.de.bytes.d);
+		break;
 
-			/* If LCD is in HBlank, calculate the number of cycles
-			 * until the end of HBlank and the start of mode 2 or
-			 * mode 1. */
-			if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_HBLANK)
-			{
-				lcd_cycles = LCD_MODE_2_CYCLES -
-					     gb->counter.lcd_count;
-			}
-			else if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_SEARCH_OAM)
-			{
-				lcd_cycles = LCD_MODE_3_CYCLES -
-					gb->counter.lcd_count;
-			}
-			else if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_SEARCH_TRANSFER)
-			{
-				lcd_cycles = LCD_MODE_0_CYCLES -
-					gb->counter.lcd_count;
-			}
-			else
-			{
-				/* VBlank */
-				lcd_cycles =
-					LCD_LINE_CYCLES - gb->counter.lcd_count;
-			}
+	PGB_OPCODE(0x73): /* LD (HL), E */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.de.bytes.e);
+		break;
 
-			if(lcd_cycles < halt_cycles)
-				halt_cycles = lcd_cycles;
-		}
+	PGB_OPCODE(0x74): /* LD (HL), H */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.hl.bytes.h);
+		break;
 
-		/* Some halt cycles may already be very high, so make sure we
-		 * don't underflow here. */
-		if(halt_cycles <= 0)
-			halt_cycles = 4;
+	PGB_OPCODE(0x75): /* LD (HL), L */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.hl.bytes.l);
+		break;
 
-		inst_cycles = (uint_fast16_t)halt_cycles;
+	PGB_OPCODE(0x76): /* HALT */
+		gb->cpu_reg = cpu_reg;
+		inst_cycles = __gb_halt(gb, end);
 		break;
-	}
 
-	case 0x77: /* LD (HL), A */
-		__gb_write(gb, gb->cpu_reg.hl.reg, gb->cpu_reg.a);
+	PGB_OPCODE(0x77): /* LD (HL), A */
+		__gb_write(gb, cpu_reg.hl.reg, cpu_reg.a);
 		break;
 
-	case 0x78: /* LD A, B */
-		gb->cpu_reg.a = gb->cpu_reg.bc.bytes.b;
+	PGB_OPCODE(0x78): /* LD A, B */
+		cpu_reg.a = cpu_reg.bc.bytes.b;
 		break;
 
-	case 0x79: /* LD A, C */
-		gb->cpu_reg.a = gb->cpu_reg.bc.bytes.c;
+	PGB_OPCODE(0x79): /* LD A, C */
+		cpu_reg.a = cpu_reg.bc.bytes.c;
 		break;
 
-	case 0x7A: /* LD A, D */
-		gb->cpu_reg.a = gb->cpu_reg.de.bytes.d;
+	PGB_OPCODE(0x7A): /* LD A, D */
+		cpu_reg.a = cpu_reg.de.bytes.d;
 		break;
 
-	case 0x7B: /* LD A, E */
-		gb->cpu_reg.a = gb->cpu_reg.de.bytes.e;
+	PGB_OPCODE(0x7B): /* LD A, E */
+		cpu_reg.a = cpu_reg.de.bytes.e;
 		break;
 
-	case 0x7C: /* LD A, H */
-		gb->cpu_reg.a = gb->cpu_reg.hl.bytes.h;
+	PGB_OPCODE(0x7C): /* LD A, H */
+		cpu_reg.a = cpu_reg.hl.bytes.h;
 		break;
 
-	case 0x7D: /* LD A, L */
-		gb->cpu_reg.a = gb->cpu_reg.hl.bytes.l;
+	PGB_OPCODE(0x7D): /* LD A, L */
+		cpu_reg.a = cpu_reg.hl.bytes.l;
 		break;
 
-	case 0x7E: /* LD A, (HL) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl.reg);
+	PGB_OPCODE(0x7E): /* LD A, (HL) */
+		cpu_reg.a = __gb_read(gb, cpu_reg.hl.reg);
 		break;
 
-	case 0x7F: /* LD A, A */
+	PGB_OPCODE(0x7F): /* LD A, A */
 		break;
 
-	case 0x80: /* ADD A, B */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.bc.bytes.b, 0);
+	PGB_OPCODE(0x80): /* ADD A, B */
+		PGB_INSTR_ADC_R8(cpu_reg.bc.bytes.b, 0);
 		break;
 
-	case 0x81: /* ADD A, C */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.bc.bytes.c, 0);
+	PGB_OPCODE(0x81): /* ADD A, C */
+		PGB_INSTR_ADC_R8(cpu_reg.bc.bytes.c, 0);
 		break;
 
-	case 0x82: /* ADD A, D */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.de.bytes.d, 0);
+	PGB_OPCODE(0x82): /* ADD A, D */
+		PGB_INSTR_ADC_R8(cpu_reg.de.bytes.d, 0);
 		break;
 
-	case 0x83: /* ADD A, E */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.de.bytes.e, 0);
+	PGB_OPCODE(0x83): /* ADD A, E */
+		PGB_INSTR_ADC_R8(cpu_reg.de.bytes.e, 0);
 		break;
 
-	case 0x84: /* ADD A, H */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.hl.bytes.h, 0);
+	PGB_OPCODE(0x84): /* ADD A, H */
+		PGB_INSTR_ADC_R8(cpu_reg.hl.bytes.h, 0);
 		break;
 
-	case 0x85: /* ADD A, L */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.hl.bytes.l, 0);
+	PGB_OPCODE(0x85): /* ADD A, L */
+		PGB_INSTR_ADC_R8(cpu_reg.hl.bytes.l, 0);
 		break;
 
-	case 0x86: /* ADD A, (HL) */
-		PGB_INSTR_ADC_R8(__gb_read(gb, gb->cpu_reg.hl.reg), 0);
+	PGB_OPCODE(0x86): /* ADD A, (HL) */
+		PGB_INSTR_ADC_R8(__gb_read(gb, cpu_reg.hl.reg), 0);
 		break;
 
-	case 0x87: /* ADD A, A */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.a, 0);
+	PGB_OPCODE(0x87): /* ADD A, A */
+		PGB_INSTR_ADC_R8(cpu_reg.a, 0);
 		break;
 
-	case 0x88: /* ADC A, B */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.bc.bytes.b, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x88): /* ADC A, B */
+		PGB_INSTR_ADC_R8(cpu_reg.bc.bytes.b, PGB_FLAG_C());
 		break;
 
-	case 0x89: /* ADC A, C */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.bc.bytes.c, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x89): /* ADC A, C */
+		PGB_INSTR_ADC_R8(cpu_reg.bc.bytes.c, PGB_FLAG_C());
 		break;
 
-	case 0x8A: /* ADC A, D */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.de.bytes.d, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x8A): /* ADC A, D */
+		PGB_INSTR_ADC_R8(cpu_reg.de.bytes.d, PGB_FLAG_C());
 		break;
 
-	case 0x8B: /* ADC A, E */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.de.bytes.e, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x8B): /* ADC A, E */
+		PGB_INSTR_ADC_R8(cpu_reg.de.bytes.e, PGB_FLAG_C());
 		break;
 
-	case 0x8C: /* ADC A, H */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.hl.bytes.h, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x8C): /* ADC A, H */
+		PGB_INSTR_ADC_R8(cpu_reg.hl.bytes.h, PGB_FLAG_C());
 		break;
 
-	case 0x8D: /* ADC A, L */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.hl.bytes.l, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x8D): /* ADC A, L */
+		PGB_INSTR_ADC_R8(cpu_reg.hl.bytes.l, PGB_FLAG_C());
 		break;
 
-	case 0x8E: /* ADC A, (HL) */
-		PGB_INSTR_ADC_R8(__gb_read(gb, gb->cpu_reg.hl.reg), gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x8E): /* ADC A, (HL) */
+		PGB_INSTR_ADC_R8(__gb_read(gb, cpu_reg.hl.reg), PGB_FLAG_C());
 		break;
 
-	case 0x8F: /* ADC A, A */
-		PGB_INSTR_ADC_R8(gb->cpu_reg.a, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x8F): /* ADC A, A */
+		PGB_INSTR_ADC_R8(cpu_reg.a, PGB_FLAG_C());
 		break;
 
-	case 0x90: /* SUB B */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.bc.bytes.b, 0);
+	PGB_OPCODE(0x90): /* SUB B */
+		PGB_INSTR_SBC_R8(cpu_reg.bc.bytes.b, 0);
 		break;
 
-	case 0x91: /* SUB C */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.bc.bytes.c, 0);
+	PGB_OPCODE(0x91): /* SUB C */
+		PGB_INSTR_SBC_R8(cpu_reg.bc.bytes.c, 0);
 		break;
 
-	case 0x92: /* SUB D */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.de.bytes.d, 0);
+	PGB_OPCODE(0x92): /* SUB D */
+		PGB_INSTR_SBC_R8(cpu_reg.de.bytes.d, 0);
 		break;
 
-	case 0x93: /* SUB E */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.de.bytes.e, 0);
+	PGB_OPCODE(0x93): /* SUB E */
+		PGB_INSTR_SBC_R8(cpu_reg.de.bytes.e, 0);
 		break;
 
-	case 0x94: /* SUB H */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.hl.bytes.h, 0);
+	PGB_OPCODE(0x94): /* SUB H */
+		PGB_INSTR_SBC_R8(cpu_reg.hl.bytes.h, 0);
 		break;
 
-	case 0x95: /* SUB L */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.hl.bytes.l, 0);
+	PGB_OPCODE(0x95): /* SUB L */
+		PGB_INSTR_SBC_R8(cpu_reg.hl.bytes.l, 0);
 		break;
 
-	case 0x96: /* SUB (HL) */
-		PGB_INSTR_SBC_R8(__gb_read(gb, gb->cpu_reg.hl.reg), 0);
+	PGB_OPCODE(0x96): /* SUB (HL) */
+		PGB_INSTR_SBC_R8(__gb_read(gb, cpu_reg.hl.reg), 0);
 		break;
 
-	case 0x97: /* SUB A */
-		gb->cpu_reg.a = 0;
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.z = 1;
-		gb->cpu_reg.f.f_bits.n = 1;
+	PGB_OPCODE(0x97): /* SUB A */
+		cpu_reg.a = 0;
+		PGB_CLEAR_FLAGS();
+		PGB_SET_FLAG_Z(1);
+		PGB_SET_FLAG_N(1);
 		break;
 
-	case 0x98: /* SBC A, B */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.bc.bytes.b, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x98): /* SBC A, B */
+		PGB_INSTR_SBC_R8(cpu_reg.bc.bytes.b, PGB_FLAG_C());
 		break;
 
-	case 0x99: /* SBC A, C */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.bc.bytes.c, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x99): /* SBC A, C */
+		PGB_INSTR_SBC_R8(cpu_reg.bc.bytes.c, PGB_FLAG_C());
 		break;
 
-	case 0x9A: /* SBC A, D */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.de.bytes.d, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x9A): /* SBC A, D */
+		PGB_INSTR_SBC_R8(cpu_reg.de.bytes.d, PGB_FLAG_C());
 		break;
 
-	case 0x9B: /* SBC A, E */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.de.bytes.e, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x9B): /* SBC A, E */
+		PGB_INSTR_SBC_R8(cpu_reg.de.bytes.e, PGB_FLAG_C());
 		break;
 
-	case 0x9C: /* SBC A, H */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.hl.bytes.h, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x9C): /* SBC A, H */
+		PGB_INSTR_SBC_R8(cpu_reg.hl.bytes.h, PGB_FLAG_C());
 		break;
 
-	case 0x9D: /* SBC A, L */
-		PGB_INSTR_SBC_R8(gb->cpu_reg.hl.bytes.l, gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x9D): /* SBC A, L */
+		PGB_INSTR_SBC_R8(cpu_reg.hl.bytes.l, PGB_FLAG_C());
 		break;
 
-	case 0x9E: /* SBC A, (HL) */
-		PGB_INSTR_SBC_R8(__gb_read(gb, gb->cpu_reg.hl.reg), gb->cpu_reg.f.f_bits.c);
+	PGB_OPCODE(0x9E): /* SBC A, (HL) */
+		PGB_INSTR_SBC_R8(__gb_read(gb, cpu_reg.hl.reg), PGB_FLAG_C());
 		break;
 
-	case 0x9F: /* SBC A, A */
-		gb->cpu_reg.a = gb->cpu_reg.f.f_bits.c ? 0xFF : 0x00;
-		gb->cpu_reg.f.f_bits.z = !gb->cpu_reg.f.f_bits.c;
-		gb->cpu_reg.f.f_bits.n = 1;
-		gb->cpu_reg.f.f_bits.h = gb->cpu_reg.f.f_bits.c;
+	PGB_OPCODE(0x9F): /* SBC A, A */
+		cpu_reg.a = PGB_FLAG_C() ? 0xFF : 0x00;
+		PGB_SET_FLAG_Z(!PGB_FLAG_C());
+		PGB_SET_FLAG_N(1);
+		PGB_SET_FLAG_H(PGB_FLAG_C());
 		break;
 
-	case 0xA0: /* AND B */
-		PGB_INSTR_AND_R8(gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0xA0): /* AND B */
+		PGB_INSTR_AND_R8(cpu_reg.bc.bytes.b);
 		break;
 
-	case 0xA1: /* AND C */
-		PGB_INSTR_AND_R8(gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0xA1): /* AND C */
+		PGB_INSTR_AND_R8(cpu_reg.bc.bytes.c);
 		break;
 
-	case 0xA2: /* AND D */
-		PGB_INSTR_AND_R8(gb->cpu_reg.de.bytes.d);
+	PGB_OPCODE(0xA2): /* AND D */
+		PGB_INSTR_AND_R8(cpu_reg.de.bytes.d);
 		break;
 
-	case 0xA3: /* AND E */
-		PGB_INSTR_AND_R8(gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0xA3): /* AND E */
+		PGB_INSTR_AND_R8(cpu_reg.de.bytes.e);
 		break;
 
-	case 0xA4: /* AND H */
-		PGB_INSTR_AND_R8(gb->cpu_reg.hl.bytes.h);
+	PGB_OPCODE(0xA4): /* AND H */
+		PGB_INSTR_AND_R8(cpu_reg.hl.bytes.h);
 		break;
 
-	case 0xA5: /* AND L */
-		PGB_INSTR_AND_R8(gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0xA5): /* AND L */
+		PGB_INSTR_AND_R8(cpu_reg.hl.bytes.l);
 		break;
 
-	case 0xA6: /* AND (HL) */
-		PGB_INSTR_AND_R8(__gb_read(gb, gb->cpu_reg.hl.reg));
+	PGB_OPCODE(0xA6): /* AND (HL) */
+		PGB_INSTR_AND_R8(__gb_read(gb, cpu_reg.hl.reg));
 		break;
 
-	case 0xA7: /* AND A */
-		PGB_INSTR_AND_R8(gb->cpu_reg.a);
+	PGB_OPCODE(0xA7): /* AND A */
+		PGB_INSTR_AND_R8(cpu_reg.a);
 		break;
 
-	case 0xA8: /* XOR B */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0xA8): /* XOR B */
+		PGB_INSTR_XOR_R8(cpu_reg.bc.bytes.b);
 		break;
 
-	case 0xA9: /* XOR C */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0xA9): /* XOR C */
+		PGB_INSTR_XOR_R8(cpu_reg.bc.bytes.c);
 		break;
 
-	case 0xAA: /* XOR D */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.de.bytes.d);
+	PGB_OPCODE(0xAA): /* XOR D */
+		PGB_INSTR_XOR_R8(cpu_reg.de.bytes.d);
 		break;
 
-	case 0xAB: /* XOR E */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0xAB): /* XOR E */
+		PGB_INSTR_XOR_R8(cpu_reg.de.bytes.e);
 		break;
 
-	case 0xAC: /* XOR H */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.hl.bytes.h);
+	PGB_OPCODE(0xAC): /* XOR H */
+		PGB_INSTR_XOR_R8(cpu_reg.hl.bytes.h);
 		break;
 
-	case 0xAD: /* XOR L */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0xAD): /* XOR L */
+		PGB_INSTR_XOR_R8(cpu_reg.hl.bytes.l);
 		break;
 
-	case 0xAE: /* XOR (HL) */
-		PGB_INSTR_XOR_R8(__gb_read(gb, gb->cpu_reg.hl.reg));
+	PGB_OPCODE(0xAE): /* XOR (HL) */
+		PGB_INSTR_XOR_R8(__gb_read(gb, cpu_reg.hl.reg));
 		break;
 
-	case 0xAF: /* XOR A */
-		PGB_INSTR_XOR_R8(gb->cpu_reg.a);
+	PGB_OPCODE(0xAF): /* XOR A */
+		PGB_INSTR_XOR_R8(cpu_reg.a);
 		break;
 
-	case 0xB0: /* OR B */
-		PGB_INSTR_OR_R8(gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0xB0): /* OR B */
+		PGB_INSTR_OR_R8(cpu_reg.bc.bytes.b);
 		break;
 
-	case 0xB1: /* OR C */
-		PGB_INSTR_OR_R8(gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0xB1): /* OR C */
+		PGB_INSTR_OR_R8(cpu_reg.bc.bytes.c);
 		break;
 
-	case 0xB2: /* OR D */
-		PGB_INSTR_OR_R8(gb->cpu_reg.de.bytes.d);
+	PGB_OPCODE(0xB2): /* OR D */
+		PGB_INSTR_OR_R8(cpu_reg.de.bytes.d);
 		break;
 
-	case 0xB3: /* OR E */
-		PGB_INSTR_OR_R8(gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0xB3): /* OR E */
+		PGB_INSTR_OR_R8(cpu_reg.de.bytes.e);
 		break;
 
-	case 0xB4: /* OR H */
-		PGB_INSTR_OR_R8(gb->cpu_reg.hl.bytes.h);
+	PGB_OPCODE(0xB4): /* OR H */
+		PGB_INSTR_OR_R8(cpu_reg.hl.bytes.h);
 		break;
 
-	case 0xB5: /* OR L */
-		PGB_INSTR_OR_R8(gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0xB5): /* OR L */
+		PGB_INSTR_OR_R8(cpu_reg.hl.bytes.l);
 		break;
 
-	case 0xB6: /* OR (HL) */
-		PGB_INSTR_OR_R8(__gb_read(gb, gb->cpu_reg.hl.reg));
+	PGB_OPCODE(0xB6): /* OR (HL) */
+		PGB_INSTR_OR_R8(__gb_read(gb, cpu_reg.hl.reg));
 		break;
 
-	case 0xB7: /* OR A */
-		PGB_INSTR_OR_R8(gb->cpu_reg.a);
+	PGB_OPCODE(0xB7): /* OR A */
+		PGB_INSTR_OR_R8(cpu_reg.a);
 		break;
 
-	case 0xB8: /* CP B */
-		PGB_INSTR_CP_R8(gb->cpu_reg.bc.bytes.b);
+	PGB_OPCODE(0xB8): /* CP B */
+		PGB_INSTR_CP_R8(cpu_reg.bc.bytes.b);
 		break;
 
-	case 0xB9: /* CP C */
-		PGB_INSTR_CP_R8(gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0xB9): /* CP C */
+		PGB_INSTR_CP_R8(cpu_reg.bc.bytes.c);
 		break;
 
-	case 0xBA: /* CP D */
-		PGB_INSTR_CP_R8(gb->cpu_reg.de.bytes.d);
+	PGB_OPCODE(0xBA): /* CP D */
+		PGB_INSTR_CP_R8(cpu_reg.de.bytes.d);
 		break;
 
-	case 0xBB: /* CP E */
-		PGB_INSTR_CP_R8(gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0xBB): /* CP E */
+		PGB_INSTR_CP_R8(cpu_reg.de.bytes.e);
 		break;
 
-	case 0xBC: /* CP H */
-		PGB_INSTR_CP_R8(gb->cpu_reg.hl.bytes.h);
+	PGB_OPCODE(0xBC): /* CP H */
+		PGB_INSTR_CP_R8(cpu_reg.hl.bytes.h);
 		break;
 
-	case 0xBD: /* CP L */
-		PGB_INSTR_CP_R8(gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0xBD): /* CP L */
+		PGB_INSTR_CP_R8(cpu_reg.hl.bytes.l);
 		break;
 
-	case 0xBE: /* CP (HL) */
-		PGB_INSTR_CP_R8(__gb_read(gb, gb->cpu_reg.hl.reg));
+	PGB_OPCODE(0xBE): /* CP (HL) */
+		PGB_INSTR_CP_R8(__gb_read(gb, cpu_reg.hl.reg));
 		break;
 
-	case 0xBF: /* CP A */
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.z = 1;
-		gb->cpu_reg.f.f_bits.n = 1;
+	PGB_OPCODE(0xBF): /* CP A */
+		PGB_CLEAR_FLAGS();
+		PGB_SET_FLAG_Z(1);
+		PGB_SET_FLAG_N(1);
 		break;
 
-	case 0xC0: /* RET NZ */
-		if(!gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0xC0): /* RET NZ */
+		if(!PGB_FLAG_Z())
 		{
-			gb->cpu_reg.pc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-			gb->cpu_reg.pc.bytes.p = __gb_read(gb, gb->cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.p = __gb_read(gb, cpu_reg.sp.reg++);
 			inst_cycles += 12;
 		}
 
 		break;
 
-	case 0xC1: /* POP BC */
-		gb->cpu_reg.bc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-		gb->cpu_reg.bc.bytes.b = __gb_read(gb, gb->cpu_reg.sp.reg++);
+	PGB_OPCODE(0xC1): /* POP BC */
+		cpu_reg.bc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+		cpu_reg.bc.bytes.b = __gb_read(gb, cpu_reg.sp.reg++);
 		break;
 
-	case 0xC2: /* JP NZ, imm */
-		if(!gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0xC2): /* JP NZ, imm */
+		if(!PGB_FLAG_Z())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xC3: /* JP imm */
-	{
-		uint8_t p, c;
-		c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		p = __gb_read(gb, gb->cpu_reg.pc.reg);
-		gb->cpu_reg.pc.bytes.c = c;
-		gb->cpu_reg.pc.bytes.p = p;
+	PGB_OPCODE(0xC3): /* JP imm */
+		cpu_reg.pc.reg = imm;
 		break;
-	}
 
-	case 0xC4: /* CALL NZ imm */
-		if(!gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0xC4): /* CALL NZ imm */
+		if(!PGB_FLAG_Z())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.p);
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.c);
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 12;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xC5: /* PUSH BC */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.bc.bytes.b);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0xC5): /* PUSH BC */
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.bc.bytes.b);
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.bc.bytes.c);
 		break;
 
-	case 0xC6: /* ADD A, imm */
+	PGB_OPCODE(0xC6): /* ADD A, imm */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.pc.reg++);
+		uint8_t val = imm;
 		PGB_INSTR_ADC_R8(val, 0);
 		break;
 	}
 
-	case 0xC7: /* RST 0x0000 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0000;
+	PGB_OPCODE(0xC7): /* RST 0x0000 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0000;
 		break;
 
-	case 0xC8: /* RET Z */
-		if(gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0xC8): /* RET Z */
+		if(PGB_FLAG_Z())
 		{
-			gb->cpu_reg.pc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-			gb->cpu_reg.pc.bytes.p = __gb_read(gb, gb->cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.p = __gb_read(gb, cpu_reg.sp.reg++);
 			inst_cycles += 12;
 		}
 		break;
 
-	case 0xC9: /* RET */
+	PGB_OPCODE(0xC9): /* RET */
 	{
-		gb->cpu_reg.pc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-		gb->cpu_reg.pc.bytes.p = __gb_read(gb, gb->cpu_reg.sp.reg++);
+		cpu_reg.pc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+		cpu_reg.pc.bytes.p = __gb_read(gb, cpu_reg.sp.reg++);
 		break;
 	}
 
-	case 0xCA: /* JP Z, imm */
-		if(gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0xCA): /* JP Z, imm */
+		if(PGB_FLAG_Z())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xCB: /* CB INST */
-		inst_cycles = __gb_execute_cb(gb);
+	PGB_OPCODE(0xCB): /* CB INST */
+		gb->cpu_reg = cpu_reg;
+		inst_cycles = __gb_execute_cb(gb, imm);
+		cpu_reg = gb->cpu_reg;
 		break;
 
-	case 0xCC: /* CALL Z, imm */
-		if(gb->cpu_reg.f.f_bits.z)
+	PGB_OPCODE(0xCC): /* CALL Z, imm */
+		if(PGB_FLAG_Z())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.p);
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.c);
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 12;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xCD: /* CALL imm */
-	{
-		uint8_t p, c;
-		c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		p = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.bytes.c = c;
-		gb->cpu_reg.pc.bytes.p = p;
-	}
-	break;
+	PGB_OPCODE(0xCD): /* CALL imm */
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.p);
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.c);
+		cpu_reg.pc.reg = imm;
+		break;
 
-	case 0xCE: /* ADC A, imm */
+	PGB_OPCODE(0xCE): /* ADC A, imm */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		PGB_INSTR_ADC_R8(val, gb->cpu_reg.f.f_bits.c);
+		uint8_t val = imm;
+		PGB_INSTR_ADC_R8(val, PGB_FLAG_C());
 		break;
 	}
 
-	case 0xCF: /* RST 0x0008 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0008;
+	PGB_OPCODE(0xCF): /* RST 0x0008 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0008;
 		break;
 
-	case 0xD0: /* RET NC */
-		if(!gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0xD0): /* RET NC */
+		if(!PGB_FLAG_C())
 		{
-			gb->cpu_reg.pc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-			gb->cpu_reg.pc.bytes.p = __gb_read(gb, gb->cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.p = __gb_read(gb, cpu_reg.sp.reg++);
 			inst_cycles += 12;
 		}
 
 		break;
 
-	case 0xD1: /* POP DE */
-		gb->cpu_reg.de.bytes.e = __gb_read(gb, gb->cpu_reg.sp.reg++);
-		gb->cpu_reg.de.bytes.d = __gb_read(gb, gb->cpu_reg.sp.reg++);
+	PGB_OPCODE(0xD1): /* POP DE */
+		cpu_reg.de.bytes.e = __gb_read(gb, cpu_reg.sp.reg++);
+		cpu_reg.de.bytes.d = __gb_read(gb, cpu_reg.sp.reg++);
 		break;
 
-	case 0xD2: /* JP NC, imm */
-		if(!gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0xD2): /* JP NC, imm */
+		if(!PGB_FLAG_C())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xD4: /* CALL NC, imm */
-		if(!gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0xD4): /* CALL NC, imm */
+		if(!PGB_FLAG_C())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.p);
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.c);
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 12;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xD5: /* PUSH DE */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.de.bytes.d);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.de.bytes.e);
+	PGB_OPCODE(0xD5): /* PUSH DE */
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.de.bytes.d);
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.de.bytes.e);
 		break;
 
-	case 0xD6: /* SUB imm */
+	PGB_OPCODE(0xD6): /* SUB imm */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		uint16_t temp = gb->cpu_reg.a - val;
-		gb->cpu_reg.f.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f.f_bits.n = 1;
-		gb->cpu_reg.f.f_bits.h =
-			(gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
+		uint8_t val = imm;
+		uint16_t temp = cpu_reg.a - val;
+		PGB_SET_FLAGS_RESULT(temp, 1, cpu_reg.a ^ val ^ temp, temp);
+		cpu_reg.a = (temp & 0xFF);
 		break;
 	}
 
-	case 0xD7: /* RST 0x0010 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0010;
+	PGB_OPCODE(0xD7): /* RST 0x0010 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0010;
 		break;
 
-	case 0xD8: /* RET C */
-		if(gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0xD8): /* RET C */
+		if(PGB_FLAG_C())
 		{
-			gb->cpu_reg.pc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-			gb->cpu_reg.pc.bytes.p = __gb_read(gb, gb->cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+			cpu_reg.pc.bytes.p = __gb_read(gb, cpu_reg.sp.reg++);
 			inst_cycles += 12;
 		}
 
 		break;
 
-	case 0xD9: /* RETI */
+	PGB_OPCODE(0xD9): /* RETI */
 	{
-		gb->cpu_reg.pc.bytes.c = __gb_read(gb, gb->cpu_reg.sp.reg++);
-		gb->cpu_reg.pc.bytes.p = __gb_read(gb, gb->cpu_reg.sp.reg++);
+		cpu_reg.pc.bytes.c = __gb_read(gb, cpu_reg.sp.reg++);
+		cpu_reg.pc.bytes.p = __gb_read(gb, cpu_reg.sp.reg++);
 		gb->gb_ime = true;
 	}
 	break;
 
-	case 0xDA: /* JP C, imm */
-		if(gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0xDA): /* JP C, imm */
+		if(PGB_FLAG_C())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 4;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xDC: /* CALL C, imm */
-		if(gb->cpu_reg.f.f_bits.c)
+	PGB_OPCODE(0xDC): /* CALL C, imm */
+		if(PGB_FLAG_C())
 		{
-			uint8_t p, c;
-			c = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			p = __gb_read(gb, gb->cpu_reg.pc.reg++);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-			__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-			gb->cpu_reg.pc.bytes.c = c;
-			gb->cpu_reg.pc.bytes.p = p;
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.p);
+			__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.pc.bytes.c);
+			cpu_reg.pc.reg = imm;
 			inst_cycles += 12;
 		}
-		else
-			gb->cpu_reg.pc.reg += 2;
 
 		break;
 
-	case 0xDE: /* SBC A, imm */
+	PGB_OPCODE(0xDE): /* SBC A, imm */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		PGB_INSTR_SBC_R8(val, gb->cpu_reg.f.f_bits.c);
+		uint8_t val = imm;
+		PGB_INSTR_SBC_R8(val, PGB_FLAG_C());
 		break;
 	}
 
-	case 0xDF: /* RST 0x0018 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0018;
+	PGB_OPCODE(0xDF): /* RST 0x0018 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0018;
 		break;
 
-	case 0xE0: /* LD (0xFF00+imm), A */
-		__gb_write(gb, 0xFF00 | __gb_read(gb, gb->cpu_reg.pc.reg++),
-			   gb->cpu_reg.a);
+	PGB_OPCODE(0xE0): /* LD (0xFF00+imm), A */
+		__gb_write(gb, 0xFF00 | imm,
+			   cpu_reg.a);
 		break;
 
-	case 0xE1: /* POP HL */
-		gb->cpu_reg.hl.bytes.l = __gb_read(gb, gb->cpu_reg.sp.reg++);
-		gb->cpu_reg.hl.bytes.h = __gb_read(gb, gb->cpu_reg.sp.reg++);
+	PGB_OPCODE(0xE1): /* POP HL */
+		cpu_reg.hl.bytes.l = __gb_read(gb, cpu_reg.sp.reg++);
+		cpu_reg.hl.bytes.h = __gb_read(gb, cpu_reg.sp.reg++);
 		break;
 
-	case 0xE2: /* LD (C), A */
-		__gb_write(gb, 0xFF00 | gb->cpu_reg.bc.bytes.c, gb->cpu_reg.a);
+	PGB_OPCODE(0xE2): /* LD (C), A */
+		__gb_write(gb, 0xFF00 | cpu_reg.bc.bytes.c, cpu_reg.a);
 		break;
 
-	case 0xE5: /* PUSH HL */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.hl.bytes.h);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.hl.bytes.l);
+	PGB_OPCODE(0xE5): /* PUSH HL */
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.hl.bytes.h);
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.hl.bytes.l);
 		break;
 
-	case 0xE6: /* AND imm */
+	PGB_OPCODE(0xE6): /* AND imm */
 	{
-		uint8_t temp = __gb_read(gb, gb->cpu_reg.pc.reg++);
+		uint8_t temp = imm;
 		PGB_INSTR_AND_R8(temp);
 		break;
 	}
 
-	case 0xE7: /* RST 0x0020 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0020;
+	PGB_OPCODE(0xE7): /* RST 0x0020 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0020;
 		break;
 
-	case 0xE8: /* ADD SP, imm */
-	{
-		int8_t offset = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.sp.reg & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
-		gb->cpu_reg.f.f_bits.c = ((gb->cpu_reg.sp.reg & 0xFF) + (offset & 0xFF) > 0xFF);
-		gb->cpu_reg.sp.reg += offset;
+	PGB_OPCODE(0xE8): /* ADD SP, imm */
+		gb->cpu_reg = cpu_reg;
+		gb->cpu_reg.sp.reg = __gb_sp_offset(gb, imm);
+		cpu_reg = gb->cpu_reg;
 		break;
-	}
 
-	case 0xE9: /* JP (HL) */
-		gb->cpu_reg.pc.reg = gb->cpu_reg.hl.reg;
+	PGB_OPCODE(0xE9): /* JP (HL) */
+		cpu_reg.pc.reg = cpu_reg.hl.reg;
 		break;
 
-	case 0xEA: /* LD (imm), A */
+	PGB_OPCODE(0xEA): /* LD (imm), A */
 	{
-		uint8_t h, l;
-		uint16_t addr;
-		l = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		h = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		addr = PEANUT_GB_U8_TO_U16(h, l);
-		__gb_write(gb, addr, gb->cpu_reg.a);
+		uint16_t addr = imm;
+		__gb_write(gb, addr, cpu_reg.a);
 		break;
 	}
 
-	case 0xEE: /* XOR imm */
-		PGB_INSTR_XOR_R8(__gb_read(gb, gb->cpu_reg.pc.reg++));
+	PGB_OPCODE(0xEE): /* XOR imm */
+		PGB_INSTR_XOR_R8(imm);
 		break;
 
-	case 0xEF: /* RST 0x0028 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0028;
+	PGB_OPCODE(0xEF): /* RST 0x0028 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0028;
 		break;
 
-	case 0xF0: /* LD A, (0xFF00+imm) */
-		gb->cpu_reg.a =
-			__gb_read(gb, 0xFF00 | __gb_read(gb, gb->cpu_reg.pc.reg++));
+	PGB_OPCODE(0xF0): /* LD A, (0xFF00+imm) */
+		cpu_reg.a =
+			__gb_read(gb, 0xFF00 | imm);
 		break;
 
-	case 0xF1: /* POP AF */
+	PGB_OPCODE(0xF1): /* POP AF */
 	{
-		uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.sp.reg++);
-		gb->cpu_reg.f.f_bits.z = (temp_8 >> 7) & 1;
-		gb->cpu_reg.f.f_bits.n = (temp_8 >> 6) & 1;
-		gb->cpu_reg.f.f_bits.h = (temp_8 >> 5) & 1;
-		gb->cpu_reg.f.f_bits.c = (temp_8 >> 4) & 1;
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.sp.reg++);
+		uint8_t temp_8 = __gb_read(gb, cpu_reg.sp.reg++);
+		PGB_SET_FLAG_Z((temp_8 >> 7) & 1);
+		PGB_SET_FLAG_N((temp_8 >> 6) & 1);
+		PGB_SET_FLAG_H((temp_8 >> 5) & 1);
+		PGB_SET_FLAG_C((temp_8 >> 4) & 1);
+		cpu_reg.a = __gb_read(gb, cpu_reg.sp.reg++);
 		break;
 	}
 
-	case 0xF2: /* LD A, (C) */
-		gb->cpu_reg.a = __gb_read(gb, 0xFF00 | gb->cpu_reg.bc.bytes.c);
+	PGB_OPCODE(0xF2): /* LD A, (C) */
+		cpu_reg.a = __gb_read(gb, 0xFF00 | cpu_reg.bc.bytes.c);
 		break;
 
-	case 0xF3: /* DI */
+	PGB_OPCODE(0xF3): /* DI */
 		gb->gb_ime = false;
 		break;
 
-	case 0xF5: /* PUSH AF */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.a);
-		__gb_write(gb, --gb->cpu_reg.sp.reg,
-			   gb->cpu_reg.f.f_bits.z << 7 | gb->cpu_reg.f.f_bits.n << 6 |
-			   gb->cpu_reg.f.f_bits.h << 5 | gb->cpu_reg.f.f_bits.c << 4);
+	PGB_OPCODE(0xF5): /* PUSH AF */
+		__gb_write(gb, --cpu_reg.sp.reg, cpu_reg.a);
+		__gb_write(gb, --cpu_reg.sp.reg,
+			   PGB_FLAG_Z() << 7 | PGB_FLAG_N() << 6 |
+			   PGB_FLAG_H() << 5 | PGB_FLAG_C() << 4);
 		break;
 
-	case 0xF6: /* OR imm */
-		PGB_INSTR_OR_R8(__gb_read(gb, gb->cpu_reg.pc.reg++));
+	PGB_OPCODE(0xF6): /* OR imm */
+		PGB_INSTR_OR_R8(imm);
 		break;
 
-	case 0xF7: /* PUSH AF */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0030;
+	PGB_OPCODE(0xF7): /* RST 0x0030 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0030;
 		break;
 
-	case 0xF8: /* LD HL, SP+/-imm */
-	{
-		/* Taken from SameBoy, which is released under MIT Licence. */
-		int8_t offset = (int8_t) __gb_read(gb, gb->cpu_reg.pc.reg++);
-		gb->cpu_reg.hl.reg = gb->cpu_reg.sp.reg + offset;
-		gb->cpu_reg.f.reg = 0;
-		gb->cpu_reg.f.f_bits.h = ((gb->cpu_reg.sp.reg & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
-		gb->cpu_reg.f.f_bits.c = ((gb->cpu_reg.sp.reg & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 : 0;
+	PGB_OPCODE(0xF8): /* LD HL, SP+/-imm */
+		gb->cpu_reg = cpu_reg;
+		gb->cpu_reg.hl.reg = __gb_sp_offset(gb, imm);
+		cpu_reg = gb->cpu_reg;
 		break;
-	}
 
-	case 0xF9: /* LD SP, HL */
-		gb->cpu_reg.sp.reg = gb->cpu_reg.hl.reg;
+	PGB_OPCODE(0xF9): /* LD SP, HL */
+		cpu_reg.sp.reg = cpu_reg.hl.reg;
 		break;
 
-	case 0xFA: /* LD A, (imm) */
+	PGB_OPCODE(0xFA): /* LD A, (imm) */
 	{
-		uint8_t h, l;
-		uint16_t addr;
-		l = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		h = __gb_read(gb, gb->cpu_reg.pc.reg++);
-		addr = PEANUT_GB_U8_TO_U16(h, l);
-		gb->cpu_reg.a = __gb_read(gb, addr);
+		uint16_t addr = imm;
+		cpu_reg.a = __gb_read(gb, addr);
 		break;
 	}
 
-	case 0xFB: /* EI */
+	PGB_OPCODE(0xFB): /* EI */
 		gb->gb_ime = true;
 		break;
 
-	case 0xFE: /* CP imm */
+	PGB_OPCODE(0xFE): /* CP imm */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.pc.reg++);
+		uint8_t val = imm;
 		PGB_INSTR_CP_R8(val);
 		break;
 	}
 
-	case 0xFF: /* RST 0x0038 */
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.p);
-		__gb_write(gb, --gb->cpu_reg.sp.reg, gb->cpu_reg.pc.bytes.c);
-		gb->cpu_reg.pc.reg = 0x0038;
+	PGB_OPCODE(0xFF): /* RST 0x0038 */
+		cpu_reg.sp.reg = __gb_rst(gb, cpu_reg.sp.reg, cpu_reg.pc.reg);
+		cpu_reg.pc.reg = 0x0038;
 		break;
 
-	default:
+	PGB_OPCODE_INVALID:
 		/* Return address where invalid opcode that was read. */
-		(gb->gb_error)(gb, GB_INVALID_OPCODE, gb->cpu_reg.pc.reg - 1);
+		gb->cpu_reg = cpu_reg;
+		__gb_error(gb, GB_INVALID_OPCODE, cpu_reg.pc.reg - 1);
 		PGB_UNREACHABLE();
 	}
 
-	do
-	{
-		/* DIV register timing */
-		gb->counter.div_count += inst_cycles;
-		while(gb->counter.div_count >= DIV_CYCLES)
-		{
-			gb->hram_io[IO_DIV]++;
-			gb->counter.div_count -= DIV_CYCLES;
-		}
-
-		/* Check for RTC tick. */
-		if(gb->mbc == 3 && (gb->rtc_real.reg.high & 0x40) == 0)
-		{
-			gb->counter.rtc_count += inst_cycles;
-			while(PGB_UNLIKELY(gb->counter.rtc_count >= RTC_CYCLES))
-			{
-				gb->counter.rtc_count -= RTC_CYCLES;
-
-				/* Detect invalid rollover. */
-				if(PGB_UNLIKELY(gb->rtc_real.reg.sec == 63))
-				{
-					gb->rtc_real.reg.sec = 0;
-					continue;
-				}
-
-				if(++gb->rtc_real.reg.sec != 60)
-					continue;
-
-				gb->rtc_real.reg.sec = 0;
-				if(gb->rtc_real.reg.min == 63)
-				{
-					gb->rtc_real.reg.min = 0;
-					continue;
-				}
-				if(++gb->rtc_real.reg.min != 60)
-					continue;
-
-				gb->rtc_real.reg.min = 0;
-				if(gb->rtc_real.reg.hour == 31)
-				{
-					gb->rtc_real.reg.hour = 0;
-					continue;
-				}
-				if(++gb->rtc_real.reg.hour != 24)
-					continue;
-
-				gb->rtc_real.reg.hour = 0;
-				if(++gb->rtc_real.reg.yday != 0)
-					continue;
-
-				if(gb->rtc_real.reg.high & 1)  /* Bit 8 of days*/
-					gb->rtc_real.reg.high |= 0x80; /* Overflow bit */
-
-				gb->rtc_real.reg.high ^= 1;
-			}
-		}
+#if PEANUT_GB_USE_MUSTTAIL
+	*regs = cpu_reg;
+	return inst_cycles;
+}
 
-		/* Check serial transmission. */
-		if(gb->hram_io[IO_SC] & SERIAL_SC_TX_START)
-		{
-			/* If new transfer, call TX function. */
-			if(gb->counter.serial_count == 0 &&
-				gb->gb_serial_tx != NULL)
-				(gb->gb_serial_tx)(gb, gb->hram_io[IO_SB]);
+/* Lists all 256 opcodes, each as X(0xNN). */
+#define PGB_OPCODE_ROW(X, r)						\
+	X(r##0) X(r##1) X(r##2) X(r##3) X(r##4) X(r##5) X(r##6) X(r##7)	\
+	X(r##8) X(r##9) X(r##A) X(r##B) X(r##C) X(r##D) X(r##E) X(r##F)
+#define PGB_OPCODE_ALL(X)						\
+	PGB_OPCODE_ROW(X, 0x0) PGB_OPCODE_ROW(X, 0x1)			\
+	PGB_OPCODE_ROW(X, 0x2) PGB_OPCODE_ROW(X, 0x3)			\
+	PGB_OPCODE_ROW(X, 0x4) PGB_OPCODE_ROW(X, 0x5)			\
+	PGB_OPCODE_ROW(X, 0x6) PGB_OPCODE_ROW(X, 0x7)			\
+	PGB_OPCODE_ROW(X, 0x8) PGB_OPCODE_ROW(X, 0x9)			\
+	PGB_OPCODE_ROW(X, 0xA) PGB_OPCODE_ROW(X, 0xB)			\
+	PGB_OPCODE_ROW(X, 0xC) PGB_OPCODE_ROW(X, 0xD)			\
+	PGB_OPCODE_ROW(X, 0xE) PGB_OPCODE_ROW(X, 0xF)
+
+#define PGB_OP_HANDLER_DECLARE(op)					\
+	static void __gb_op_##op(struct gb_s *gb,			\
+		struct cpu_registers_s cpu_reg, uint16_t imm,		\
+		const uint32_t end);
+#define PGB_OP_HANDLER_ENTRY(op)	__gb_op_##op,
+
+PGB_OPCODE_ALL(PGB_OP_HANDLER_DECLARE)
+
+/* Handlers of each opcode, called with the registers and immediate operand. */
+static void (*const __gb_op_handlers[0x100])(struct gb_s *,
+		struct cpu_registers_s, uint16_t, const uint32_t) =
+{
+	PGB_OPCODE_ALL(PGB_OP_HANDLER_ENTRY)
+};
 
-			gb->counter.serial_count += inst_cycles;
+/**
+ * Runs opcode and fetches the next one. Returns the next opcode, or -1 once
+ * the run has ended and the registers have been written back.
+ */
+static PGB_ALWAYS_INLINE int __gb_op_run(struct gb_s *gb,
+		struct cpu_registers_s *regs, const uint8_t opcode,
+		uint16_t *imm, const uint32_t end)
+{
+	const uint_fast16_t inst_cycles =
+		__gb_execute(gb, regs, opcode, *imm, op_cycles[opcode], end);
 
-			/* If it's time to receive byte, call RX function. */
-			if(gb->counter.serial_count >= SERIAL_CYCLES)
-			{
-				/* If RX can be done, do it. */
-				/* If RX failed, do not change SB if using external
-				 * clock, or set to 0xFF if using internal clock. */
-				uint8_t rx;
-
-				if(gb->gb_serial_rx != NULL &&
-					(gb->gb_serial_rx(gb, &rx) ==
-						GB_SERIAL_RX_SUCCESS))
-				{
-					gb->hram_io[IO_SB] = rx;
+	if(PGB_UNLIKELY(!__gb_retire(gb, regs, opcode, *imm, inst_cycles,
+			end)))
+	{
+		gb->cpu_reg = *regs;
+		__gb_end_run(gb, end);
+		return -1;
+	}
 
-					/* Inform game of serial TX/RX completion. */
-					gb->hram_io[IO_SC] &= 0x01;
-					gb->hram_io[IO_IF] |= SERIAL_INTR;
-				}
-				else if(gb->hram_io[IO_SC] & SERIAL_SC_CLOCK_SRC)
-				{
-					/* If using internal clock, and console is not
-					 * attached to any external peripheral, shifted
-					 * bits are replaced with logic 1. */
-					gb->hram_io[IO_SB] = 0xFF;
-
-					/* Inform game of serial TX/RX completion. */
-					gb->hram_io[IO_SC] &= 0x01;
-					gb->hram_io[IO_IF] |= SERIAL_INTR;
-				}
-				else
-				{
-					/* If using external clock, and console is not
-					 * attached to any external peripheral, bits are
-					 * not shifted, so SB is not modified. */
-				}
+	__gb_interrupt(gb, regs);
+	return __gb_fetch(gb, regs, imm);
+}
 
-				gb->counter.serial_count = 0;
-			}
-		}
+/* The handler of each opcode jumps straight to the handler of the next. */
+#define PGB_OP_HANDLER_DEFINE(op)					\
+	static PGB_HOT void __gb_op_##op(struct gb_s *gb,		\
+		struct cpu_registers_s cpu_reg, uint16_t imm,		\
+		const uint32_t end)					\
+	{								\
+		const int next = __gb_op_run(gb, &cpu_reg, op, &imm, end); \
+									\
+		if(next >= 0)						\
+			PGB_TAIL_CALL(__gb_op_handlers[next](gb, cpu_reg, \
+				imm, end));				\
+	}
 
-		/* TIMA register timing */
-		/* TODO: Change tac_enable to struct of TAC timer control bits. */
-		if(gb->hram_io[IO_TAC] & IO_TAC_ENABLE_MASK)
-		{
-			gb->counter.tima_count += inst_cycles;
+PGB_OPCODE_ALL(PGB_OP_HANDLER_DEFINE)
 
-			while(gb->counter.tima_count >=
-				TAC_CYCLES[gb->hram_io[IO_TAC] & IO_TAC_RATE_MASK])
-			{
-				gb->counter.tima_count -=
-					TAC_CYCLES[gb->hram_io[IO_TAC] & IO_TAC_RATE_MASK];
+/**
+ * Internal function used to run the CPU until an event is due, the CPU is
+ * halted or the cycle counter reaches end. At least one instruction is run.
+ * The CPU registers are passed from one opcode handler to the next meanwhile,
+ * and are only written back to gb->cpu_reg for the functions that use them.
+ */
+PGB_HOT void __gb_run_cpu(struct gb_s *gb, const uint32_t end)
+{
+	struct cpu_registers_s cpu_reg = gb->cpu_reg;
+	uint16_t imm;
+	uint8_t opcode;
 
-				if(++gb->hram_io[IO_TIMA] == 0)
-				{
-					gb->hram_io[IO_IF] |= TIMER_INTR;
-					/* On overflow, set TMA to TIMA. */
-					gb->hram_io[IO_TIMA] = gb->hram_io[IO_TMA];
-				}
-			}
-		}
+	/* Continue waiting if the previous run ended while halted. */
+	if(PGB_UNLIKELY(gb->gb_halt &&
+			(gb->hram_io[IO_IF] & gb->hram_io[IO_IE]) == 0))
+	{
+		__gb_halt_wait(gb, end);
+		return;
+	}
 
-		/* If LCD is off, don't update LCD state or increase the LCD
-		 * ticks. */
-		if(!(gb->hram_io[IO_LCDC] & LCDC_ENABLE))
-			continue;
+	__gb_interrupt(gb, &cpu_reg);
+	opcode = __gb_fetch(gb, &cpu_reg, &imm);
+	__gb_op_handlers[opcode](gb, cpu_reg, imm, end);
+}
+#else
+	/* Continue with the next instruction while no event is due. */
+	if(PGB_LIKELY(__gb_retire(gb, &cpu_reg, opcode, imm, inst_cycles, end)))
+		goto next_inst;
 
-		/* LCD Timing */
-		gb->counter.lcd_count += inst_cycles;
+	gb->cpu_reg = cpu_reg;
+	__gb_end_run(gb, end);
+}
+#endif /* PEANUT_GB_USE_MUSTTAIL */
 
-		/* New Scanline */
-		if(gb->counter.lcd_count >= LCD_LINE_CYCLES)
-		{
-			gb->counter.lcd_count -= LCD_LINE_CYCLES;
+#undef PGB_CPU_REG
+#define PGB_CPU_REG	gb->cpu_reg
 
-			/* Next line */
-			gb->hram_io[IO_LY] = (gb->hram_io[IO_LY] + 1) % LCD_VERT_LINES;
+void __gb_step_cpu(struct gb_s *gb)
+{
+	__gb_run_cpu(gb, gb->counter.cycles);
 
-			/* LYC Update */
-			if(gb->hram_io[IO_LY] == gb->hram_io[IO_LYC])
-			{
-				gb->hram_io[IO_STAT] |= STAT_LYC_COINC;
+	/* Wait for the interrupt that ends a HALT. */
+	if(gb->gb_halt && (gb->hram_io[IO_IF] & gb->hram_io[IO_IE]) == 0)
+		__gb_run_cpu(gb, gb->counter.cycles + INT32_MAX);
+}
 
-				if(gb->hram_io[IO_STAT] & STAT_LYC_INTR)
-					gb->hram_io[IO_IF] |= LCDC_INTR;
-			}
-			else
-				gb->hram_io[IO_STAT] &= 0xFB;
+/**
+ * Adds the cycles run since the last call to the 64-bit cycle counter.
+ */
+void __gb_update_elapsed(struct gb_s *gb)
+{
+	gb->counter.elapsed += (uint32_t)(gb->counter.cycles -
+		gb->counter.elapsed_sync);
+	gb->counter.elapsed_sync = gb->counter.cycles;
+}
 
-			/* VBLANK Start */
-			if(gb->hram_io[IO_LY] == LCD_HEIGHT)
-			{
-				gb->hram_io[IO_STAT] =
-					(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_VBLANK;
-				gb->gb_frame = true;
-				gb->hram_io[IO_IF] |= VBLANK_INTR;
-				gb->lcd_blank = false;
+void gb_run_frame(struct gb_s *gb)
+{
+	gb->gb_frame = false;
 
-				if(gb->hram_io[IO_STAT] & STAT_MODE_1_INTR)
-					gb->hram_io[IO_IF] |= LCDC_INTR;
+	/* The frame ends with an event. */
+	while(!gb->gb_frame)
+		__gb_run_cpu(gb, gb->counter.cycles + INT32_MAX);
 
-#if ENABLE_LCD
-				/* If frame skip is activated, check if we need to draw
-				 * the frame or skip it. */
-				if(gb->direct.frame_skip)
-				{
-					gb->display.frame_skip_count =
-						!gb->display.frame_skip_count;
-				}
+	__gb_update_elapsed(gb);
+}
 
-				/* If interlaced is activated, change which lines get
-				 * updated. Also, only update lines on frames that are
-				 * actually drawn when frame skip is enabled. */
-				if(gb->direct.interlace &&
-						(!gb->direct.frame_skip ||
-						 gb->display.frame_skip_count))
-				{
-					gb->display.interlace_count =
-						!gb->display.interlace_count;
-				}
-#endif
-			}
-			/* Normal Line */
-			else if(gb->hram_io[IO_LY] < LCD_HEIGHT)
-			{
-				if(gb->hram_io[IO_LY] == 0)
-				{
-					/* Clear Screen */
-					gb->display.WY = gb->hram_io[IO_WY];
-					gb->display.window_clear = 0;
-				}
+uint_fast32_t gb_run_cycles(struct gb_s *gb, uint_fast32_t cycles,
+		bool stop_at_vblank)
+{
+	const uint32_t start = gb->counter.cycles;
+	uint_fast32_t run;
 
-				gb->hram_io[IO_STAT] =
-					(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_HBLANK;
+	gb->gb_frame = false;
 
-				if(gb->hram_io[IO_STAT] & STAT_MODE_0_INTR)
-					gb->hram_io[IO_IF] |= LCDC_INTR;
+	do
+	{
+		__gb_run_cpu(gb, start + cycles);
+		run = (uint32_t)(gb->counter.cycles - start);
+	}
+	while(run < cycles && !(stop_at_vblank && gb->gb_frame));
 
-				/* If halted immediately jump to next LCD mode. */
-				if(gb->counter.lcd_count < LCD_MODE_2_CYCLES)
-					inst_cycles = LCD_MODE_2_CYCLES - gb->counter.lcd_count;
-			}
-		}
-		/* OAM access */
-		else if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_HBLANK &&
-				gb->counter.lcd_count >= LCD_MODE_2_CYCLES)
-		{
-			gb->hram_io[IO_STAT] =
-				(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_SEARCH_OAM;
+	__gb_update_elapsed(gb);
+	return run;
+}
 
-			if(gb->hram_io[IO_STAT] & STAT_MODE_2_INTR)
-				gb->hram_io[IO_IF] |= LCDC_INTR;
+uint64_t gb_get_cycles(const struct gb_s *gb)
+{
+	return gb->counter.elapsed +
+		(uint32_t)(gb->counter.cycles - gb->counter.elapsed_sync);
+}
 
-			/* If halted immediately jump to next LCD mode. */
-			if (gb->counter.lcd_count < LCD_MODE_3_CYCLES)
-				inst_cycles = LCD_MODE_3_CYCLES - gb->counter.lcd_count;
-		}
-		/* Update LCD */
-		else if((gb->hram_io[IO_STAT] & STAT_MODE) == IO_STAT_MODE_SEARCH_OAM &&
-				gb->counter.lcd_count >= LCD_MODE_3_CYCLES)
-		{
-			gb->hram_io[IO_STAT] =
-				(gb->hram_io[IO_STAT] & ~STAT_MODE) | IO_STAT_MODE_SEARCH_TRANSFER;
-#if ENABLE_LCD
-			if(!gb->lcd_blank)
-				__gb_draw_line(gb);
+uint64_t gb_get_skipped_cycles(const struct gb_s *gb)
+{
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+	return gb->idle.skipped_cycles;
+#else
+	(void)gb;
+	return 0;
 #endif
-			/* If halted immediately jump to next LCD mode. */
-			if (gb->counter.lcd_count < LCD_MODE_0_CYCLES)
-				inst_cycles = LCD_MODE_0_CYCLES - gb->counter.lcd_count;
-		}
-	} while(gb->gb_halt && (gb->hram_io[IO_IF] & gb->hram_io[IO_IE]) == 0);
-	/* If halted, loop until an interrupt occurs. */
 }
 
-void gb_run_frame(struct gb_s *gb)
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+uint32_t gb_get_fused_count(const struct gb_s *gb, enum gb_fused_e fused,
+		const char **name)
 {
-	gb->gb_frame = false;
+	static const char *const fused_name[GB_FUSED_MAX] =
+	{
+		"",
+		"LD A, (HL+); LD (DE), A",
+		"DEC B; JR NZ, imm",
+		"DEC C; JR NZ, imm",
+		"OR C; JR NZ, imm",
+		"CP imm; JR Z, imm",
+		"CP imm; JR NZ, imm"
+	};
 
-	while(!gb->gb_frame)
-		__gb_step_cpu(gb);
+	if(fused >= GB_FUSED_MAX)
+		fused = GB_FUSED_NONE;
+
+	if(name != NULL)
+		*name = fused_name[fused];
+
+	return gb->block_cache.fused_count[fused];
 }
+#endif
 
 /**
  * Gets the size of the save file required for the ROM.
@@ -3515,7 +6314,7 @@ uint8_t gb_colour_hash(struct gb_s *gb)
 /**
  * Resets the context, and initialises startup values for a DMG console.
  */
-void gb_reset(struct gb_s *gb)
+PGB_COLD void gb_reset(struct gb_s *gb)
 {
 	gb->gb_halt = false;
 	gb->gb_ime = true;
@@ -3533,17 +6332,17 @@ void gb_reset(struct gb_s *gb)
 		hdr_chk = gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC) != 0;
 
 		gb->cpu_reg.a = 0x01;
-		gb->cpu_reg.f.f_bits.z = 1;
-		gb->cpu_reg.f.f_bits.n = 0;
-		gb->cpu_reg.f.f_bits.h = hdr_chk;
-		gb->cpu_reg.f.f_bits.c = hdr_chk;
+		PGB_SET_FLAG_Z(1);
+		PGB_SET_FLAG_N(0);
+		PGB_SET_FLAG_H(hdr_chk);
+		PGB_SET_FLAG_C(hdr_chk);
 		gb->cpu_reg.bc.reg = 0x0013;
 		gb->cpu_reg.de.reg = 0x00D8;
 		gb->cpu_reg.hl.reg = 0x014D;
 		gb->cpu_reg.sp.reg = 0xFFFE;
 		gb->cpu_reg.pc.reg = 0x0100;
 
-		gb->hram_io[IO_DIV ] = 0xAB;
+		gb->counter.div_offset = 0xAB;
 		gb->hram_io[IO_LCDC] = 0x91;
 		gb->hram_io[IO_STAT] = 0x85;
 		gb->hram_io[IO_BOOT] = 0x01;
@@ -3555,17 +6354,49 @@ void gb_reset(struct gb_s *gb)
 		/* Set value as though the console was just switched on.
 		 * CPU registers are uninitialised. */
 		gb->cpu_reg.pc.reg = 0x0000;
-		gb->hram_io[IO_DIV ] = 0x00;
+		gb->counter.div_offset = 0x00;
 		gb->hram_io[IO_LCDC] = 0x00;
 		gb->hram_io[IO_STAT] = 0x84;
 		gb->hram_io[IO_BOOT] = 0x00;
 	}
 
-	gb->counter.lcd_count = 0;
-	gb->counter.div_count = 0;
+#if PEANUT_GB_USE_BLOCK_CACHE
+	__gb_block_cache_reset(gb);
+#endif
+
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+	gb->display.line_sprites_valid = false;
+#endif
+
+#if PEANUT_GB_DEFERRED_RENDER
+	gb->deferred.lines = 0;
+	gb->deferred.count = 0;
+#endif
+
+#if PEANUT_GB_TILE_CACHE
+	/* VRAM may have been written to before the reset. */
+	memset(gb->tile_cache.dirty, 0xFF, sizeof(gb->tile_cache.dirty));
+#endif
+
+	/* Reset the scheduler. Timer and serial are stopped by the TAC and SC
+	 * values below. */
+	gb->counter.cycles = 0;
+	gb->counter.scheduled = 0;
+	__gb_update_memory_map(gb);
+	gb->counter.lcd_line_start = 0;
 	gb->counter.tima_count = 0;
 	gb->counter.serial_count = 0;
-	gb->counter.rtc_count = 0;
+	gb->counter.elapsed = 0;
+	gb->counter.elapsed_sync = 0;
+	__gb_schedule_rtc(gb, 0);
+
+	if(gb->hram_io[IO_LCDC] & LCDC_ENABLE)
+		__gb_schedule_lcd(gb);
+
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+	gb->idle.valid = false;
+	gb->idle.skipped_cycles = 0;
+#endif
 
 	gb->direct.joypad = 0xFF;
 	gb->hram_io[IO_JOYP] = 0xCF;
@@ -3590,7 +6421,19 @@ void gb_reset(struct gb_s *gb)
 	gb->hram_io[IO_WX] = 0x00;
 	gb->hram_io[IO_IE] = 0x00;
 	gb->hram_io[IO_IF] = 0xE1;
+	__gb_update_intr_pending(gb);
+}
+
+#if PEANUT_GB_RELOCATE_MEMORY
+void gb_set_memory(struct gb_s *gb, uint8_t *wram, uint8_t *vram,
+		   uint8_t *oam, uint8_t *hram_io)
+{
+	gb->wram = wram;
+	gb->vram = vram;
+	gb->oam = oam;
+	gb->hram_io = hram_io;
 }
+#endif
 
 enum gb_init_error_e gb_init(struct gb_s *gb,
 			     uint8_t (*gb_rom_read)(struct gb_s*, const uint_fast32_t),
@@ -3642,6 +6485,16 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 
 	gb->gb_bootrom_read = NULL;
 
+	gb->host.rom = NULL;
+	gb->host.rom_size = 0;
+	gb->host.cart_ram = NULL;
+	gb->host.cart_ram_size = 0;
+
+#if PEANUT_GB_USE_JIT
+	gb->jit.code = NULL;
+	gb->direct.interpreter_only = false;
+#endif
+
 	/* Check valid ROM using checksum value. */
 	{
 		uint8_t x = 0;
@@ -3663,6 +6516,7 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 			return GB_INIT_CARTRIDGE_UNSUPPORTED;
 	}
 
+	gb->mbc_handlers = &gb_mbc_handlers[gb->mbc];
 	gb->cart_ram = cart_ram[gb->gb_rom_read(gb, mbc_location)];
 	gb->num_rom_banks_mask = num_rom_banks_mask[gb->gb_rom_read(gb, bank_count_location)] - 1;
 	gb->num_ram_banks = num_ram_banks[gb->gb_rom_read(gb, ram_size_location)];
@@ -3673,6 +6527,7 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 
 	gb->lcd_blank = false;
 	gb->display.lcd_draw_line = NULL;
+	gb->display.framebuffer = NULL;
 
 	gb_reset(gb);
 
@@ -3710,6 +6565,7 @@ void gb_init_lcd(struct gb_s *gb,
 			const uint_fast8_t line))
 {
 	gb->display.lcd_draw_line = lcd_draw_line;
+	gb->display.framebuffer = NULL;
 
 	gb->direct.interlace = false;
 	gb->display.interlace_count = false;
@@ -3721,6 +6577,47 @@ void gb_init_lcd(struct gb_s *gb,
 
 	return;
 }
+
+void gb_init_framebuffer(struct gb_s *gb, uint8_t *base, size_t stride,
+		enum gb_framebuffer_format_e format)
+{
+	/* GB_FRAMEBUFFER_8BPP is the only format. */
+	(void)format;
+
+	gb_init_lcd(gb, NULL);
+	gb->display.framebuffer = base;
+	gb->display.framebuffer_stride = stride;
+}
+#endif
+
+void gb_init_direct(struct gb_s *gb,
+		    const uint8_t *rom, const uint_fast32_t rom_size,
+		    uint8_t *cart_ram, const uint_fast32_t cart_ram_size)
+{
+	gb->host.rom = rom;
+	gb->host.rom_size = rom_size;
+	gb->host.cart_ram = cart_ram;
+	gb->host.cart_ram_size = cart_ram_size;
+
+	__gb_update_memory_map(gb);
+}
+
+#if PEANUT_GB_USE_JIT
+void gb_init_jit(struct gb_s *gb, void *code, size_t code_size)
+{
+	uint_fast16_t ah;
+
+	/* LAHF stores CF in bit 0, AF in bit 4 and ZF in bit 6. */
+	for(ah = 0; ah < 0x100; ah++)
+	{
+		gb->jit.flags[ah] = __gb_jit_flags((ah >> 6) & 1, 0,
+			(ah >> 4) & 1, ah & 1);
+	}
+
+	gb->jit.code = (uint8_t *)code;
+	gb->jit.size = code_size;
+	__gb_jit_flush(gb);
+}
 #endif
 
 void gb_set_bootrom(struct gb_s *gb,
@@ -3740,11 +6637,25 @@ void gb_tick_rtc(struct gb_s *gb)
 
 void gb_set_rtc(struct gb_s *gb, const struct tm * const time)
 {
+	const uint_fast32_t rtc_count = __gb_rtc_count(gb);
+
 	gb->rtc_real.bytes[0] = time->tm_sec;
 	gb->rtc_real.bytes[1] = time->tm_min;
 	gb->rtc_real.bytes[2] = time->tm_hour;
 	gb->rtc_real.bytes[3] = time->tm_yday & 0xFF; /* Low 8 bits of day counter. */
 	gb->rtc_real.bytes[4] = time->tm_yday >> 8; /* High 1 bit of day counter. */
+
+	/* The RTC halt flag may have changed. */
+	__gb_schedule_rtc(gb, rtc_count);
+}
+
+void gb_advance_rtc(struct gb_s *gb, uint_fast32_t seconds)
+{
+	__gb_update_rtc(gb);
+
+	/* A halted RTC does not count. */
+	if(gb->mbc == 3 && (gb->rtc_real.reg.high & 0x40) == 0)
+		__gb_rtc_advance(gb, seconds);
 }
 #endif // PEANUT_GB_HEADER_ONLY
 
@@ -3775,6 +6686,24 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 			     void (*gb_error)(struct gb_s*, const enum gb_error_e, const uint16_t),
 			     void *priv);
 
+/**
+ * Sets the memory that WRAM, VRAM, OAM and HRAM/IO are stored in. Only
+ * available when PEANUT_GB_RELOCATE_MEMORY is defined to a non-zero value, in
+ * which case this must be called before gb_init(). Each region may be placed
+ * anywhere, so that the most used ones can be put in fast memory. The memory
+ * must remain valid until the emulator context is no longer used.
+ *
+ * \param gb	An emulator context. Must not be NULL.
+ * \param wram	WRAM_SIZE bytes for WRAM.
+ * \param vram	VRAM_SIZE bytes for VRAM.
+ * \param oam	OAM_SIZE bytes for OAM.
+ * \param hram_io HRAM_IO_SIZE bytes for the IO registers and HRAM.
+ */
+#if PEANUT_GB_RELOCATE_MEMORY
+void gb_set_memory(struct gb_s *gb, uint8_t *wram, uint8_t *vram,
+		   uint8_t *oam, uint8_t *hram_io);
+#endif
+
 /**
  * Executes the emulator and runs for one frame.
  *
@@ -3782,6 +6711,55 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
  */
 void gb_run_frame(struct gb_s *gb);
 
+/**
+ * Executes the emulator for a number of clock cycles. Only the last instruction
+ * may run past the given number of cycles. A HALT that is still waiting for an
+ * interrupt continues in the next call. gb_frame is set if VBlank was entered.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param cycles	Number of clock cycles to run, less than 2^31.
+ * \param stop_at_vblank	Stop early if VBlank is entered.
+ * \returns	Number of clock cycles that were run.
+ */
+uint_fast32_t gb_run_cycles(struct gb_s *gb, uint_fast32_t cycles,
+		bool stop_at_vblank);
+
+/**
+ * Returns the number of clock cycles run since the last reset. The CPU runs at
+ * 4194304 cycles per second.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \returns	Number of clock cycles since reset.
+ */
+uint64_t gb_get_cycles(const struct gb_s *gb);
+
+/**
+ * Returns the number of clock cycles since the last reset that were skipped
+ * in idle loops instead of being run. These are included in gb_get_cycles().
+ * Always 0 unless PEANUT_GB_SKIP_IDLE_LOOPS is defined to a non-zero value.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \returns	Number of clock cycles skipped since reset.
+ */
+uint64_t gb_get_skipped_cycles(const struct gb_s *gb);
+
+/**
+ * Returns the number of times a pair of instructions was run as a
+ * superinstruction since the last reset. Only available when
+ * PEANUT_GB_SUPERINSTRUCTION_STATS is defined to a non-zero value. A report of
+ * all pairs is obtained by calling this for each value from
+ * GB_FUSED_NONE + 1 up to GB_FUSED_MAX - 1.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param fused	Superinstruction to return the count of.
+ * \param name	If not NULL, set to the instructions of the pair.
+ * \returns	Number of times the superinstruction was run.
+ */
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+uint32_t gb_get_fused_count(const struct gb_s *gb, enum gb_fused_e fused,
+		const char **name);
+#endif
+
 /**
  * Internal function used to step the CPU. Used mainly for testing.
  * Use gb_run_frame() instead.
@@ -3818,6 +6796,27 @@ void gb_init_lcd(struct gb_s *gb,
 		void (*lcd_draw_line)(struct gb_s *gb,
 			const uint8_t *pixels,
 			const uint_fast8_t line));
+
+/**
+ * Initialises the display context of the emulator to draw lines directly to a
+ * frame buffer, instead of passing each line to an lcd_draw_line function.
+ * Only available when ENABLE_LCD is defined to a non-zero value.
+ * The pixels are the same as those described for gb_init_lcd(). Calling
+ * gb_init_lcd() afterwards stops drawing to the frame buffer.
+ * Each line is written when lcd_draw_line() would be called for it, so lines
+ * that are not drawn yet keep the pixels of the previous frame. A line is
+ * drawn in several passes, so the frame buffer must not be read while the
+ * emulator runs, such as by a GPU that is still drawing the previous frame.
+ * This function can be called at any time.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param base	Frame buffer of at least LCD_HEIGHT lines of LCD_WIDTH
+ *		pixels. Must not be NULL.
+ * \param stride	Distance in bytes between the start of each line.
+ * \param format	Format of the pixels. Must be GB_FRAMEBUFFER_8BPP.
+ */
+void gb_init_framebuffer(struct gb_s *gb, uint8_t *base, size_t stride,
+		enum gb_framebuffer_format_e format);
 #endif
 
 /**
@@ -3837,6 +6836,43 @@ void gb_init_serial(struct gb_s *gb,
 		    enum gb_serial_rx_ret_e (*gb_serial_rx)(struct gb_s*,
 			    uint8_t*));
 
+/**
+ * Registers buffers holding the whole ROM and Cart RAM, so that they are read
+ * and written directly instead of through the callbacks given to gb_init().
+ * The callbacks are still used for any address that is not covered by these
+ * buffers, such as MBC2 RAM, so they must remain valid.
+ * Should be called after gb_init(). The buffers must remain valid until the
+ * emulator context is no longer used.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param rom	Pointer to the ROM file. Set to NULL to use only
+ *		gb_rom_read().
+ * \param rom_size Size of the ROM buffer in bytes.
+ * \param cart_ram Pointer to the Cart RAM. Set to NULL to use only
+ *		gb_cart_ram_read() and gb_cart_ram_write().
+ * \param cart_ram_size Size of the Cart RAM buffer in bytes. Usually the
+ *		value returned by gb_get_save_size().
+ */
+void gb_init_direct(struct gb_s *gb,
+		    const uint8_t *rom, const uint_fast32_t rom_size,
+		    uint8_t *cart_ram, const uint_fast32_t cart_ram_size);
+
+/**
+ * Registers an executable buffer to store code translated from the game by the
+ * JIT. Only available when PEANUT_GB_USE_JIT is defined to a non-zero value.
+ * Until this is called, only the interpreter is used. Translated code may be
+ * ignored at any time by setting gb->direct.interpreter_only.
+ * The buffer must remain valid until the emulator context is no longer used.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param code	Buffer that is writable and executable, such as one mapped
+ *		with PROT_READ | PROT_WRITE | PROT_EXEC.
+ * \param code_size Size of the buffer in bytes. 256 KiB is plenty.
+ */
+#if PEANUT_GB_USE_JIT
+void gb_init_jit(struct gb_s *gb, void *code, size_t code_size);
+#endif
+
 /**
  * Obtains the save size of the game (size of the Cart RAM). Required by the
  * frontend to allocate enough memory for the Cart RAM.
@@ -3881,6 +6917,16 @@ void gb_tick_rtc(struct gb_s *gb);
  */
 void gb_set_rtc(struct gb_s *gb, const struct tm * const time);
 
+/**
+ * Advances the RTC by a number of seconds, unless it is halted. May be used
+ * to account for the time that passed while the emulator was not running,
+ * such as after loading a save file.
+ *
+ * \param gb	An initialised emulator context. Must not be NULL.
+ * \param seconds	Number of seconds to add to the RTC.
+ */
+void gb_advance_rtc(struct gb_s *gb, uint_fast32_t seconds);
+
 /**
  * Use boot ROM on reset. gb_reset() must be called for this to take affect.
  * \param gb 	An initialised emulator context. Must not be NULL.
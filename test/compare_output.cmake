@@ -0,0 +1,22 @@
+# Runs REFERENCE and PROGRAM, and fails unless both succeed and print the same
+# output.
+
+execute_process(COMMAND ${REFERENCE}
+    OUTPUT_VARIABLE reference_output
+    RESULT_VARIABLE reference_result)
+execute_process(COMMAND ${PROGRAM}
+    OUTPUT_VARIABLE program_output
+    RESULT_VARIABLE program_result)
+
+if(NOT reference_result EQUAL 0)
+    message(FATAL_ERROR "${REFERENCE} failed: ${reference_result}")
+endif()
+
+if(NOT program_result EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM} failed: ${program_result}")
+endif()
+
+if(NOT reference_output STREQUAL program_output)
+    message(FATAL_ERROR "Output of ${PROGRAM} differs from ${REFERENCE}:\n"
+        "${reference_output}\n--\n${program_output}")
+endif()
@@ -0,0 +1,182 @@
+/**
+ * Runs the usual OAM DMA routine from HRAM with sources in ROM bank 0, ROM
+ * bank N, VRAM, cart RAM, WRAM and echo RAM, and checks that OAM then holds
+ * what is read from each source a byte at a time. Mapped sources are copied in
+ * one go, and the others through __gb_read().
+ *
+ * With PEANUT_GB_ACCURATE_OAM_DMA, memory below 0xFF00 must read as 0xFF
+ * while the transfer runs, and the transfer must complete after 640 cycles.
+ */
+
+#include "test_common.h"
+
+/* The DMA routine copied to HRAM, called from ROM with the source page in A.
+ * It also reads 0xC000 while the transfer runs, and stores the value read at
+ * PROBE_ADDR. */
+#define ROUTINE_ADDR	0xFF80
+#define SPIN_ADDR	0xFF8D
+#define PROBE_ADDR	0xFF90
+#define CALL_ADDR	0x0150
+#define RETURN_ADDR	0x0153
+
+#define WRAM_VALUE	0x5A
+
+static const uint8_t routine[] = {
+	0xE0, 0x46,		/* LDH (0x46), A */
+	0xFA, 0x00, 0xC0,	/* LD A, (0xC000) */
+	0xE0, 0x90,		/* LDH (0x90), A */
+	0x3E, 0x28,		/* LD A, 40 */
+	0x3D,			/* wait: DEC A */
+	0x20, 0xFD,		/* JR NZ, wait */
+	0xC9,			/* RET */
+	0x18, 0xFE		/* spin: JR spin */
+};
+
+/* Source pages, with cart RAM bank 1 selected. */
+static const uint8_t pages[] = {
+	0x01, 0x45, 0x7F, 0x88, 0x9F, 0xA3, 0xBF, 0xC2, 0xD7, 0xE5, 0xF1
+};
+
+static void build_rom(void)
+{
+	uint_fast32_t i;
+
+	test_rom_init(TEST_CART_MBC3_RTC_RAM);
+
+	TEST_ROM_CODE(CALL_ADDR,
+		0xCD, 0x80, 0xFF,	/* CALL 0xFF80 */
+		0x18, 0xFE);		/* JR 0x0153 */
+
+	for(i = 0x4000; i < sizeof(test_rom); i++)
+		test_rom[i] = test_rand();
+}
+
+/**
+ * Fills VRAM, WRAM and cart RAM with random bytes, selects cart RAM bank 1 and
+ * copies the routine to HRAM.
+ */
+static void fill_memory(struct gb_s *gb)
+{
+	uint_fast32_t i;
+
+	for(i = 0; i < sizeof(test_cart_ram); i++)
+		test_cart_ram[i] = test_rand();
+
+	/* Enable cart RAM and select bank 1. */
+	__gb_write(gb, 0x0000, 0x0A);
+	__gb_write(gb, 0x4000, 0x01);
+
+	for(i = VRAM_ADDR; i < CART_RAM_ADDR; i++)
+		__gb_write(gb, i, test_rand());
+
+	for(i = WRAM_0_ADDR; i < ECHO_ADDR; i++)
+		__gb_write(gb, i, test_rand());
+
+	__gb_write(gb, WRAM_0_ADDR, WRAM_VALUE);
+
+	for(i = 0; i < sizeof(routine); i++)
+		__gb_write(gb, ROUTINE_ADDR + i, routine[i]);
+}
+
+static void read_page(struct gb_s *gb, uint8_t page, uint8_t *out)
+{
+	uint_fast16_t i;
+
+	for(i = 0; i < OAM_SIZE; i++)
+		out[i] = __gb_read(gb, (page << 8) + i);
+}
+
+static void check_oam(struct gb_s *gb, uint8_t page, const uint8_t *expected)
+{
+	uint_fast16_t i;
+
+	for(i = 0; i < OAM_SIZE; i++)
+	{
+		const uint8_t val = __gb_read(gb, OAM_ADDR + i);
+
+		if(val == expected[i])
+			continue;
+
+		fprintf(stderr, "page %02X: OAM byte %u is %02X, expected %02X\n",
+				page, (unsigned)i, val, expected[i]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Calls the routine with the given source page from ROM.
+ */
+static void run_routine(struct gb_s *gb, uint8_t page)
+{
+	uint8_t expected[OAM_SIZE];
+
+	read_page(gb, page, expected);
+
+	gb->cpu_reg.a = page;
+	gb->cpu_reg.sp.reg = 0xFFFE;
+	gb->cpu_reg.pc.reg = CALL_ADDR;
+	gb_run_cycles(gb, 1000, false);
+	TEST_CHECK(gb->cpu_reg.pc.reg == RETURN_ADDR);
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	TEST_CHECK(__gb_read(gb, PROBE_ADDR) == 0xFF);
+#else
+	TEST_CHECK(__gb_read(gb, PROBE_ADDR) == WRAM_VALUE);
+#endif
+	check_oam(gb, page, expected);
+}
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+/**
+ * Starts a transfer from the given source page while the CPU spins in HRAM,
+ * and checks memory every few cycles until it completes.
+ */
+static void check_transfer(struct gb_s *gb, uint8_t page)
+{
+	uint8_t expected[OAM_SIZE];
+	uint64_t start;
+	uint_fast16_t i;
+
+	read_page(gb, page, expected);
+
+	for(i = 0; i < OAM_SIZE; i++)
+		gb->oam[i] = ~expected[i];
+
+	gb->cpu_reg.pc.reg = SPIN_ADDR;
+	__gb_write(gb, 0xFF00 | IO_DMA, page);
+	start = gb_get_cycles(gb);
+
+	while(gb_get_cycles(gb) - start < OAM_SIZE * DMA_BYTE_CYCLES)
+	{
+		TEST_CHECK(__gb_read(gb, WRAM_0_ADDR) == 0xFF);
+		TEST_CHECK(__gb_read(gb, VRAM_ADDR) == 0xFF);
+		TEST_CHECK(__gb_read(gb, OAM_ADDR) == 0xFF);
+		TEST_CHECK(__gb_read(gb, 0x0000) == 0xFF);
+		TEST_CHECK(gb->oam[OAM_SIZE - 1] != expected[OAM_SIZE - 1]);
+		gb_run_cycles(gb, 4, false);
+	}
+
+	TEST_CHECK(__gb_read(gb, WRAM_0_ADDR) == WRAM_VALUE);
+	check_oam(gb, page, expected);
+}
+#endif
+
+int main(void)
+{
+	static struct gb_s gb;
+	size_t i;
+
+	build_rom();
+	test_gb_init(&gb);
+	fill_memory(&gb);
+
+	for(i = 0; i < sizeof(pages); i++)
+		run_routine(&gb, pages[i]);
+
+#if PEANUT_GB_ACCURATE_OAM_DMA
+	for(i = 0; i < sizeof(pages); i++)
+		check_transfer(&gb, pages[i]);
+#endif
+
+	return EXIT_SUCCESS;
+}
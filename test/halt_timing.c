@@ -0,0 +1,125 @@
+/**
+ * Checks that a HALT ends on the exact cycle that the interrupt waking it is
+ * raised, for the LY=LYC and mode 2 STAT interrupts and for the timer.
+ */
+
+#include "test_common.h"
+
+#define WAKES			16
+
+/* Interrupt handlers execute a NOP before returning. */
+#define HANDLER_CYCLES		4
+
+/* Cycles between overflows of TIMA with TAC 0x05 and TMA 0xF0. */
+#define TIMER_PERIOD		(16 * 16)
+
+/**
+ * The CPU halts in a loop, with the interrupts in ie enabled. The handlers of
+ * the STAT and timer interrupts return after a NOP.
+ */
+static void build_rom(uint8_t stat, uint8_t ie)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	TEST_ROM_CODE(0x0048,
+		0x00,			/* NOP */
+		0xD9);			/* RETI */
+
+	TEST_ROM_CODE(0x0050,
+		0x00,			/* NOP */
+		0xD9);			/* RETI */
+
+	TEST_ROM_CODE(0x0150,
+		0x3E, 0x10,		/* LD A, 0x10 */
+		0xE0, 0x45,		/* LDH (LYC), A */
+		0x3E, stat,		/* LD A, stat */
+		0xE0, 0x41,		/* LDH (STAT), A */
+		0x3E, 0xF0,		/* LD A, 0xF0 */
+		0xE0, 0x06,		/* LDH (TMA), A */
+		0xE0, 0x05,		/* LDH (TIMA), A */
+		0x3E, 0x05,		/* LD A, 0x05 */
+		0xE0, 0x07,		/* LDH (TAC), A */
+		0x3E, ie,		/* LD A, ie */
+		0xE0, 0xFF,		/* LDH (IE), A */
+		0xFB,			/* EI */
+		0x76,			/* wait: HALT */
+		0x18, 0xFD);		/* JR wait */
+}
+
+/**
+ * Runs one instruction at a time, and stores the cycle of each of the first
+ * WAKES interrupts to wake the CPU, taken after the NOP of the handler.
+ */
+static void run(struct gb_s *gb, uint64_t *wake)
+{
+	uint_fast8_t n = 0;
+
+	test_gb_init(gb);
+
+	while(n < WAKES)
+	{
+		gb_run_cycles(gb, 1, false);
+
+		if(gb->cpu_reg.pc.reg == 0x0049 || gb->cpu_reg.pc.reg == 0x0051)
+			wake[n++] = gb_get_cycles(gb) - HANDLER_CYCLES;
+	}
+}
+
+static void test_lyc(void)
+{
+	static struct gb_s gb;
+	uint64_t wake[WAKES];
+	uint_fast8_t i;
+
+	build_rom(STAT_LYC_INTR, LCDC_INTR);
+	run(&gb, wake);
+
+	/* The last wake is at the start of line LYC. */
+	TEST_CHECK(gb.hram_io[IO_LY] == 0x10);
+	TEST_CHECK(gb.counter.cycles - gb.counter.lcd_line_start ==
+			HANDLER_CYCLES);
+
+	for(i = 1; i < WAKES; i++)
+		TEST_CHECK(wake[i] - wake[i - 1] ==
+				LCD_LINE_CYCLES * LCD_VERT_LINES);
+}
+
+static void test_mode_2(void)
+{
+	static struct gb_s gb;
+	uint64_t wake[WAKES];
+	uint_fast8_t i;
+
+	build_rom(STAT_MODE_2_INTR, LCDC_INTR);
+	run(&gb, wake);
+
+	TEST_CHECK((gb.hram_io[IO_STAT] & STAT_MODE) ==
+			IO_STAT_MODE_SEARCH_OAM);
+	TEST_CHECK(gb.counter.cycles - gb.counter.lcd_line_start ==
+			LCD_MODE_2_CYCLES + HANDLER_CYCLES);
+
+	/* Mode 2 does not occur during VBlank. */
+	for(i = 1; i < WAKES; i++)
+		TEST_CHECK(wake[i] - wake[i - 1] == LCD_LINE_CYCLES);
+}
+
+static void test_timer(void)
+{
+	static struct gb_s gb;
+	uint64_t wake[WAKES];
+	uint_fast8_t i;
+
+	build_rom(0, TIMER_INTR);
+	run(&gb, wake);
+
+	for(i = 1; i < WAKES; i++)
+		TEST_CHECK(wake[i] - wake[i - 1] == TIMER_PERIOD);
+}
+
+int main(void)
+{
+	test_lyc();
+	test_mode_2();
+	test_timer();
+	return EXIT_SUCCESS;
+}
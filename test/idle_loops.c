@@ -0,0 +1,135 @@
+/**
+ * Runs a ROM that waits in loops polling HRAM and LY, with several cycle
+ * budgets passed to gb_run_cycles(). Every budget must give the same frames,
+ * and no run may end more than one instruction past its budget. The output is
+ * compared with a build without PEANUT_GB_SKIP_IDLE_LOOPS, which must run
+ * every iteration of the loops to the same result.
+ */
+
+#include "test_common.h"
+
+/* Longest instruction, which may start just before the end of a run. */
+#define MAX_INSTRUCTION_CYCLES	24
+
+#define FRAMES			8
+
+static uint32_t line_hash;
+
+static void lcd_draw_line(struct gb_s *gb, const uint8_t *pixels,
+		const uint_fast8_t line)
+{
+	const uint64_t cycles = gb_get_cycles(gb);
+
+	line_hash = test_hash(line_hash, &cycles, sizeof(cycles));
+	line_hash = test_hash(line_hash, &line, sizeof(line));
+	line_hash = test_hash(line_hash, pixels, LCD_WIDTH);
+}
+
+static void build_rom(void)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	/* VBlank handler: increment the frame counter in HRAM. */
+	TEST_ROM_CODE(0x0040,
+		0xF5,			/* PUSH AF */
+		0xF0, 0x80,		/* LDH A, (0x80) */
+		0x3C,			/* INC A */
+		0xE0, 0x80,		/* LDH (0x80), A */
+		0xF1,			/* POP AF */
+		0xD9);			/* RETI */
+
+	TEST_ROM_CODE(0x0150,
+		/* Give tile 0 a pattern. */
+		0x21, 0x00, 0x80,	/* LD HL, 0x8000 */
+		0x06, 0x10,		/* LD B, 16 */
+		0x7D,			/* fill: LD A, L */
+		0x22,			/* LD (HL+), A */
+		0x05,			/* DEC B */
+		0x20, 0xFB,		/* JR NZ, fill */
+		0x3E, 0x01,		/* LD A, VBLANK_INTR */
+		0xE0, 0xFF,		/* LDH (IE), A */
+		0xAF,			/* XOR A */
+		0xE0, 0x80,		/* LDH (0x80), A */
+		0x47,			/* LD B, A */
+		0xFB,			/* EI */
+		/* Wait for the VBlank handler. */
+		0xF0, 0x80,		/* main: LDH A, (0x80) */
+		0xB8,			/* CP B */
+		0x28, 0xFB,		/* JR Z, main */
+		0x47,			/* LD B, A */
+		0x21, 0x43, 0xFF,	/* LD HL, SCX */
+		0x34,			/* INC (HL) */
+		/* Wait for line 64, then change the palette. */
+		0xF0, 0x44,		/* wait_ly: LDH A, (LY) */
+		0xFE, 0x40,		/* CP 64 */
+		0x20, 0xFA,		/* JR NZ, wait_ly */
+		0xF0, 0x47,		/* LDH A, (BGP) */
+		0x07,			/* RLCA */
+		0x07,			/* RLCA */
+		0xE0, 0x47,		/* LDH (BGP), A */
+		0x18, 0xE8);		/* JR main */
+}
+
+/**
+ * Runs FRAMES frames in slices of budget cycles, and prints the state at the
+ * start of each VBlank to out.
+ */
+static void run(uint_fast32_t budget, char *out, size_t size)
+{
+	static struct gb_s gb;
+	unsigned frame = 0;
+	size_t len = 0;
+
+	test_gb_init(&gb);
+	gb_init_lcd(&gb, &lcd_draw_line);
+	line_hash = TEST_HASH_INIT;
+
+	while(frame < FRAMES)
+	{
+		const uint_fast32_t ran = gb_run_cycles(&gb, budget, true);
+
+		TEST_CHECK(ran < budget + MAX_INSTRUCTION_CYCLES);
+
+		if(!gb.gb_frame)
+		{
+			TEST_CHECK(ran >= budget);
+			continue;
+		}
+
+		len += snprintf(out + len, size - len,
+				"frame %u cycles %llu pc %04X b %02X lines %08X\n",
+				frame, (unsigned long long)gb_get_cycles(&gb),
+				gb.cpu_reg.pc.reg, gb.cpu_reg.bc.bytes.b,
+				(unsigned)line_hash);
+		TEST_CHECK(len < size);
+		frame++;
+	}
+
+	TEST_CHECK(gb_get_skipped_cycles(&gb) < gb_get_cycles(&gb));
+#if PEANUT_GB_SKIP_IDLE_LOOPS
+	/* Shorter runs end before a loop has repeated. */
+	if(budget >= 100)
+		TEST_CHECK(gb_get_skipped_cycles(&gb) > 0);
+#else
+	TEST_CHECK(gb_get_skipped_cycles(&gb) == 0);
+#endif
+}
+
+int main(void)
+{
+	static const uint_fast32_t budgets[] = { 7, 100, 456, 70224 };
+	static char expected[4096], out[4096];
+	size_t i;
+
+	build_rom();
+	run(70224, expected, sizeof(expected));
+
+	for(i = 0; i < sizeof(budgets) / sizeof(*budgets); i++)
+	{
+		run(budgets[i], out, sizeof(out));
+		TEST_CHECK(strcmp(expected, out) == 0);
+	}
+
+	fputs(expected, stdout);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/**
+ * Switches ROM and cart RAM banks of MBC1 in both banking modes and with the
+ * upper bank bits, MBC3 with its RTC registers, and MBC5 with bit 8 of the
+ * ROM bank. After each switch, a hash of ROM and cart RAM read through
+ * __gb_read() is printed, and bytes are written to cart RAM. The output is
+ * compared with a build that maps ROM and cart RAM with gb_init_direct(),
+ * which must read and write the same bytes as the callbacks.
+ */
+
+/* 8 MiB, so that bit 8 of the MBC5 ROM bank selects a bank. */
+#define TEST_ROM_BANKS		512
+
+#include "test_common.h"
+
+struct mbc_write
+{
+	uint16_t addr;
+	uint8_t val;
+};
+
+/* Writes to the MBC registers. The ROM bank is selected at 0x2000, the RAM bank
+ * or upper ROM bank bits at 0x4000, and the MBC1 banking mode or MBC3 latch at
+ * 0x6000. Cart RAM is enabled by writing 0x0A to 0x0000. */
+static const struct mbc_write mbc1_writes[] = {
+	{ 0x0000, 0x0A }, { 0x2000, 0x05 }, { 0x2000, 0x00 }, { 0x2000, 0x1F },
+	{ 0x4000, 0x01 }, { 0x4000, 0x03 }, { 0x6000, 0x01 }, { 0x4000, 0x02 },
+	{ 0x2000, 0x00 }, { 0x2000, 0x13 }, { 0x6000, 0x00 }, { 0x0000, 0x00 },
+	{ 0x2000, 0x07 }, { 0x0000, 0x0A }
+};
+
+static const struct mbc_write mbc3_writes[] = {
+	{ 0x0000, 0x0A }, { 0x2000, 0x00 }, { 0x2000, 0x7F }, { 0x2000, 0x25 },
+	{ 0x4000, 0x01 }, { 0x4000, 0x03 }, { 0x4000, 0x08 }, { 0x6000, 0x00 },
+	{ 0x6000, 0x01 }, { 0x4000, 0x02 }, { 0x0000, 0x00 }, { 0x2000, 0x41 },
+	{ 0x0000, 0x0A }
+};
+
+static const struct mbc_write mbc5_writes[] = {
+	{ 0x0000, 0x0A }, { 0x2000, 0x00 }, { 0x3000, 0x01 }, { 0x2000, 0xFF },
+	{ 0x4000, 0x03 }, { 0x3000, 0x00 }, { 0x4000, 0x05 }, { 0x2000, 0x80 },
+	{ 0x4000, 0x01 }, { 0x3000, 0x01 }, { 0x0000, 0x00 }, { 0x2000, 0x12 },
+	{ 0x0000, 0x0A }
+};
+
+/**
+ * Returns a hash of the bytes read from addr up to end.
+ */
+static uint32_t hash_reads(struct gb_s *gb, uint_fast16_t addr,
+		uint_fast32_t end)
+{
+	uint32_t h = TEST_HASH_INIT;
+
+	for(; addr < end; addr++)
+	{
+		const uint8_t val = __gb_read(gb, addr);
+
+		h = test_hash(h, &val, sizeof(val));
+	}
+
+	return h;
+}
+
+static void test_mbc(const char *name, uint8_t cart_type,
+		const struct mbc_write *writes, size_t count)
+{
+	static struct gb_s gb;
+	uint_fast32_t i;
+
+	test_rom_init(cart_type);
+
+	for(i = 0x4000; i < sizeof(test_rom); i++)
+		test_rom[i] = test_rand();
+
+	for(i = 0; i < sizeof(test_cart_ram); i++)
+		test_cart_ram[i] = test_rand();
+
+	test_gb_init(&gb);
+
+	for(i = 0; i < count; i++)
+	{
+		__gb_write(&gb, writes[i].addr, writes[i].val);
+
+#if TEST_DIRECT
+		/* Every bank that can be selected is in the buffer. */
+		TEST_CHECK(gb.map.read[0x4] != NULL);
+#endif
+
+		printf("%s %04X=%02X rom0 %08lX romx %08lX ram %08lX\n",
+				name, writes[i].addr, writes[i].val,
+				(unsigned long)hash_reads(&gb, 0x0000, 0x4000),
+				(unsigned long)hash_reads(&gb, 0x4000, VRAM_ADDR),
+				(unsigned long)hash_reads(&gb, CART_RAM_ADDR,
+					WRAM_0_ADDR));
+
+		__gb_write(&gb, CART_RAM_ADDR + i * 0x0101, i);
+		__gb_write(&gb, WRAM_0_ADDR - 1 - i, ~i);
+	}
+
+	printf("%s cart ram %08lX\n", name, (unsigned long)test_hash(
+			TEST_HASH_INIT, test_cart_ram, sizeof(test_cart_ram)));
+}
+
+int main(void)
+{
+	test_mbc("mbc1", TEST_CART_MBC1_RAM, mbc1_writes,
+			sizeof(mbc1_writes) / sizeof(*mbc1_writes));
+	test_mbc("mbc3", TEST_CART_MBC3_RTC_RAM, mbc3_writes,
+			sizeof(mbc3_writes) / sizeof(*mbc3_writes));
+	test_mbc("mbc5", TEST_CART_MBC5_RAM, mbc5_writes,
+			sizeof(mbc5_writes) / sizeof(*mbc5_writes));
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+/**
+ * Draws frames of random tiles, maps and sprites, and prints a hash of the
+ * pixels of each frame. The LCD registers, VRAM and OAM are also written at
+ * random cycles while the frame is drawn. The output is compared between
+ * builds with different renderer options, which must draw the same pixels.
+ *
+ * With TEST_FRAMEBUFFER, a second emulator draws to a frame buffer with
+ * gb_init_framebuffer() in step with the first. After every run, including
+ * runs that end partway through a frame, the frame buffer must hold the same
+ * pixels as the lines passed to lcd_draw_line() by the first.
+ */
+
+#include "test_common.h"
+
+#define FRAMES			16
+
+/* Writes made while each frame is drawn. */
+#define WRITES_PER_FRAME	64
+
+/* Distance between the lines of the frame buffers, as in the 256 pixel wide
+ * texture of the PSP front end. The bytes past the end of each line must not
+ * be written. */
+#define FRAMEBUFFER_STRIDE	256
+#define FRAMEBUFFER_FILL	0xAA
+
+#if TEST_FRAMEBUFFER
+# define EMULATORS		2
+#else
+# define EMULATORS		1
+#endif
+
+static struct gb_s emu[EMULATORS];
+
+static uint32_t frame_hash;
+static unsigned frame_lines;
+
+/* Lines passed to lcd_draw_line(), and lines drawn by the core. */
+static uint8_t lines[LCD_HEIGHT * FRAMEBUFFER_STRIDE];
+#if TEST_FRAMEBUFFER
+static uint8_t framebuffer[LCD_HEIGHT * FRAMEBUFFER_STRIDE];
+#endif
+
+static void lcd_draw_line(struct gb_s *gb, const uint8_t *pixels,
+		const uint_fast8_t line)
+{
+	(void)gb;
+	frame_hash = test_hash(frame_hash, &line, sizeof(line));
+	frame_hash = test_hash(frame_hash, pixels, LCD_WIDTH);
+	frame_lines++;
+
+	memcpy(&lines[line * FRAMEBUFFER_STRIDE], pixels, LCD_WIDTH);
+}
+
+/**
+ * Writes val to addr in every emulator.
+ */
+static void write_all(uint_fast16_t addr, uint8_t val)
+{
+	unsigned i;
+
+	for(i = 0; i < EMULATORS; i++)
+		__gb_write(&emu[i], addr, val);
+}
+
+/**
+ * Runs every emulator for a number of cycles, stopping at VBlank, and checks
+ * that the frame buffer holds the same lines as were passed to
+ * lcd_draw_line().
+ */
+static void run_all(uint_fast32_t cycles)
+{
+	uint_fast32_t ran[EMULATORS];
+	unsigned i;
+
+	for(i = 0; i < EMULATORS; i++)
+		ran[i] = gb_run_cycles(&emu[i], cycles, true);
+
+#if TEST_FRAMEBUFFER
+	TEST_CHECK(ran[1] == ran[0] && emu[1].gb_frame == emu[0].gb_frame);
+	TEST_CHECK(memcmp(framebuffer, lines, sizeof(lines)) == 0);
+#else
+	(void)ran;
+#endif
+}
+
+/**
+ * Writes a random value to one of the registers that change how lines are
+ * drawn. The LCD is kept on.
+ */
+static void write_lcd_register(void)
+{
+	static const uint16_t reg[] = {
+		0xFF40, /* LCDC */
+		0xFF42, /* SCY */
+		0xFF43, /* SCX */
+		0xFF47, /* BGP */
+		0xFF48, /* OBP0 */
+		0xFF49, /* OBP1 */
+		0xFF4A, /* WY */
+		0xFF4B  /* WX */
+	};
+	const uint16_t addr = reg[test_rand() % (sizeof(reg) / sizeof(*reg))];
+	uint8_t val = test_rand();
+
+	if(addr == 0xFF40)
+		val |= LCDC_ENABLE;
+
+	write_all(addr, val);
+}
+
+/**
+ * Fills VRAM and OAM with random values, and sets the LCD registers.
+ */
+static void randomise(void)
+{
+	uint_fast16_t addr;
+
+	for(addr = 0x8000; addr < 0xA000; addr++)
+		write_all(addr, test_rand());
+
+	/* Sprites are placed on or near the screen. */
+	for(addr = 0xFE00; addr < 0xFEA0; addr += 4)
+	{
+		write_all(addr + 0, test_rand() % (LCD_HEIGHT + 32));
+		write_all(addr + 1, test_rand() % (LCD_WIDTH + 16));
+		write_all(addr + 2, test_rand());
+		write_all(addr + 3, test_rand());
+	}
+
+	for(addr = 0; addr < 8; addr++)
+		write_lcd_register();
+}
+
+int main(void)
+{
+	unsigned frame, i;
+
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	/* JR -2 */
+	TEST_ROM_CODE(0x0150, 0x18, 0xFE);
+
+	memset(lines, FRAMEBUFFER_FILL, sizeof(lines));
+
+	for(i = 0; i < EMULATORS; i++)
+		test_gb_init(&emu[i]);
+
+	gb_init_lcd(&emu[0], &lcd_draw_line);
+
+#if TEST_FRAMEBUFFER
+	memset(framebuffer, FRAMEBUFFER_FILL, sizeof(framebuffer));
+	gb_init_framebuffer(&emu[1], framebuffer, FRAMEBUFFER_STRIDE,
+			GB_FRAMEBUFFER_8BPP);
+#endif
+
+	/* Start at VBlank. */
+	do
+		run_all(LCD_LINE_CYCLES);
+	while(!emu[0].gb_frame);
+
+	for(frame = 0; frame < FRAMES; frame++)
+	{
+		unsigned writes = 0;
+
+		frame_hash = TEST_HASH_INIT;
+		frame_lines = 0;
+		randomise();
+
+		/* The first frames are drawn without writes in between. */
+		do
+		{
+			run_all(1 + test_rand() % 2048);
+
+			if(emu[0].gb_frame || frame < FRAMES / 4 ||
+					writes == WRITES_PER_FRAME)
+				continue;
+
+			switch(test_rand() % 4)
+			{
+			case 0:
+				write_all(0x8000 + test_rand() % 0x2000,
+						test_rand());
+				break;
+
+			case 1:
+				write_all(0xFE00 + test_rand() % OAM_SIZE,
+						test_rand());
+				break;
+
+			default:
+				write_lcd_register();
+				break;
+			}
+
+			writes++;
+		}
+		while(!emu[0].gb_frame);
+
+		TEST_CHECK(frame_lines == LCD_HEIGHT);
+		printf("frame %u %08X\n", frame, (unsigned)frame_hash);
+	}
+
+	return EXIT_SUCCESS;
+}
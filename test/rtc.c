@@ -0,0 +1,220 @@
+/**
+ * Checks the MBC3 RTC, which adds the seconds that passed to its registers in
+ * closed form, against ticking the registers one second at a time as the
+ * hardware does. Registers start at random values, including invalid values
+ * past the period of each counter, and the day counter overflow.
+ */
+
+#include "test_common.h"
+
+#define FUZZ_RUNS		2000
+
+/* Frames to run with the emulated clock, a little over three seconds. */
+#define FRAMES			200
+
+/**
+ * Ticks the registers by one second. Invalid values count up to the width of
+ * the register and wrap to 0 without a carry.
+ */
+static void tick(union cart_rtc *rtc)
+{
+	if(rtc->reg.sec == 63)
+	{
+		rtc->reg.sec = 0;
+		return;
+	}
+
+	if(++rtc->reg.sec != 60)
+		return;
+
+	rtc->reg.sec = 0;
+
+	if(rtc->reg.min == 63)
+	{
+		rtc->reg.min = 0;
+		return;
+	}
+
+	if(++rtc->reg.min != 60)
+		return;
+
+	rtc->reg.min = 0;
+
+	if(rtc->reg.hour == 31)
+	{
+		rtc->reg.hour = 0;
+		return;
+	}
+
+	if(++rtc->reg.hour != 24)
+		return;
+
+	rtc->reg.hour = 0;
+
+	if(++rtc->reg.yday != 0)
+		return;
+
+	/* Bit 8 of the day counter carries to the overflow bit. */
+	if(rtc->reg.high & 0x01)
+		rtc->reg.high |= 0x80;
+
+	rtc->reg.high ^= 0x01;
+}
+
+static void set_rtc(struct gb_s *gb, const union cart_rtc *rtc)
+{
+	memcpy(gb->rtc_real.bytes, rtc->bytes, sizeof(rtc->bytes));
+}
+
+static void check_rtc(const struct gb_s *gb, const union cart_rtc *expected)
+{
+	if(memcmp(gb->rtc_real.bytes, expected->bytes,
+			sizeof(expected->bytes)) == 0)
+		return;
+
+	fprintf(stderr, "rtc %02X:%02X:%02X day %02X high %02X, "
+			"expected %02X:%02X:%02X day %02X high %02X\n",
+			gb->rtc_real.reg.hour, gb->rtc_real.reg.min,
+			gb->rtc_real.reg.sec, gb->rtc_real.reg.yday,
+			gb->rtc_real.reg.high, expected->reg.hour,
+			expected->reg.min, expected->reg.sec,
+			expected->reg.yday, expected->reg.high);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Returns registers at random values that each fit the width of the
+ * register. The RTC is running.
+ */
+static union cart_rtc random_rtc(void)
+{
+	union cart_rtc rtc;
+
+	rtc.reg.sec = test_rand() % 64;
+	rtc.reg.min = test_rand() % 64;
+	rtc.reg.hour = test_rand() % 32;
+	rtc.reg.yday = test_rand() % 256;
+	rtc.reg.high = test_rand() & 0x81;
+	return rtc;
+}
+
+/**
+ * Advances the RTC with gb_advance_rtc() by random numbers of seconds, from
+ * single seconds to several days.
+ */
+static void test_advance(struct gb_s *gb)
+{
+	static const uint_fast32_t max_seconds[] = {
+		2, 64, 3600, 86400, 3 * 86400
+	};
+	uint_fast32_t i;
+
+	for(i = 0; i < FUZZ_RUNS; i++)
+	{
+		union cart_rtc expected = random_rtc();
+		const uint_fast32_t seconds = test_rand() %
+			max_seconds[i % (sizeof(max_seconds) /
+					 sizeof(*max_seconds))];
+		uint_fast32_t s;
+
+		set_rtc(gb, &expected);
+		gb_advance_rtc(gb, seconds);
+
+		for(s = 0; s < seconds; s++)
+			tick(&expected);
+
+		check_rtc(gb, &expected);
+	}
+}
+
+/**
+ * Checks the carry from each counter up to the overflow of the day counter,
+ * which sets bit 7 of the high register and keeps it set.
+ */
+static void test_day_overflow(struct gb_s *gb)
+{
+	union cart_rtc rtc = { { 59, 59, 23, 0xFF, 0x00 } };
+	union cart_rtc expected;
+
+	/* Bit 8 of the day counter. */
+	set_rtc(gb, &rtc);
+	gb_advance_rtc(gb, 1);
+	expected = (union cart_rtc){ { 0, 0, 0, 0x00, 0x01 } };
+	check_rtc(gb, &expected);
+
+	/* Overflow past day 511. */
+	gb_advance_rtc(gb, 256UL * 86400 - 1);
+	expected = (union cart_rtc){ { 59, 59, 23, 0xFF, 0x01 } };
+	check_rtc(gb, &expected);
+
+	gb_advance_rtc(gb, 1);
+	expected = (union cart_rtc){ { 0, 0, 0, 0x00, 0x80 } };
+	check_rtc(gb, &expected);
+
+	/* The overflow bit stays set until it is written. */
+	gb_advance_rtc(gb, 256UL * 86400);
+	expected = (union cart_rtc){ { 0, 0, 0, 0x00, 0x81 } };
+	check_rtc(gb, &expected);
+
+	gb_advance_rtc(gb, 256UL * 86400);
+	expected = (union cart_rtc){ { 0, 0, 0, 0x00, 0x80 } };
+	check_rtc(gb, &expected);
+
+	/* Invalid values wrap without a carry. */
+	rtc = (union cart_rtc){ { 63, 63, 31, 0xFF, 0x01 } };
+	set_rtc(gb, &rtc);
+	gb_advance_rtc(gb, 1);
+	expected = (union cart_rtc){ { 0, 63, 31, 0xFF, 0x01 } };
+	check_rtc(gb, &expected);
+
+	/* A halted RTC does not count. */
+	rtc = (union cart_rtc){ { 10, 20, 5, 0x40, 0x41 } };
+	set_rtc(gb, &rtc);
+	gb_advance_rtc(gb, 1000);
+	check_rtc(gb, &rtc);
+}
+
+/**
+ * Runs the emulator so that the RTC counts emulated clock cycles, starting
+ * just before the overflow of the day counter.
+ */
+static void test_emulated(void)
+{
+	static struct gb_s gb;
+	union cart_rtc rtc = { { 58, 59, 23, 0xFF, 0x01 } };
+	uint_fast32_t seconds, s, frame;
+
+	test_gb_init(&gb);
+	set_rtc(&gb, &rtc);
+
+	for(frame = 0; frame < FRAMES; frame++)
+		gb_run_frame(&gb);
+
+	/* Add the seconds counted so far to the registers. */
+	gb_advance_rtc(&gb, 0);
+
+	seconds = (uint_fast32_t)(gb_get_cycles(&gb) / RTC_CYCLES);
+	TEST_CHECK(seconds >= 3);
+
+	for(s = 0; s < seconds; s++)
+		tick(&rtc);
+
+	check_rtc(&gb, &rtc);
+}
+
+int main(void)
+{
+	static struct gb_s gb;
+
+	test_rom_init(TEST_CART_MBC3_RTC_RAM);
+
+	/* JR -2 */
+	TEST_ROM_CODE(0x0150, 0x18, 0xFE);
+
+	test_gb_init(&gb);
+	test_advance(&gb);
+	test_day_overflow(&gb);
+	test_emulated();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,426 @@
+/**
+ * Checks that gb_run_cycles() never runs more than one instruction past the
+ * cycles it is given, while the CPU waits in HALT with the LCD off, while it
+ * runs code translated by the JIT, while it runs pairs of instructions that
+ * are fused into superinstructions and while it runs ALU, DAA and CB prefixed
+ * instructions that store the flags to WRAM, and while it runs code in WRAM
+ * and HRAM that is patched between and during calls. Every budget must give
+ * the same results, which are compared between builds with and without the
+ * JIT, the block cache, superinstructions and lazy flags.
+ */
+
+#include "test_common.h"
+
+#if PEANUT_GB_USE_JIT
+# include <sys/mman.h>
+#endif
+
+/* Longest instruction, which may start just before the end of a run. */
+#define MAX_INSTRUCTION_CYCLES	24
+
+#define HALT_WAKES		32
+#define FRAMES			4
+
+static const uint_fast32_t budgets[] = { 7, 100, 456, 70224 };
+
+/**
+ * Runs budget cycles and checks that the run ends within one instruction of
+ * the budget.
+ */
+static void run_budget(struct gb_s *gb, uint_fast32_t budget,
+		bool stop_at_vblank)
+{
+	const uint_fast32_t ran = gb_run_cycles(gb, budget, stop_at_vblank);
+
+	TEST_CHECK(ran < budget + MAX_INSTRUCTION_CYCLES);
+
+	if(!gb->gb_frame || !stop_at_vblank)
+		TEST_CHECK(ran >= budget);
+}
+
+/**
+ * The LCD is turned off and the CPU halts until the timer interrupt, whose
+ * handler stores DIV to WRAM. The timer overflows every 320 cycles, which does
+ * not divide the 256 cycles of a DIV increment, so waking at the wrong cycle
+ * stores different values.
+ */
+static void build_halt_rom(void)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	/* Timer handler: store DIV at HL. */
+	TEST_ROM_CODE(0x0050,
+		0xF5,			/* PUSH AF */
+		0xF0, 0x04,		/* LDH A, (DIV) */
+		0x22,			/* LD (HL+), A */
+		0xF1,			/* POP AF */
+		0xD9);			/* RETI */
+
+	TEST_ROM_CODE(0x0150,
+		0xAF,			/* XOR A */
+		0xE0, 0x40,		/* LDH (LCDC), A */
+		0x21, 0x00, 0xC0,	/* LD HL, 0xC000 */
+		0x3E, 0xFB,		/* LD A, 0xFB */
+		0xE0, 0x06,		/* LDH (TMA), A */
+		0xE0, 0x05,		/* LDH (TIMA), A */
+		0x3E, 0x06,		/* LD A, 0x06 */
+		0xE0, 0x07,		/* LDH (TAC), A */
+		0x3E, 0x04,		/* LD A, TIMER_INTR */
+		0xE0, 0xFF,		/* LDH (IE), A */
+		0xFB,			/* EI */
+		0x76,			/* wait: HALT */
+		0x18, 0xFD);		/* JR wait */
+}
+
+static void run_halt(uint_fast32_t budget, char *out, size_t size)
+{
+	static struct gb_s gb;
+	size_t len = 0;
+	uint_fast16_t i;
+
+	test_gb_init(&gb);
+
+	while(gb.cpu_reg.hl.reg < 0xC000 + HALT_WAKES)
+		run_budget(&gb, budget, false);
+
+	for(i = 0; i < HALT_WAKES; i++)
+	{
+		len += snprintf(out + len, size - len, "%02X%c",
+				gb.wram[i], i % 16 == 15 ? '\n' : ' ');
+		TEST_CHECK(len < size);
+	}
+}
+
+/**
+ * A loop of instructions that only use CPU registers, which the JIT
+ * translates.
+ */
+static void build_jit_rom(void)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	TEST_ROM_CODE(0x0150,
+		0x01, 0x34, 0x12,	/* LD BC, 0x1234 */
+		0x11, 0x78, 0x56,	/* LD DE, 0x5678 */
+		0x3C,			/* loop: INC A */
+		0x80,			/* ADD A, B */
+		0x4F,			/* LD C, A */
+		0x15,			/* DEC D */
+		0xCE, 0x07,		/* ADC A, 0x07 */
+		0xA9,			/* XOR C */
+		0x13,			/* INC DE */
+		0x47,			/* LD B, A */
+		0x91,			/* SUB A, C */
+		0x1C,			/* INC E */
+		0x60,			/* LD H, B */
+		0x6B,			/* LD L, E */
+		0x23,			/* INC HL */
+		0xB2,			/* OR D */
+		0x0B,			/* DEC BC */
+		0x98,			/* SBC A, B */
+		0x18, 0xEC);		/* JR loop */
+}
+
+/**
+ * Runs FRAMES frames, and prints the registers at the end of each.
+ */
+static void run_frames(struct gb_s *gb, uint_fast32_t budget, char *out,
+		size_t size)
+{
+	unsigned frame = 0;
+	size_t len = 0;
+
+	while(frame < FRAMES)
+	{
+		run_budget(gb, budget, true);
+
+		if(!gb->gb_frame)
+			continue;
+
+		len += snprintf(out + len, size - len,
+				"frame %u cycles %llu pc %04X a %02X bc %04X "
+				"de %04X hl %04X\n",
+				frame, (unsigned long long)gb_get_cycles(gb),
+				gb->cpu_reg.pc.reg, gb->cpu_reg.a,
+				gb->cpu_reg.bc.reg, gb->cpu_reg.de.reg,
+				gb->cpu_reg.hl.reg);
+		TEST_CHECK(len < size);
+		frame++;
+	}
+}
+
+static void run_jit(uint_fast32_t budget, char *out, size_t size)
+{
+	static struct gb_s gb;
+
+	test_gb_init(&gb);
+
+#if PEANUT_GB_USE_JIT
+	{
+		static void *code = NULL;
+		const size_t code_size = 0x10000;
+
+		if(code == NULL)
+		{
+			code = mmap(NULL, code_size,
+					PROT_READ | PROT_WRITE | PROT_EXEC,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			TEST_CHECK(code != MAP_FAILED);
+		}
+
+		gb_init_jit(&gb, code, code_size);
+	}
+#endif
+
+	run_frames(&gb, budget, out, size);
+
+#if PEANUT_GB_USE_JIT
+	TEST_CHECK(gb.jit.used > 0);
+#endif
+}
+
+/**
+ * Nested loops that contain each pair of instructions that is run as a
+ * superinstruction, with their branches both taken and not taken. Bytes are
+ * copied from all of the memory map to WRAM.
+ */
+static void build_fused_rom(void)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	TEST_ROM_CODE(0x0150,
+		0x21, 0x00, 0x01,	/* LD HL, 0x0100 */
+		0x11, 0x00, 0xD0,	/* LD DE, 0xD000 */
+		0x0E, 0x03,		/* outer: LD C, 3 */
+		0x06, 0x05,		/* mid: LD B, 5 */
+		0x2A,			/* inner: LD A, (HL+) */
+		0x12,			/* LD (DE), A */
+		0x1C,			/* INC E */
+		0xFE, 0x00,		/* CP 0x00 */
+		0x28, 0x05,		/* JR Z, skip */
+		0xFE, 0xC3,		/* CP 0xC3 */
+		0x20, 0x01,		/* JR NZ, skip */
+		0x37,			/* SCF */
+		0x05,			/* skip: DEC B */
+		0x20, 0xF1,		/* JR NZ, inner */
+		0x0D,			/* DEC C */
+		0x20, 0xEC,		/* JR NZ, mid */
+		0x7D,			/* LD A, L */
+		0xB1,			/* OR C */
+		0x20, 0xE6,		/* JR NZ, outer */
+		0x18, 0xE4);		/* JR outer */
+}
+
+static void run_fused(uint_fast32_t budget, char *out, size_t size)
+{
+	static struct gb_s gb;
+
+	test_gb_init(&gb);
+	run_frames(&gb, budget, out, size);
+
+#if PEANUT_GB_SUPERINSTRUCTION_STATS
+	/* Short runs end between the instructions of a pair. */
+	if(budget >= 100)
+	{
+		enum gb_fused_e fused;
+
+		for(fused = GB_FUSED_NONE + 1; fused < GB_FUSED_MAX; fused++)
+			TEST_CHECK(gb_get_fused_count(&gb, fused, NULL) > 0);
+	}
+#endif
+}
+
+/**
+ * A loop of ALU, DAA, rotate, shift and bit instructions with a mix of flags
+ * set by the instructions before them, and flags loaded from a register pair
+ * with POP AF. The flags are pushed and stored to WRAM after every few
+ * instructions.
+ */
+static void build_alu_rom(void)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	TEST_ROM_CODE(0x0150,
+		0x21, 0x00, 0xC0,	/* LD HL, 0xC000 */
+		0x01, 0x17, 0x39,	/* LD BC, 0x3917 */
+		0x11, 0x00, 0x00,	/* LD DE, 0x0000 */
+		0x80,			/* loop: ADD A, B */
+		0x27,			/* DAA */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x89,			/* ADC A, C */
+		0x27,			/* DAA */
+		0xCB, 0x11,		/* RL C */
+		0xCB, 0x38,		/* SRL B */
+		0x90,			/* SUB A, B */
+		0x27,			/* DAA */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0xCB, 0x37,		/* SWAP A */
+		0x99,			/* SBC A, C */
+		0x27,			/* DAA */
+		0xCB, 0x7F,		/* BIT 7, A */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x3C,			/* INC A */
+		0x38, 0x01,		/* JR C, no_ccf */
+		0x3F,			/* CCF */
+		0xCB, 0x1B,		/* no_ccf: RR E */
+		0xCB, 0x2A,		/* SRA D */
+		0x2F,			/* CPL */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0xE6, 0xF7,		/* AND 0xF7 */
+		0xCB, 0x06,		/* RLC (HL) */
+		0x17,			/* RLA */
+		0x1F,			/* RRA */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x09,			/* ADD HL, BC */
+		0x26, 0xC0,		/* LD H, 0xC0 */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x3D,			/* DEC A */
+		0xCE, 0x0F,		/* ADC A, 0x0F */
+		0xD6, 0x33,		/* SUB A, 0x33 */
+		0x27,			/* DAA */
+		0xB9,			/* CP C */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x7B,			/* LD A, E */
+		0xEE, 0x5A,		/* XOR 0x5A */
+		0x5F,			/* LD E, A */
+		0xD5, 0xF1,		/* PUSH DE; POP AF */
+		0x27,			/* DAA */
+		0xCE, 0x00,		/* ADC A, 0x00 */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x37,			/* SCF */
+		0x9F,			/* SBC A, A */
+		0xF6, 0x00,		/* OR 0x00 */
+		0xCB, 0x47,		/* BIT 0, A */
+		0xF5, 0xD1, 0x73, 0x2C,	/* PUSH AF; POP DE; LD (HL), E; INC L */
+		0x04,			/* INC B */
+		0x20, 0xA1,		/* JR NZ, loop */
+		0x18, 0x9F);		/* JR loop */
+}
+
+/**
+ * Runs FRAMES frames, and prints a hash of the flags stored to WRAM after
+ * them.
+ */
+static void run_alu(uint_fast32_t budget, char *out, size_t size)
+{
+	static struct gb_s gb;
+	size_t len;
+
+	test_gb_init(&gb);
+	run_frames(&gb, budget, out, size);
+
+	len = strlen(out);
+	len += snprintf(out + len, size - len, "wram %08lX\n",
+			(unsigned long)test_hash(TEST_HASH_INIT, gb.wram, 0x100));
+	TEST_CHECK(len < size);
+}
+
+/**
+ * Calls routines in WRAM and HRAM, and patches an immediate operand of each
+ * between calls, the WRAM one through echo RAM. Each routine also changes
+ * one of its later opcodes and one of its later operands before running them.
+ */
+static void build_patch_rom(void)
+{
+	test_rom_init(TEST_CART_ROM_ONLY);
+
+	TEST_ROM_CODE(0x0150,
+		0xCD, 0x00, 0xC0,	/* loop: CALL 0xC000 */
+		0xCD, 0x80, 0xFF,	/* CALL 0xFF80 */
+		0x78,			/* LD A, B */
+		0xEA, 0x01, 0xE0,	/* LD (0xE001), A */
+		0x7B,			/* LD A, E */
+		0xE0, 0x81,		/* LDH (0x81), A */
+		0x0C,			/* INC C */
+		0x18, 0xF0);		/* JR loop */
+}
+
+/**
+ * Copies the routine to addr, with the addresses that it patches relocated.
+ */
+static void copy_patch_routine(struct gb_s *gb, uint_fast16_t addr)
+{
+	const uint8_t routine[] = {
+		0x3E, 0x00,		/* LD A, 0x00 */
+		0x80,			/* ADD A, B */
+		0x47,			/* LD B, A */
+		0x21, 0x0B, 0x00,	/* LD HL, toggle */
+		0x7E,			/* LD A, (HL) */
+		0xEE, 0x01,		/* XOR 0x01 */
+		0x77,			/* LD (HL), A */
+		0x14,			/* toggle: INC D or DEC D */
+		0x21, 0x11, 0x00,	/* LD HL, operand */
+		0x34,			/* INC (HL) */
+		0xC6, 0x00,		/* ADD A, operand */
+		0x5F,			/* LD E, A */
+		0xC9			/* RET */
+	};
+	uint_fast16_t i;
+
+	for(i = 0; i < sizeof(routine); i++)
+		__gb_write(gb, addr + i, routine[i]);
+
+	__gb_write(gb, addr + 0x05, (addr + 0x0B) & 0xFF);
+	__gb_write(gb, addr + 0x06, (addr + 0x0B) >> 8);
+	__gb_write(gb, addr + 0x0D, (addr + 0x11) & 0xFF);
+	__gb_write(gb, addr + 0x0E, (addr + 0x11) >> 8);
+}
+
+static void run_patch(uint_fast32_t budget, char *out, size_t size)
+{
+	static struct gb_s gb;
+
+	test_gb_init(&gb);
+	copy_patch_routine(&gb, WRAM_0_ADDR);
+	copy_patch_routine(&gb, HRAM_ADDR);
+	run_frames(&gb, budget, out, size);
+
+#if PEANUT_GB_USE_BLOCK_CACHE
+	/* Blocks decoded from both pages were invalidated. */
+	if(!gb.block_cache.bypass)
+	{
+		TEST_CHECK(gb.block_cache.ram_gen[0xC] > 0);
+		TEST_CHECK(gb.block_cache.ram_gen[0xF] > 0);
+	}
+#endif
+}
+
+/**
+ * Runs the test with each budget, checks that all give the same output, and
+ * prints it.
+ */
+static void test(void (*run)(uint_fast32_t, char *, size_t))
+{
+	static char expected[4096], out[4096];
+	size_t i;
+
+	run(70224, expected, sizeof(expected));
+
+	for(i = 0; i < sizeof(budgets) / sizeof(*budgets); i++)
+	{
+		run(budgets[i], out, sizeof(out));
+		TEST_CHECK(strcmp(expected, out) == 0);
+	}
+
+	fputs(expected, stdout);
+}
+
+int main(void)
+{
+	build_halt_rom();
+	test(run_halt);
+
+	build_jit_rom();
+	test(run_jit);
+
+	build_fused_rom();
+	test(run_fused);
+
+	build_alu_rom();
+	test(run_alu);
+
+	build_patch_rom();
+	test(run_patch);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/**
+ * Helpers shared by the tests of the emulator core. Each test assembles a
+ * small ROM in memory, runs it and checks the result. The options of the core
+ * are set by the test target before this file is included.
+ */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peanut_gb.h"
+
+/* Size of the PSP scratchpad, which holds struct gb_s, OAM and HRAM/IO in the
+ * front end when memory is relocated. */
+#define TEST_SCRATCHPAD_SIZE	0x4000
+
+/* Number of 16 KiB ROM banks, a power of two. Tests of bank switching define
+ * more before including this file. */
+#ifndef TEST_ROM_BANKS
+# define TEST_ROM_BANKS		2
+#endif
+
+/* Cartridge types written to the ROM header. */
+#define TEST_CART_ROM_ONLY	0x00
+#define TEST_CART_MBC1_RAM	0x02
+#define TEST_CART_MBC3_RTC_RAM	0x10
+#define TEST_CART_MBC5_RAM	0x1A
+
+/* Fails the test if cond is false. */
+#define TEST_CHECK(cond)						\
+	do {								\
+		if(!(cond))						\
+		{							\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+					__FILE__, __LINE__, #cond);	\
+			exit(EXIT_FAILURE);				\
+		}							\
+	} while(0)
+
+/* Copies the instruction bytes given after addr to the ROM at addr. */
+#define TEST_ROM_CODE(addr, ...)					\
+	do {								\
+		const uint8_t code_[] = { __VA_ARGS__ };		\
+		memcpy(&test_rom[addr], code_, sizeof(code_));		\
+	} while(0)
+
+static uint8_t test_rom[TEST_ROM_BANKS * 0x4000];
+static uint8_t test_cart_ram[0x8000];
+
+static uint8_t test_rom_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	(void)gb;
+	return addr < sizeof(test_rom) ? test_rom[addr] : 0xFF;
+}
+
+static uint8_t test_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	(void)gb;
+	return test_cart_ram[addr % sizeof(test_cart_ram)];
+}
+
+static void test_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
+		const uint8_t val)
+{
+	(void)gb;
+	test_cart_ram[addr % sizeof(test_cart_ram)] = val;
+}
+
+static void test_error(struct gb_s *gb, const enum gb_error_e err,
+		const uint16_t addr)
+{
+	(void)gb;
+	fprintf(stderr, "emulator error %d at 0x%04X\n", (int)err, addr);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Clears the ROM and writes a header for the given cartridge type. The entry
+ * point jumps to 0x0150, where the code of the test starts.
+ */
+static void test_rom_init(uint8_t cart_type)
+{
+	uint8_t x = 0, rom_size = 0;
+	uint_fast16_t i;
+
+	memset(test_rom, 0x00, sizeof(test_rom));
+	memset(test_cart_ram, 0x00, sizeof(test_cart_ram));
+
+	/* NOP; JP 0x0150 */
+	TEST_ROM_CODE(0x0100, 0x00, 0xC3, 0x50, 0x01);
+	memcpy(&test_rom[0x0134], "PGBTEST", 7);
+	test_rom[0x0147] = cart_type;
+	/* ROM size is 32 KiB shifted left by this. */
+	while((0x8000u << rom_size) < sizeof(test_rom))
+		rom_size++;
+
+	test_rom[0x0148] = rom_size;
+	test_rom[0x0149] = cart_type == TEST_CART_ROM_ONLY ? 0x00 : 0x03;
+
+	for(i = 0x0134; i <= 0x014C; i++)
+		x = x - test_rom[i] - 1;
+
+	test_rom[0x014D] = x;
+}
+
+/**
+ * Initialises the emulator with the ROM and cart RAM of the test. Relocated
+ * memory is allocated on every call. With TEST_DIRECT, ROM and cart RAM are
+ * mapped with gb_init_direct() instead of being read through the callbacks.
+ */
+static void test_gb_init(struct gb_s *gb)
+{
+#if PEANUT_GB_RELOCATE_MEMORY
+	uint8_t *wram = calloc(WRAM_SIZE, 1);
+	uint8_t *vram = calloc(VRAM_SIZE, 1);
+	uint8_t *oam = calloc(OAM_SIZE, 1);
+	uint8_t *hram_io = calloc(HRAM_IO_SIZE, 1);
+
+	/* Pointers are wider on the host than on the PSP, so the context
+	 * fits the scratchpad there if it does here. */
+	TEST_CHECK(sizeof(struct gb_s) + OAM_SIZE + HRAM_IO_SIZE <=
+			TEST_SCRATCHPAD_SIZE);
+	TEST_CHECK(wram != NULL && vram != NULL && oam != NULL &&
+			hram_io != NULL);
+	gb_set_memory(gb, wram, vram, oam, hram_io);
+#endif
+	TEST_CHECK(gb_init(gb, &test_rom_read, &test_cart_ram_read,
+			&test_cart_ram_write, &test_error, NULL) ==
+			GB_INIT_NO_ERROR);
+#if TEST_DIRECT
+	gb_init_direct(gb, test_rom, sizeof(test_rom), test_cart_ram,
+			sizeof(test_cart_ram));
+#endif
+}
+
+/**
+ * Continues the FNV-1a hash h over n bytes at p.
+ */
+static inline uint32_t test_hash(uint32_t h, const void *p, size_t n)
+{
+	const uint8_t *b = (const uint8_t *)p;
+
+	while(n--)
+	{
+		h ^= *b++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+#define TEST_HASH_INIT	2166136261u
+
+static uint32_t test_rand_state = 0x12345678;
+
+/**
+ * Returns a pseudo-random number. The sequence is the same on every host.
+ */
+static inline uint32_t test_rand(void)
+{
+	test_rand_state ^= test_rand_state << 13;
+	test_rand_state ^= test_rand_state >> 17;
+	test_rand_state ^= test_rand_state << 5;
+	return test_rand_state;
+}
+
+#endif /* TEST_COMMON_H */